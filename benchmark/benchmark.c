@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEBUG
+#include "board.h"
+#include "debug.h"
+#include "engine.h"
+#include "move.h"
+#include "playout.h"
+#include "playout/light.h"
+#include "playout/moggy.h"
+#include "probdist.h"
+#include "random.h"
+#include "t-unit/test.h"
+#include "timeinfo.h"
+#include "benchmark/benchmark.h"
+
+
+/* This engine measures the playout performance: it plays a fixed number
+ * of random games from each position, with a fixed random seed, and
+ * reports playouts/s, average game length and, for the moggy policy,
+ * the time share of each heuristic. */
+
+/* Pass me arguments like a=b,c=d,...
+ * Supported arguments:
+ * games=N			number of playouts per position (1000)
+ * seed=N			random seed, reset for each position (1)
+ * playout={light,moggy}[:playout_params]	playout policy (moggy)
+ * positions=FILE		benchmark the boards of a t-unit-style file
+ *				(only the "boardsize" blocks are used)
+ *				and exit; otherwise, each genmove
+ *				benchmarks the current board and passes
+ * probdist=N			time N probdist picks on an empty 19x19 board,
+ *				each followed by an update of the picked
+ *				point and its 8-neighborhood, then N picks
+ *				from a static and a frozen distribution,
+ *				and exit
+ */
+
+
+struct benchmark {
+	int games;
+	int seed;
+	char *playout;
+	char *positions;
+	int probdist;
+};
+
+struct benchmark_stats {
+	int games;
+	long moves;
+	double time;
+	struct moggy_stats moggy;
+};
+
+
+static struct playout_policy *
+benchmark_policy(struct benchmark *bm, struct board *b)
+{
+	/* The policy options are consumed by the parser. */
+	char *spec = strdup(bm->playout);
+	char *playoutarg = strchr(spec, ':');
+	if (playoutarg)
+		*playoutarg++ = 0;
+	struct playout_policy *policy = NULL;
+	if (!strcasecmp(spec, "moggy")) {
+		policy = playout_moggy_init(playoutarg, b, NULL);
+	} else if (!strcasecmp(spec, "light")) {
+		policy = playout_light_init(playoutarg, b);
+	} else {
+		fprintf(stderr, "Benchmark: Invalid playout policy %s\n", spec);
+		exit(1);
+	}
+	free(spec);
+	return policy;
+}
+
+/* Play bm->games playouts from b, alternating the color to play. */
+static void
+benchmark_position(struct benchmark *bm, struct board *b, enum stone color, struct benchmark_stats *s)
+{
+	struct playout_policy *policy = benchmark_policy(bm, b);
+	struct playout_setup setup = { .gamelen = MAX_GAMELEN };
+	struct playout_amafmap amaf;
+
+	fast_srandom(bm->seed);
+	playout_moggy_profile(&s->moggy);
+	for (int i = 0; i < bm->games; i++) {
+		struct board b2;
+		board_copy(&b2, b);
+		amaf.gamelen = amaf.game_baselen = 0;
+
+		double start = time_now();
+		play_random_game(&setup, &b2, i & 1 ? stone_other(color) : color, &amaf, NULL, policy);
+		s->time += time_now() - start;
+		s->moves += amaf.gamelen;
+		s->games++;
+
+		board_done_noalloc(&b2);
+	}
+	playout_moggy_profile(NULL);
+	playout_policy_done(policy);
+}
+
+static void
+benchmark_print(struct benchmark_stats *s, char *title)
+{
+	fprintf(stderr, "%s: %d games in %.2fs, %.0f playouts/s, %.1f moves/game\n",
+		title, s->games, s->time, s->games / s->time, (double) s->moves / s->games);
+}
+
+static void
+benchmark_print_moggy(struct benchmark_stats *s)
+{
+	if (!s->moggy.calls[MH_PERMIT])
+		return;
+	fprintf(stderr, "%-26s %10s %8s %8s\n", "heuristic", "calls/game", "hit%", "time%");
+	for (int h = 0; h < MH_MAX; h++) {
+		unsigned long calls = s->moggy.calls[h];
+		fprintf(stderr, "%-26s %10.1f %8.1f %8.1f\n", moggy_heuristic_names[h],
+			(double) calls / s->games,
+			calls ? 100.0 * s->moggy.hits[h] / calls : 0,
+			100.0 * s->moggy.time[h] / s->time);
+	}
+}
+
+static void
+benchmark_sum(struct benchmark_stats *dst, struct benchmark_stats *src)
+{
+	dst->games += src->games;
+	dst->moves += src->moves;
+	dst->time += src->time;
+	for (int h = 0; h < MH_MAX; h++) {
+		dst->moggy.calls[h] += src->moggy.calls[h];
+		dst->moggy.hits[h] += src->moggy.hits[h];
+		dst->moggy.time[h] += src->moggy.time[h];
+	}
+}
+
+static void
+benchmark_file(struct benchmark *bm)
+{
+	FILE *f = fopen(bm->positions, "r");
+	if (!f) {
+		perror(bm->positions);
+		exit(EXIT_FAILURE);
+	}
+
+	struct board *b = board_init(NULL);
+	b->komi = 7.5;
+	struct benchmark_stats total;
+	memset(&total, 0, sizeof(total));
+	int n = 0;
+
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "boardsize ", 10))
+			continue;
+		board_load(b, f, atoi(line + 10));
+
+		struct benchmark_stats s;
+		memset(&s, 0, sizeof(s));
+		benchmark_position(bm, b, S_BLACK, &s);
+		char title[64];
+		snprintf(title, sizeof(title), "Position %d (%dx%d)", ++n, real_board_size(b), real_board_size(b));
+		benchmark_print(&s, title);
+		benchmark_sum(&total, &s);
+	}
+	fclose(f);
+	board_done(b);
+
+	if (!n) {
+		fprintf(stderr, "%s: No positions found\n", bm->positions);
+		exit(EXIT_FAILURE);
+	}
+	benchmark_print(&total, "Total");
+	benchmark_print_moggy(&total);
+}
+
+static fixp_t
+benchmark_gamma(void)
+{
+	return 1 + fast_irandom(4 * FIXP_SCALE);
+}
+
+/* Mimic a gamma-weighted playout: one pick per move, after which the
+ * move's weight drops to zero and its neighbors get new weights. */
+static void
+benchmark_probdist(struct benchmark *bm)
+{
+	struct board *b = board_init(NULL);
+	board_resize(b, 19);
+	board_clear(b);
+	fast_srandom(bm->seed);
+
+	probdist_alloca(pd, b);
+	int picks = 0;
+	double start = time_now();
+	while (picks < bm->probdist) {
+		foreach_free_point(b) {
+			probdist_set(&pd, c, benchmark_gamma());
+		} foreach_free_point_end;
+		for (int moves = 0; moves < 300 && picks < bm->probdist; moves++, picks++) {
+			coord_t m = probdist_pick(&pd, (coord_t[]){ pass });
+			probdist_set(&pd, m, 0);
+			foreach_8neighbor(b, m) {
+				if (probdist_one(&pd, c))
+					probdist_set(&pd, c, benchmark_gamma());
+			} foreach_8neighbor_end;
+		}
+	}
+	double time = time_now() - start;
+	fprintf(stderr, "probdist: %d picks+updates in %.2fs, %.1f ns each\n", picks, time, time * 1e9 / picks);
+
+	/* Static distribution, first as is, then frozen. */
+	foreach_free_point(b) {
+		probdist_set(&pd, c, benchmark_gamma());
+	} foreach_free_point_end;
+	probdist_alias_alloca(pa, b);
+	for (int frozen = 0; frozen < 2; frozen++) {
+		start = time_now();
+		if (frozen)
+			probdist_freeze(&pd, &pa);
+		for (picks = 0; picks < bm->probdist; picks++)
+			probdist_pick(&pd, (coord_t[]){ pass });
+		time = time_now() - start;
+		fprintf(stderr, "probdist: %d %s picks in %.2fs, %.1f ns each\n",
+			picks, frozen ? "frozen" : "static", time, time * 1e9 / picks);
+	}
+
+	board_done(b);
+}
+
+
+static coord_t *
+benchmark_genmove(struct engine *e, struct board *b, struct time_info *ti, enum stone color, bool pass_all_alive)
+{
+	struct benchmark *bm = e->data;
+	struct benchmark_stats s;
+	memset(&s, 0, sizeof(s));
+	benchmark_position(bm, b, color, &s);
+	benchmark_print(&s, "Benchmark");
+	benchmark_print_moggy(&s);
+	return coord_copy(pass);
+}
+
+static void
+benchmark_done(struct engine *e)
+{
+	struct benchmark *bm = e->data;
+	free(bm->playout);
+	free(bm->positions);
+}
+
+struct benchmark *
+benchmark_state_init(char *arg, struct board *b)
+{
+	struct benchmark *bm = calloc2(1, sizeof(struct benchmark));
+
+	bm->games = 1000;
+	bm->seed = 1;
+
+	if (arg) {
+		char *optspec, *next = arg;
+		while (*next) {
+			optspec = next;
+			next += strcspn(next, ",");
+			if (*next) { *next++ = 0; } else { *next = 0; }
+
+			char *optname = optspec;
+			char *optval = strchr(optspec, '=');
+			if (optval) *optval++ = 0;
+
+			if (!strcasecmp(optname, "games") && optval) {
+				bm->games = atoi(optval);
+			} else if (!strcasecmp(optname, "seed") && optval) {
+				bm->seed = atoi(optval);
+			} else if (!strcasecmp(optname, "playout") && optval) {
+				bm->playout = strdup(optval);
+			} else if (!strcasecmp(optname, "positions") && optval) {
+				bm->positions = strdup(optval);
+			} else if (!strcasecmp(optname, "probdist") && optval) {
+				bm->probdist = atoi(optval);
+			} else {
+				fprintf(stderr, "Benchmark: Invalid engine argument %s or missing value\n", optname);
+				exit(1);
+			}
+		}
+	}
+
+	if (!bm->playout)
+		bm->playout = strdup("moggy");
+
+	return bm;
+}
+
+
+struct engine *
+engine_benchmark_init(char *arg, struct board *b)
+{
+	struct benchmark *bm = benchmark_state_init(arg, b);
+	if (bm->probdist) {
+		benchmark_probdist(bm);
+		exit(0);
+	}
+	if (bm->positions) {
+		benchmark_file(bm);
+		exit(0);
+	}
+
+	struct engine *e = calloc2(1, sizeof(struct engine));
+	e->name = "PlayoutBenchmark";
+	e->comment = "I only measure playout speed and always pass.";
+	e->genmove = benchmark_genmove;
+	e->done = benchmark_done;
+	e->data = bm;
+
+	return e;
+}
@@ -0,0 +1,8 @@
+#ifndef PACHI_BENCHMARK_BENCHMARK_H
+#define PACHI_BENCHMARK_BENCHMARK_H
+
+#include "engine.h"
+
+struct engine *engine_benchmark_init(char *arg, struct board *b);
+
+#endif
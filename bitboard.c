@@ -0,0 +1,311 @@
+#include <string.h>
+
+#include "bitboard.h"
+#include "board.h"
+#include "move.h"
+#include "ownermap.h"
+#include "random.h"
+
+
+/* Word @i of bitset @s shifted by @k bits towards higher (shl) or lower
+ * (shr) coordinates. Neighbors of a point are at +-1 and +-size;
+ * shifting over the row end falls on the edge, so stone sets need
+ * no further masking. */
+
+static inline uint64_t
+shl(const uint64_t *s, int i, int k)
+{
+	return s[i] << k | (i > 0 ? s[i - 1] >> (64 - k) : 0);
+}
+
+static inline uint64_t
+shr(const uint64_t *s, int i, int k, int n)
+{
+	return s[i] >> k | (i < n - 1 ? s[i + 1] << (64 - k) : 0);
+}
+
+static inline uint64_t
+neighbors(const uint64_t *s, int i, int size, int n)
+{
+	return shl(s, i, 1) | shr(s, i, 1, n) | shl(s, i, size) | shr(s, i, size, n);
+}
+
+
+void
+bitboard_init(struct bitboard *bb, struct board *b)
+{
+	memset(bb, 0, sizeof(*bb));
+	bb->size = board_size(b);
+	bb->words = (board_size2(b) + 63) / 64;
+	for (int c = board_size2(b); c < bb->words * 64; c++)
+		bb->stones[S_OFFBOARD][c >> 6] |= 1ULL << (c & 63);
+
+	foreach_point(b) {
+		enum stone s = board_at(b, c);
+		bb->stones[s][c >> 6] |= 1ULL << (c & 63);
+		int x = coord_x(c, b), y = coord_y(c, b);
+		if (s != S_OFFBOARD && (x == 1 || y == 1 || x == bb->size - 2 || y == bb->size - 2))
+			bb->edge[c >> 6] |= 1ULL << (c & 63);
+	} foreach_point_end;
+
+	bb->ko = b->ko;
+	memcpy(bb->captures, b->captures, sizeof(bb->captures));
+	bb->moves = b->moves;
+	bb->komi = b->komi + (b->rules != RULES_SIMING ? b->handicap : 0);
+	bb->rules = b->rules;
+}
+
+
+/* Flood fill the group of @color at @c into @g, until we find its first
+ * liberty. Returns true if the group has no liberty, @g being the whole
+ * group then. */
+static bool
+bitboard_group_captured(struct bitboard *bb, coord_t c, enum stone color, uint64_t *g)
+{
+	int n = bb->words;
+	memset(g, 0, n * sizeof(*g));
+	g[c >> 6] = 1ULL << (c & 63);
+	bool grown;
+	do {
+		grown = false;
+		for (int i = 0; i < n; i++) {
+			uint64_t nei = neighbors(g, i, bb->size, n);
+			if (nei & bb->stones[S_NONE][i])
+				return false;
+			uint64_t x = (g[i] | nei) & bb->stones[color][i];
+			if (x != g[i]) {
+				g[i] = x;
+				grown = true;
+			}
+		}
+	} while (grown);
+	/* The last pass saw the whole group and no liberty. */
+	return true;
+}
+
+static inline bool
+bitboard_point_has_lib(struct bitboard *bb, coord_t c)
+{
+	return bitboard_at(bb, c - 1, S_NONE) || bitboard_at(bb, c + 1, S_NONE)
+		|| bitboard_at(bb, c - bb->size, S_NONE) || bitboard_at(bb, c + bb->size, S_NONE);
+}
+
+/* Remove the group @g of @color; returns the number of stones. */
+static int
+bitboard_group_capture(struct bitboard *bb, uint64_t *g, enum stone color)
+{
+	int stones = 0;
+	for (int i = 0; i < bb->words; i++) {
+		bb->stones[color][i] &= ~g[i];
+		bb->stones[S_NONE][i] |= g[i];
+		stones += __builtin_popcountll(g[i]);
+	}
+	bb->captures[stone_other(color)] += stones;
+	return stones;
+}
+
+int
+bitboard_play(struct bitboard *bb, struct move *m)
+{
+	coord_t coord = m->coord;
+	enum stone color = m->color, other = stone_other(color);
+
+	if (unlikely(is_pass(coord))) {
+		if (bb->rules == RULES_SIMING)
+			bb->captures[other]++;
+		bb->ko.coord = pass; bb->ko.color = S_NONE;
+		bb->moves++;
+		return 0;
+	}
+	if (!bitboard_at(bb, coord, S_NONE)
+	    || (coord == bb->ko.coord && color == bb->ko.color))
+		return -1;
+
+	coord_t nei[4] = { coord - 1, coord + 1, coord - bb->size, coord + bb->size };
+	bool libs = false, eyelike = true;
+	for (int k = 0; k < 4; k++) {
+		if (bitboard_at(bb, nei[k], S_NONE))
+			libs = true, eyelike = false;
+		else if (bitboard_at(bb, nei[k], color))
+			eyelike = false;
+	}
+
+	uint64_t bit = 1ULL << (coord & 63);
+	bb->stones[S_NONE][coord >> 6] &= ~bit;
+	bb->stones[color][coord >> 6] |= bit;
+
+	uint64_t g[BITBOARD_WORDS];
+	int caps = 0; coord_t cap_at = pass;
+	for (int k = 0; k < 4; k++) {
+		/* The stone may be gone already if a previous neighbor was
+		 * part of the same captured group. */
+		if (!bitboard_at(bb, nei[k], other) || bitboard_point_has_lib(bb, nei[k]))
+			continue;
+		if (!bitboard_group_captured(bb, nei[k], other, g))
+			continue;
+		caps += bitboard_group_capture(bb, g, other);
+		cap_at = nei[k];
+	}
+
+	if (!libs && !caps) {
+		if (bitboard_group_captured(bb, coord, color, g)) {
+			if (eyelike) {
+				/* Single-stone suicide, take it back. */
+				bb->stones[color][coord >> 6] &= ~bit;
+				bb->stones[S_NONE][coord >> 6] |= bit;
+				return -1;
+			}
+			bitboard_group_capture(bb, g, color);
+		}
+	}
+
+	if (eyelike && caps == 1) {
+		bb->ko.coord = cap_at; bb->ko.color = other;
+	} else {
+		bb->ko.coord = pass; bb->ko.color = S_NONE;
+	}
+	bb->moves++;
+	return 0;
+}
+
+
+/* Word @i of the 1pt eyes of @color; bit-parallel version of
+ * board_is_one_point_eye(). */
+static inline uint64_t
+bitboard_eyes(struct bitboard *bb, int i, enum stone color, uint64_t *notown)
+{
+	int n = bb->words, size = bb->size;
+	uint64_t *enemy = bb->stones[stone_other(color)];
+	uint64_t eyelike = bb->stones[S_NONE][i] & ~neighbors(notown, i, size, n);
+	if (!eyelike)
+		return 0;
+
+	/* False eye: at least two enemy diagonal neighbors, the edge
+	 * counting as one. */
+	uint64_t diag[5] = {
+		shl(enemy, i, size - 1), shl(enemy, i, size + 1),
+		shr(enemy, i, size - 1, n), shr(enemy, i, size + 1, n),
+		bb->edge[i],
+	};
+	uint64_t one = 0, two = 0;
+	for (int k = 0; k < 5; k++) {
+		two |= one & diag[k];
+		one |= diag[k];
+	}
+	return eyelike & ~two;
+}
+
+/* Points not owned by @color: free points and enemy stones. */
+static inline void
+bitboard_notown(struct bitboard *bb, enum stone color, uint64_t *notown)
+{
+	for (int i = 0; i < bb->words; i++)
+		notown[i] = ~(bb->stones[color][i] | bb->stones[S_OFFBOARD][i]);
+}
+
+/* Next set bit of @s at or after @c, wrapping around; pass if empty. */
+static coord_t
+bitset_next(uint64_t *s, int n, coord_t c)
+{
+	int i = c >> 6;
+	uint64_t w = s[i] & (~0ULL << (c & 63));
+	for (int k = 0; k <= n; k++) {
+		if (w)
+			return i * 64 + __builtin_ctzll(w);
+		i = (i + 1) % n;
+		w = s[i];
+	}
+	return pass;
+}
+
+coord_t
+bitboard_play_random(struct bitboard *bb, enum stone color)
+{
+	int n = bb->words;
+	uint64_t notown[BITBOARD_WORDS], cand[BITBOARD_WORDS];
+	bitboard_notown(bb, color, notown);
+	for (int i = 0; i < n; i++)
+		cand[i] = bb->stones[S_NONE][i] & ~bitboard_eyes(bb, i, color, notown);
+
+	coord_t c = fast_random(bb->size * bb->size);
+	while ((c = bitset_next(cand, n, c)) != pass) {
+		struct move m = { c, color };
+		if (bitboard_play(bb, &m) >= 0)
+			return c;
+		cand[c >> 6] &= ~(1ULL << (c & 63));
+	}
+
+	struct move m = { pass, color };
+	bitboard_play(bb, &m);
+	return pass;
+}
+
+
+floating_t
+bitboard_fast_score(struct bitboard *bb)
+{
+	int scores[S_MAX] = { 0 };
+	uint64_t notown[S_MAX][BITBOARD_WORDS];
+	bitboard_notown(bb, S_BLACK, notown[S_BLACK]);
+	bitboard_notown(bb, S_WHITE, notown[S_WHITE]);
+	for (int i = 0; i < bb->words; i++) {
+		for (enum stone color = S_BLACK; color <= S_WHITE; color++) {
+			scores[color] += __builtin_popcountll(bb->stones[color][i]);
+			if (bb->rules != RULES_STONES_ONLY)
+				scores[color] += __builtin_popcountll(bitboard_eyes(bb, i, color, notown[color]));
+		}
+	}
+	return bb->komi + scores[S_WHITE] - scores[S_BLACK];
+}
+
+void
+bitboard_ownermap_fill(struct board_ownermap *ownermap, struct bitboard *bb)
+{
+	uint64_t notown[S_MAX][BITBOARD_WORDS];
+	bitboard_notown(bb, S_BLACK, notown[S_BLACK]);
+	bitboard_notown(bb, S_WHITE, notown[S_WHITE]);
+
+	ownermap->playouts++;
+	int size2 = bb->size * bb->size;
+	for (int i = 0; i < bb->words; i++) {
+		uint64_t owner[S_MAX] = {
+			[S_BLACK] = bb->stones[S_BLACK][i] | bitboard_eyes(bb, i, S_BLACK, notown[S_BLACK]),
+			[S_WHITE] = bb->stones[S_WHITE][i] | bitboard_eyes(bb, i, S_WHITE, notown[S_WHITE]),
+			[S_OFFBOARD] = bb->stones[S_OFFBOARD][i],
+		};
+		for (int c = i * 64; c < i * 64 + 64 && c < size2; c++) {
+			uint64_t bit = 1ULL << (c & 63);
+			enum stone color = owner[S_WHITE] & bit ? S_WHITE
+			                 : owner[S_BLACK] & bit ? S_BLACK
+					 : owner[S_OFFBOARD] & bit ? S_OFFBOARD : S_NONE;
+			ownermap->map[c][color]++;
+		}
+	}
+}
+
+void
+bitboard_store_stones(struct bitboard *bb, struct board *b)
+{
+	foreach_point(b) {
+		enum stone color = bitboard_at(bb, c, S_BLACK) ? S_BLACK
+		                 : bitboard_at(bb, c, S_WHITE) ? S_WHITE
+				 : bitboard_at(bb, c, S_NONE) ? S_NONE : board_at(b, c);
+		enum stone old = board_at(b, c);
+		if (color == old)
+			continue;
+		/* The board may be journaled (uct journal_board). */
+		board_journal_touch(b, c);
+		board_at(b, c) = color;
+		/* Keep neighbor counts, for board_is_one_point_eye() in
+		 * board_local_value(). */
+		foreach_neighbor(b, c, {
+			board_journal_touch(b, c);
+			if (old != S_NONE)
+				dec_neighbor_count_at(b, c, old);
+			if (color != S_NONE)
+				inc_neighbor_count_at(b, c, color);
+		});
+	} foreach_point_end;
+	memcpy(b->captures, bb->captures, sizeof(b->captures));
+	b->moves = bb->moves;
+}
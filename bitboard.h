@@ -0,0 +1,69 @@
+#ifndef PACHI_BITBOARD_H
+#define PACHI_BITBOARD_H
+
+/* Bitboard representation of the board, for cheap playouts. We keep
+ * a bitset of the points of each color, indexed by coord_t (edges
+ * included, like in struct board). Nothing else is tracked: groups,
+ * liberties, captures and eyes are computed by bit-parallel flood
+ * fills and neighbor shifts when needed. This is enough for uniformly
+ * random playouts (see playout/light.c); use struct board for anything
+ * smarter. */
+
+#include <stdint.h>
+
+#include "board.h"
+#include "move.h"
+
+struct board_ownermap;
+
+#define BITBOARD_WORDS ((BOARD_MAX_COORDS + 63) / 64)
+
+struct bitboard {
+	int size; // board_size(), incl. edges
+	int words; // words used for this board size
+	/* Points of each color; [S_NONE] are the free points and
+	 * [S_OFFBOARD] the edges and unused bits of the last word. */
+	uint64_t stones[S_MAX][BITBOARD_WORDS];
+	/* On-board points with an edge diagonal neighbor (first line). */
+	uint64_t edge[BITBOARD_WORDS];
+
+	struct move ko;
+	int captures[S_MAX];
+	int moves;
+
+	floating_t komi; // incl. handicap compensation
+	enum go_ruleset rules;
+};
+
+/* Set up @bb with the position of @b. */
+void bitboard_init(struct bitboard *bb, struct board *b);
+
+/* Returns -1 if the move is illegal (occupied, ko or single-stone
+ * suicide), 0 otherwise. Multi-stone suicide is allowed like in
+ * board_play(). */
+int bitboard_play(struct bitboard *bb, struct move *m);
+
+/* Play a random move which is not filling our own 1pt eye (like
+ * board_play_random() with board_permit()), or pass if there is none. */
+coord_t bitboard_play_random(struct bitboard *bb, enum stone color);
+
+/* Stones + 1pt eyes score like board_fast_score(). Positive: W wins. */
+floating_t bitboard_fast_score(struct bitboard *bb);
+
+/* Like board_ownermap_fill(). */
+void bitboard_ownermap_fill(struct board_ownermap *ownermap, struct bitboard *bb);
+
+/* Copy the stone colors, neighbor counts and capture counts back to
+ * @b. Group information of @b is left stale, so afterwards @b is good
+ * only for board_at() and neighbor_count_at() queries (final position
+ * evaluation) and must be thrown away, or rolled back if it is
+ * journaled. */
+void bitboard_store_stones(struct bitboard *bb, struct board *b);
+
+static inline bool
+bitboard_at(struct bitboard *bb, coord_t c, enum stone color)
+{
+	return (bb->stones[color][c >> 6] >> (c & 63)) & 1;
+}
+
+#endif
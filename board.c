@@ -13,6 +13,10 @@
 
 #ifdef BOARD_SPATHASH
 #include "patternsp.h"
+#if BOARD_SPATHASH_MAXD > MAX_PATTERN_DIST
+#error BOARD_SPATHASH_MAXD cannot exceed MAX_PATTERN_DIST
+#endif
+static void board_spathash_recompute(struct board *board);
 #endif
 #ifdef BOARD_PAT3
 #include "pattern3.h"
@@ -57,69 +61,59 @@ board_init(char *fbookfile)
 	return b;
 }
 
+/* Lay out the board arrays in x and return their byte size. With x
+ * NULL, only compute the size. */
 static size_t
-board_alloc(struct board *board)
+board_alloc_at(struct board *board, void *x)
 {
-	/* We do not allocate the board structure itself but we allocate
-	 * all the arrays with board contents. */
+	size_t size = 0;
+#define board_array(field_, n_) \
+	do { \
+		if (x) board->field_ = x + size; \
+		size += (n_) * sizeof(*board->field_); \
+	} while (0)
 
-	int bsize = board_size2(board) * sizeof(*board->b);
-	int gsize = board_size2(board) * sizeof(*board->g);
-	int fsize = board_size2(board) * sizeof(*board->f);
-	int nsize = board_size2(board) * sizeof(*board->n);
-	int psize = board_size2(board) * sizeof(*board->p);
-	int hsize = board_size2(board) * 2 * sizeof(*board->h);
-	int gisize = board_size2(board) * sizeof(*board->gi);
+	/* board->b must come first */
+	board_array(b, board_size2(board));
+	board_array(g, board_size2(board));
+	board_array(f, board_size2(board));
+	board_array(p, board_size2(board));
+	board_array(n, board_size2(board));
+	board_array(h, board_size2(board) * 2);
+	board_array(gi, board_size2(board));
 #ifdef WANT_BOARD_C
-	int csize = board_size2(board) * sizeof(*board->c);
-#else
-	int csize = 0;
+	board_array(c, board_size2(board));
 #endif
 #ifdef BOARD_SPATHASH
-	int ssize = board_size2(board) * sizeof(*board->spathash);
-#else
-	int ssize = 0;
+	board_array(spathash, board_size2(board));
 #endif
 #ifdef BOARD_PAT3
-	int p3size = board_size2(board) * sizeof(*board->pat3);
-#else
-	int p3size = 0;
+	board_array(pat3, board_size2(board));
 #endif
 #ifdef BOARD_TRAITS
-	int tsize = board_size2(board) * sizeof(*board->t);
-	int tqsize = board_size2(board) * sizeof(*board->t);
-#else
-	int tsize = 0;
-	int tqsize = 0;
+	board_array(t, board_size2(board));
+	board_array(tq, board_size2(board));
 #endif
-	int cdsize = board_size2(board) * sizeof(*board->coord);
+	board_array(coord, board_size2(board));
 
-	size_t size = bsize + gsize + fsize + psize + nsize + hsize + gisize + csize + ssize + p3size + tsize + tqsize + cdsize;
-	void *x = malloc2(size);
+#undef board_array
+	return size;
+}
 
-	/* board->b must come first */
-	board->b = x; x += bsize;
-	board->g = x; x += gsize;
-	board->f = x; x += fsize;
-	board->p = x; x += psize;
-	board->n = x; x += nsize;
-	board->h = x; x += hsize;
-	board->gi = x; x += gisize;
-#ifdef WANT_BOARD_C
-	board->c = x; x += csize;
-#endif
-#ifdef BOARD_SPATHASH
-	board->spathash = x; x += ssize;
-#endif
-#ifdef BOARD_PAT3
-	board->pat3 = x; x += p3size;
-#endif
-#ifdef BOARD_TRAITS
-	board->t = x; x += tsize;
-	board->tq = x; x += tqsize;
-#endif
-	board->coord = x; x += cdsize;
+/* Byte size of all the arrays with board contents. */
+static size_t
+board_alloc_size(struct board *board)
+{
+	return board_alloc_at(board, NULL);
+}
 
+static size_t
+board_alloc(struct board *board)
+{
+	/* We do not allocate the board structure itself but we allocate
+	 * all the arrays with board contents. */
+	size_t size = board_alloc_size(board);
+	board_alloc_at(board, malloc2(size));
 	return size;
 }
 
@@ -149,16 +143,13 @@ board_cmp(struct board *b1, struct board *b2)
 		    &p1[i] != (void**)&b1->t &&
 		    &p1[i] != (void**)&b1->tq &&
 #endif
-		    &p1[i] != (void**)&b1->coord)
+		    &p1[i] != (void**)&b1->coord &&
+		    &p1[i] != (void**)&b1->journal)
 			return 1;
 
-	/* Find alloc size */
-	struct board tmp;
-	board_setup(&tmp);
-	size_t size = board_alloc(&tmp);
-	board_done_noalloc(&tmp);
-	
-	return memcmp(b1->b, b2->b, size);
+	if (b1->size != b2->size)
+		return 1;
+	return memcmp(b1->b, b2->b, board_alloc_size(b1));
 }
 
 int
@@ -226,16 +217,48 @@ board_copy(struct board *b2, struct board *b1)
 	// XXX: Special semantics.
 	b2->fbook = NULL;
 	b2->ps = NULL;
+	b2->journal = NULL;
+
+	return b2;
+}
+
+struct board *
+board_copy_buf(struct board *b2, struct board *b1, void **buf, size_t *bufsize)
+{
+	memcpy(b2, b1, sizeof(struct board));
+
+	size_t size = board_alloc_size(b2);
+	if (size > *bufsize) {
+		free(*buf);
+		*buf = malloc2(size);
+		*bufsize = size;
+	}
+	board_alloc_at(b2, *buf);
+	memcpy(b2->b, b1->b, size);
+
+	// XXX: Special semantics.
+	b2->fbook = NULL;
+	b2->ps = NULL;
+	b2->journal = NULL;
 
 	return b2;
 }
 
+void
+board_done_buf(struct board *board)
+{
+	if (board->fbook) fbook_done(board->fbook);
+	if (board->ps) free(board->ps);
+	if (board->journal) board_journal_done(board);
+}
+
 void
 board_done_noalloc(struct board *board)
 {
 	if (board->b) free(board->b);
 	if (board->fbook) fbook_done(board->fbook);
 	if (board->ps) free(board->ps);
+	if (board->journal) board_journal_done(board);
 }
 
 void
@@ -347,17 +370,8 @@ board_init_data(struct board *board)
 
 #ifdef BOARD_SPATHASH
 	/* Initialize spatial hashes. */
-	foreach_point(board) {
-		for (int d = 1; d <= BOARD_SPATHASH_MAXD; d++) {
-			for (int j = ptind[d]; j < ptind[d + 1]; j++) {
-				ptcoords_at(x, y, c, board, j);
-				board->spathash[coord_xy(board, x, y)][d - 1][0] ^=
-					pthashes[0][j][board_at(board, c)];
-				board->spathash[coord_xy(board, x, y)][d - 1][1] ^=
-					pthashes[0][j][stone_other(board_at(board, c))];
-			}
-		}
-	} foreach_point_end;
+	board_spathash_recompute(board);
+	board->spathash_ndirty = 0;
 #endif
 #ifdef BOARD_PAT3
 	/* Initialize 3x3 pattern codes. */
@@ -527,6 +541,140 @@ board_print(struct board *board, FILE *f)
 }
 
 
+/* Undo journal (see board_journal_mark()). Per-point state is saved the
+ * first time a point is touched after the latest mark, slots of the f[],
+ * c[], tq[] queues and of the history hash table on every write, the
+ * scalar board state at the mark itself. */
+
+struct board_journal_point {
+	coord_t coord;
+	enum stone b;
+	group_t g;
+	coord_t p;
+	struct neighbor_colors n;
+#ifdef BOARD_SPATHASH
+	spathash_t spathash;
+#endif
+#ifdef BOARD_PAT3
+	hash3_t pat3;
+#endif
+#ifdef BOARD_TRAITS
+	struct btraits t[2];
+#endif
+	/* Info of the group based at coord, if any. */
+	struct group gi;
+};
+
+struct board_journal_slot {
+	coord_t *at;
+	coord_t old;
+};
+
+struct board_journal_hash {
+	int i;
+	hash_t old;
+};
+
+struct board_journal_mark {
+	unsigned int epoch;
+	int npoints, nslots, nhashes;
+
+	int captures[S_MAX];
+	floating_t komi;
+	int moves;
+	struct move last_move, last_move2, last_move3, last_move4;
+	bool superko_violation;
+	int flen, clen, tqlen, spathash_ndirty;
+	struct board_symmetry symmetry;
+	struct move last_ko;
+	int last_ko_age;
+	struct move ko;
+	hash_t hash, qhash[4];
+};
+
+struct board_journal {
+	/* Points whose stamp equals epoch are saved already;
+	 * epoch 0 means there is no mark and nothing is recorded. */
+	unsigned int epoch, last_epoch;
+	unsigned int stamp[BOARD_MAX_COORDS];
+
+	struct board_journal_point *points;
+	int npoints, points_alloc;
+	struct board_journal_slot *slots;
+	int nslots, slots_alloc;
+	struct board_journal_hash *hashes;
+	int nhashes, hashes_alloc;
+	struct board_journal_mark *marks;
+	int nmarks, marks_alloc;
+};
+
+#define journal_grow(array_, n_, alloc_) \
+	do { \
+		if (unlikely((n_) >= (alloc_))) { \
+			(alloc_) = (alloc_) ? (alloc_) * 2 : 256; \
+			(array_) = realloc((array_), (alloc_) * sizeof(*(array_))); \
+			if (!(array_)) { perror("realloc"); exit(1); } \
+		} \
+	} while (0)
+
+static void profiling_noinline
+board_journal_save_point(struct board *board, struct board_journal *j, coord_t coord)
+{
+	j->stamp[coord] = j->epoch;
+	journal_grow(j->points, j->npoints, j->points_alloc);
+	struct board_journal_point *jp = &j->points[j->npoints++];
+	jp->coord = coord;
+	jp->b = board->b[coord];
+	jp->g = board->g[coord];
+	jp->p = board->p[coord];
+	jp->n = board->n[coord];
+#ifdef BOARD_SPATHASH
+	memcpy(jp->spathash, board->spathash[coord], sizeof(jp->spathash));
+#endif
+#ifdef BOARD_PAT3
+	jp->pat3 = board->pat3[coord];
+#endif
+#ifdef BOARD_TRAITS
+	memcpy(jp->t, board->t[coord], sizeof(jp->t));
+#endif
+	jp->gi = board->gi[coord];
+}
+
+/* Call before changing any per-point state of coord (including the info
+ * of a group based at coord). */
+static inline void
+journal_touch(struct board *board, coord_t coord)
+{
+	struct board_journal *j = board->journal;
+	if (likely(!j) || j->stamp[coord] == j->epoch)
+		return;
+	board_journal_save_point(board, j, coord);
+}
+
+/* Call before writing into a slot of the f[], c[] or tq[] queue. */
+static inline void
+journal_slot(struct board *board, coord_t *at)
+{
+	struct board_journal *j = board->journal;
+	if (likely(!j) || !j->epoch)
+		return;
+	journal_grow(j->slots, j->nslots, j->slots_alloc);
+	j->slots[j->nslots].at = at;
+	j->slots[j->nslots++].old = *at;
+}
+
+static inline void
+journal_history_hash(struct board *board, int i)
+{
+	struct board_journal *j = board->journal;
+	if (likely(!j) || !j->epoch)
+		return;
+	journal_grow(j->hashes, j->nhashes, j->hashes_alloc);
+	j->hashes[j->nhashes].i = i;
+	j->hashes[j->nhashes++].old = board->history_hash[i];
+}
+
+
 #ifdef BOARD_TRAITS
 
 #if BOARD_TRAIT_SAFE == 1
@@ -584,6 +732,8 @@ board_trait_queue(struct board *board, coord_t coord)
 #ifdef BOARD_TRAITS
 	if (trait_at(board, coord, S_BLACK).dirty)
 		return;
+	journal_touch(board, coord);
+	journal_slot(board, &board->tq[board->tqlen]);
 	board->tq[board->tqlen++] = coord;
 	trait_at(board, coord, S_BLACK).dirty = true;
 #endif
@@ -600,19 +750,14 @@ board_hash_update(struct board *board, coord_t coord, enum stone color)
 		fprintf(stderr, "board_hash_update(%d,%d,%d) ^ %"PRIhash" -> %"PRIhash"\n", color, coord_x(coord, board), coord_y(coord, board), hash_at(board, coord, color), board->hash);
 
 #ifdef BOARD_SPATHASH
-	/* Gridcular metric is reflective, so we update all hashes
-	 * of appropriate ditance in OUR circle. */
-	for (int d = 1; d <= BOARD_SPATHASH_MAXD; d++) {
-		for (int j = ptind[d]; j < ptind[d + 1]; j++) {
-			ptcoords_at(x, y, coord, board, j);
-			/* We either changed from S_NONE to color
-			 * or vice versa; doesn't matter. */
-			board->spathash[coord_xy(board, x, y)][d - 1][0] ^=
-				pthashes[0][j][color] ^ pthashes[0][j][S_NONE];
-			board->spathash[coord_xy(board, x, y)][d - 1][1] ^=
-				pthashes[0][j][stone_other(color)] ^ pthashes[0][j][S_NONE];
-		}
+	/* Just queue the change, see board_spathash_sync(). */
+	int ndirty = board->spathash_ndirty;
+	if (ndirty < BOARD_SPATHASH_DIRTY) {
+		journal_slot(board, &board->spathash_dirty[ndirty]);
+		board->spathash_dirty[ndirty] = coord << 2 | color;
 	}
+	if (ndirty <= BOARD_SPATHASH_DIRTY)
+		board->spathash_ndirty = ndirty + 1;
 #endif
 
 #if defined(BOARD_PAT3)
@@ -621,6 +766,7 @@ board_hash_update(struct board *board, coord_t coord, enum stone color)
 	enum stone new_color = board_at(board, coord);
 	bool in_atari = false;
 	if (new_color == S_NONE) {
+		journal_touch(board, coord);
 		board->pat3[coord] = pattern3_hash(board, coord);
 	} else {
 		in_atari = (board_group_info(board, group_at(board, coord)).libs == 1);
@@ -632,6 +778,7 @@ board_hash_update(struct board *board, coord_t coord, enum stone color)
 		 * loop order. */
 		if (board_at(board, c) != S_NONE)
 			continue;
+		journal_touch(board, c);
 		board->pat3[c] &= ~(3 << (fn__i*2));
 		board->pat3[c] |= new_color << (fn__i*2);
 		if (ataribits[fn__i] >= 0) {
@@ -652,6 +799,7 @@ board_hash_commit(struct board *board)
 	if (DEBUGL(8))
 		fprintf(stderr, "board_hash_commit %"PRIhash"\n", board->hash);
 	if (likely(board->history_hash[board->hash & history_hash_mask]) == 0) {
+		journal_history_hash(board, board->hash & history_hash_mask);
 		board->history_hash[board->hash & history_hash_mask] = board->hash;
 	} else {
 		hash_t i = board->hash;
@@ -665,6 +813,7 @@ board_hash_commit(struct board *board)
 			}
 			i = history_hash_next(i);
 		}
+		journal_history_hash(board, i & history_hash_mask);
 		board->history_hash[i & history_hash_mask] = board->hash;
 	}
 }
@@ -753,6 +902,79 @@ break_symmetry:
 }
 
 
+#ifdef BOARD_SPATHASH
+/* Compute spatial hashes of all points on the board from scratch. */
+static void
+board_spathash_recompute(struct board *board)
+{
+	foreach_point(board) {
+		if (board_at(board, c) == S_OFFBOARD)
+			continue;
+		journal_touch(board, c);
+		coord_t coord = c;
+		/* d == 1 is just the center point, always empty when we
+		 * look at the hashes, so we leave it out. */
+		for (int d = 2; d <= BOARD_SPATHASH_MAXD; d++) {
+			hash_t hb = 0, hw = 0;
+			for (unsigned int j = ptind[d]; j < ptind[d + 1]; j++) {
+				ptcoords_at(x, y, coord, board, j);
+				enum stone s = board_atxy(board, x, y);
+				hb ^= pthashes[0][j][s];
+				hw ^= pthashes[0][j][stone_other(s)];
+			}
+			board->spathash[coord][d - 1][0] = hb;
+			board->spathash[coord][d - 1][1] = hw;
+		}
+	} foreach_point_end;
+}
+
+/* Account for a stone of @color placed at or removed from @coord. */
+static void
+board_spathash_update(struct board *board, coord_t coord, enum stone color)
+{
+	/* The point at -ptcoords[j] from coord sees it as its j-th point;
+	 * coord itself is on the board, so never subject to clamping. Only
+	 * the ring at the matching distance changes for each such point. */
+	int cx = coord_x(coord, board), cy = coord_y(coord, board);
+	int max = board_size(board) - 2;
+	for (int d = 2; d <= BOARD_SPATHASH_MAXD; d++) {
+		for (unsigned int j = ptind[d]; j < ptind[d + 1]; j++) {
+			int x = cx - ptcoords[j].x, y = cy - ptcoords[j].y;
+			if (x < 1 || x > max || y < 1 || y > max)
+				continue;
+			coord_t c = coord_xy(board, x, y);
+			journal_touch(board, c);
+			/* We either changed from S_NONE to color
+			 * or vice versa; doesn't matter. */
+			board->spathash[c][d - 1][0] ^=
+				pthashes[0][j][color] ^ pthashes[0][j][S_NONE];
+			board->spathash[c][d - 1][1] ^=
+				pthashes[0][j][stone_other(color)] ^ pthashes[0][j][S_NONE];
+		}
+	}
+}
+#endif
+
+void
+board_spathash_sync(struct board *board)
+{
+#ifdef BOARD_SPATHASH
+	int ndirty = board->spathash_ndirty;
+	if (likely(!ndirty))
+		return;
+	if (ndirty > BOARD_SPATHASH_DIRTY) {
+		board_spathash_recompute(board);
+	} else {
+		for (int i = 0; i < ndirty; i++) {
+			coord_t c = board->spathash_dirty[i];
+			board_spathash_update(board, c >> 2, c & 3);
+		}
+	}
+	board->spathash_ndirty = 0;
+#endif
+}
+
+
 void
 board_handicap_stone(struct board *board, int x, int y, FILE *f)
 {
@@ -809,6 +1031,12 @@ check_libs_consistency(struct board *board, group_t g)
 			fprintf(stderr, "BOGUS LIBERTY %s of group %d[%s]\n", coord2sstr(gi->lib[i], board), g, coord2sstr(group_base(g), board));
 			assert(0);
 		}
+#ifdef BOARD_LIBSET
+	int n = 0;
+	for (int w = 0; w < BOARD_LIBSET_WORDS; w++)
+		n += __builtin_popcountll(gi->libset[w]);
+	assert(n == gi->nlibs);
+#endif
 #endif
 }
 
@@ -830,6 +1058,7 @@ static void
 board_capturable_add(struct board *board, group_t group, coord_t lib, bool onestone)
 {
 	//fprintf(stderr, "group %s cap %s\n", coord2sstr(group, board), coord2sstr(lib, boarD));
+	journal_touch(board, lib);
 #ifdef BOARD_TRAITS
 	/* Increase capturable count trait of my last lib. */
 	enum stone capturing_color = stone_other(board_at(board, group));
@@ -855,6 +1084,7 @@ board_capturable_add(struct board *board, group_t group, coord_t lib, bool onest
 	/* Update the list of capturable groups. */
 	assert(group);
 	assert(board->clen < board_size2(board));
+	journal_slot(board, &board->c[board->clen]);
 	board->c[board->clen++] = group;
 #endif
 }
@@ -862,6 +1092,7 @@ static void
 board_capturable_rm(struct board *board, group_t group, coord_t lib, bool onestone)
 {
 	//fprintf(stderr, "group %s nocap %s\n", coord2sstr(group, board), coord2sstr(lib, board));
+	journal_touch(board, lib);
 #ifdef BOARD_TRAITS
 	/* Decrease capturable count trait of my previously-last lib. */
 	enum stone capturing_color = stone_other(board_at(board, group));
@@ -887,6 +1118,7 @@ board_capturable_rm(struct board *board, group_t group, coord_t lib, bool onesto
 	/* Update the list of capturable groups. */
 	for (int i = 0; i < board->clen; i++) {
 		if (unlikely(board->c[i] == group)) {
+			journal_slot(board, &board->c[i]);
 			board->c[i] = board->c[--board->clen];
 			return;
 		}
@@ -913,6 +1145,27 @@ board_atariable_rm(struct board *board, group_t group, coord_t lib1, coord_t lib
 #endif
 }
 
+/* Liberty bitset maintenance; both are idempotent, like the lib[] updates. */
+static inline void
+group_libset_add(struct group *gi, coord_t coord)
+{
+#ifdef BOARD_LIBSET
+	uint64_t bit = 1ULL << (coord & 63);
+	gi->nlibs += !(gi->libset[coord >> 6] & bit);
+	gi->libset[coord >> 6] |= bit;
+#endif
+}
+
+static inline void
+group_libset_rm(struct group *gi, coord_t coord)
+{
+#ifdef BOARD_LIBSET
+	uint64_t bit = 1ULL << (coord & 63);
+	gi->nlibs -= !!(gi->libset[coord >> 6] & bit);
+	gi->libset[coord >> 6] &= ~bit;
+#endif
+}
+
 static void
 board_group_addlib(struct board *board, group_t group, coord_t coord, struct board_undo *u)
 {
@@ -924,8 +1177,10 @@ board_group_addlib(struct board *board, group_t group, coord_t coord, struct boa
 
 	if (!u) check_libs_consistency(board, group);
 
+	journal_touch(board, group);
 	struct group *gi = &board_group_info(board, group);
 	bool onestone = group_is_onestone(board, group);
+	group_libset_add(gi, coord);
 	if (gi->libs < GROUP_KEEP_LIBS) {
 		for (int i = 0; i < GROUP_KEEP_LIBS; i++) {
 #if 0
@@ -956,6 +1211,25 @@ static void
 board_group_find_extra_libs(struct board *board, group_t group, struct group *gi, coord_t avoid)
 {
 	/* Add extra liberty from the board to our liberty list. */
+#ifdef BOARD_LIBSET
+	/* The liberty set has them all already, no need to walk the stones. */
+	int words = (board_size2(board) + 63) / 64;
+	for (int w = 0; w < words; w++) {
+		uint64_t bits = gi->libset[w];
+		while (bits) {
+			coord_t c = w * 64 + __builtin_ctzll(bits);
+			bits &= bits - 1;
+			for (int i = 0; i < gi->libs; i++)
+				if (gi->lib[i] == c)
+					goto next_lib;
+			gi->lib[gi->libs++] = c;
+			if (unlikely(gi->libs >= GROUP_KEEP_LIBS))
+				return;
+next_lib:;
+		}
+	}
+	return;
+#endif
 	unsigned char watermark[board_size2(board) / 8];
 	memset(watermark, 0, sizeof(watermark));
 #define watermark_get(c)	(watermark[c >> 3] & (1 << (c & 7)))
@@ -989,8 +1263,10 @@ board_group_rmlib(struct board *board, group_t group, coord_t coord, struct boar
 			board_group_info(board, group).libs, coord2sstr(coord, board));
 	}
 
+	journal_touch(board, group);
 	struct group *gi = &board_group_info(board, group);
 	bool onestone = group_is_onestone(board, group);
+	group_libset_rm(gi, coord);
 	for (int i = 0; i < GROUP_KEEP_LIBS; i++) {
 #if 0
 		/* Seems extra branch just slows it down */
@@ -1036,6 +1312,7 @@ static void
 board_remove_stone(struct board *board, group_t group, coord_t c, struct board_undo *u)
 {
 	enum stone color = board_at(board, c);
+	journal_touch(board, c);
 	board_at(board, c) = S_NONE;
 	group_at(board, c) = 0;
 	if (!u) {
@@ -1052,6 +1329,7 @@ board_remove_stone(struct board *board, group_t group, coord_t c, struct board_u
 	/* Increase liberties of surrounding groups */
 	coord_t coord = c;
 	foreach_neighbor(board, coord, {
+		journal_touch(board, c);
 		dec_neighbor_count_at(board, c, color);
 		if (!u) board_trait_queue(board, c);
 		group_t g = group_at(board, c);
@@ -1069,6 +1347,7 @@ board_remove_stone(struct board *board, group_t group, coord_t c, struct board_u
 
 	if (DEBUGL(6))
 		fprintf(stderr, "pushing free move [%d]: %d,%d\n", board->flen, coord_x(c, board), coord_y(c, board));
+	journal_slot(board, &board->f[board->flen]);
 	board->f[board->flen++] = c;
 }
 
@@ -1085,6 +1364,7 @@ board_group_capture(struct board *board, group_t group, struct board_undo *u)
 
 	struct group *gi = &board_group_info(board, group);
 	assert(gi->libs == 0);
+	journal_touch(board, group);
 	memset(gi, 0, sizeof(*gi));
 
 	return stones;
@@ -1109,6 +1389,7 @@ add_to_group(struct board *board, group_t group, coord_t prevstone, coord_t coor
 		if (coord_is_adjecent(lib, coord, board)) {
 			if (DEBUGL(8))
 				fprintf(stderr, "add_to_group %s: %s[%d] bump\n", coord2sstr(group, board), coord2sstr(lib, board), trait_at(board, lib, capturing_color).cap);
+			journal_touch(board, lib);
 			trait_at(board, lib, capturing_color).cap++;
 			/* This is never a 1-stone group, obviously. */
 			board_trait_queue(board, lib);
@@ -1119,6 +1400,7 @@ add_to_group(struct board *board, group_t group, coord_t prevstone, coord_t coor
 			 * counter specifically. */
 			foreach_neighbor(board, group, {
 				if (board_at(board, c) != S_NONE) continue;
+				journal_touch(board, c);
 				trait_at(board, c, capturing_color).cap1--;
 				board_trait_queue(board, c);
 			});
@@ -1126,6 +1408,8 @@ add_to_group(struct board *board, group_t group, coord_t prevstone, coord_t coor
 	}
 #endif
 
+	journal_touch(board, coord);
+	journal_touch(board, prevstone);
 	group_at(board, coord) = group;
 	groupnext_at(board, coord) = groupnext_at(board, prevstone);
 	groupnext_at(board, prevstone) = coord;
@@ -1149,6 +1433,8 @@ merge_groups(struct board *board, group_t group_to, group_t group_from, struct b
 	if (DEBUGL(7))
 		fprintf(stderr, "board_play_raw: merging groups %d -> %d\n",
 			group_base(group_from), group_base(group_to));
+	journal_touch(board, group_from);
+	journal_touch(board, group_to);
 	struct group *gi_from = &board_group_info(board, group_from);
 	struct group *gi_to = &board_group_info(board, group_to);
 	bool onestone_from = group_is_onestone(board, group_from);
@@ -1187,8 +1473,17 @@ next_from_lib:;
 		}
 	}
 
+#ifdef BOARD_LIBSET
+	gi_to->nlibs = 0;
+	for (int w = 0; w < BOARD_LIBSET_WORDS; w++) {
+		gi_to->libset[w] |= gi_from->libset[w];
+		gi_to->nlibs += __builtin_popcountll(gi_to->libset[w]);
+	}
+#endif
+
 	if (!u && gi_to->libs == 1) {
 		coord_t lib = board_group_info(board, group_to).lib[0];
+		journal_touch(board, lib);
 #ifdef BOARD_TRAITS
 		enum stone capturing_color = stone_other(board_at(board, group_to));
 		assert(capturing_color == S_BLACK || capturing_color == S_WHITE);
@@ -1209,6 +1504,7 @@ next_from_lib:;
 			 * counter specifically. */
 			foreach_neighbor(board, group_to, {
 				if (board_at(board, c) != S_NONE) continue;
+				journal_touch(board, c);
 				trait_at(board, c, capturing_color).cap1--;
 				board_trait_queue(board, c);
 			});
@@ -1232,6 +1528,7 @@ next_from_lib:;
 	coord_t last_in_group;
 	foreach_in_group(board, group_from) {
 		last_in_group = c;
+		journal_touch(board, c);
 		group_at(board, c) = group_to;
 	} foreach_in_group_end;
 
@@ -1250,13 +1547,16 @@ new_group(struct board *board, coord_t coord, struct board_undo *u)
 {
 	group_t group = coord;
 	struct group *gi = &board_group_info(board, group);
+	journal_touch(board, coord);
 	foreach_neighbor(board, coord, {
-		if (board_at(board, c) == S_NONE)
+		if (board_at(board, c) == S_NONE) {
 			/* board_group_addlib is ridiculously expensive for us */
+			group_libset_add(gi, c);
 #if GROUP_KEEP_LIBS < 4
 			if (gi->libs < GROUP_KEEP_LIBS)
 #endif
 			gi->lib[gi->libs++] = c;
+		}
 	});
 
 	group_at(board, coord) = group;
@@ -1351,6 +1651,7 @@ play_one_neighbor(struct board *board,
 	enum stone ncolor = board_at(board, c);
 	group_t ngroup = group_at(board, c);
 
+	journal_touch(board, c);
 	inc_neighbor_count_at(board, c, color);
 	/* We can be S_NONE, in that case we need to update the safety
 	 * trait since we might be left with only one liberty. */
@@ -1398,6 +1699,7 @@ board_play_outside(struct board *board, struct move *m, int f, struct board_undo
 	if (u)  
 		undo_save_group_info(board, coord, color, u);
 	else {
+		journal_slot(board, &board->f[f]);
 		board->f[f] = board->f[--board->flen];
 		if (DEBUGL(6))
 			fprintf(stderr, "popping free move [%d->%d]: %d\n", board->flen, f, board->f[f]);
@@ -1423,6 +1725,7 @@ board_play_outside(struct board *board, struct move *m, int f, struct board_undo
 			group = play_one_neighbor(board, coord, color, other_color, c, group, u);
 	});
 
+	journal_touch(board, coord);
 	board_at(board, coord) = color;
 	if (unlikely(!group))
 		group = new_group(board, coord, u);
@@ -1495,6 +1798,7 @@ board_play_in_eye(struct board *board, struct move *m, int f, struct board_undo
 #endif
 #endif
 
+		journal_slot(board, &board->f[f]);
 		board->f[f] = board->f[--board->flen];
 		if (DEBUGL(6))
 			fprintf(stderr, "popping free move [%d->%d]: %d\n", board->flen, f, board->f[f]);
@@ -1505,6 +1809,7 @@ board_play_in_eye(struct board *board, struct move *m, int f, struct board_undo
 	int ko_caps = 0;
 	coord_t cap_at = pass;
 	foreach_neighbor(board, coord, {
+		journal_touch(board, c);
 		inc_neighbor_count_at(board, c, color);
 		/* Originally, this could not have changed any trait
 		 * since no neighbors were S_NONE, however by now some
@@ -1534,6 +1839,7 @@ board_play_in_eye(struct board *board, struct move *m, int f, struct board_undo
 			fprintf(stderr, "guarding ko at %d,%s\n", ko.color, coord2sstr(ko.coord, board));
 	}
 
+	journal_touch(board, coord);
 	board_at(board, coord) = color;
 	group_t group = new_group(board, coord, u);
 
@@ -1854,6 +2160,151 @@ board_quick_undo(struct board *b, struct move *m, struct board_undo *u)
 }
 
 
+/* Full undo journal, see board.h. */
+void
+board_journal_init(struct board *board)
+{
+	assert(!board->journal);
+	board->journal = calloc2(1, sizeof(*board->journal));
+}
+
+void
+board_journal_done(struct board *board)
+{
+	struct board_journal *j = board->journal;
+	free(j->points);
+	free(j->slots);
+	free(j->hashes);
+	free(j->marks);
+	free(j);
+	board->journal = NULL;
+}
+
+int
+board_journal_mark(struct board *board)
+{
+	struct board_journal *j = board->journal;
+	assert(j);
+#ifdef BOARD_UNDO_CHECKS
+	assert(!board->quicked);
+#endif
+
+	if (unlikely(++j->last_epoch == 0)) {
+		/* Wrapped around; stale stamps would only cause
+		 * redundant saves, but zero means "not recording". */
+		memset(j->stamp, 0, sizeof(j->stamp));
+		j->last_epoch = 1;
+	}
+	j->epoch = j->last_epoch;
+
+	journal_grow(j->marks, j->nmarks, j->marks_alloc);
+	struct board_journal_mark *m = &j->marks[j->nmarks];
+	m->epoch = j->epoch;
+	m->npoints = j->npoints;
+	m->nslots = j->nslots;
+	m->nhashes = j->nhashes;
+
+	memcpy(m->captures, board->captures, sizeof(m->captures));
+	m->komi = board->komi;
+	m->moves = board->moves;
+	m->last_move = board->last_move;
+	m->last_move2 = board->last_move2;
+	m->last_move3 = board->last_move3;
+	m->last_move4 = board->last_move4;
+	m->superko_violation = board->superko_violation;
+	m->flen = board->flen;
+#ifdef WANT_BOARD_C
+	m->clen = board->clen;
+#endif
+#ifdef BOARD_TRAITS
+	m->tqlen = board->tqlen;
+#endif
+#ifdef BOARD_SPATHASH
+	m->spathash_ndirty = board->spathash_ndirty;
+#endif
+	m->symmetry = board->symmetry;
+	m->last_ko = board->last_ko;
+	m->last_ko_age = board->last_ko_age;
+	m->ko = board->ko;
+	m->hash = board->hash;
+	memcpy(m->qhash, board->qhash, sizeof(m->qhash));
+
+	return j->nmarks++;
+}
+
+void
+board_journal_rollback(struct board *board, int mark)
+{
+	struct board_journal *j = board->journal;
+	assert(mark >= 0 && mark < j->nmarks);
+#ifdef BOARD_UNDO_CHECKS
+	assert(!board->quicked);
+#endif
+	struct board_journal_mark *m = &j->marks[mark];
+
+	/* Newest first, so that the oldest saved value wins. */
+	for (int i = j->npoints - 1; i >= m->npoints; i--) {
+		struct board_journal_point *jp = &j->points[i];
+		coord_t c = jp->coord;
+		board->b[c] = jp->b;
+		board->g[c] = jp->g;
+		board->p[c] = jp->p;
+		board->n[c] = jp->n;
+#ifdef BOARD_SPATHASH
+		memcpy(board->spathash[c], jp->spathash, sizeof(jp->spathash));
+#endif
+#ifdef BOARD_PAT3
+		board->pat3[c] = jp->pat3;
+#endif
+#ifdef BOARD_TRAITS
+		memcpy(board->t[c], jp->t, sizeof(jp->t));
+#endif
+		board->gi[c] = jp->gi;
+	}
+	for (int i = j->nslots - 1; i >= m->nslots; i--)
+		*j->slots[i].at = j->slots[i].old;
+	for (int i = j->nhashes - 1; i >= m->nhashes; i--)
+		board->history_hash[j->hashes[i].i] = j->hashes[i].old;
+
+	memcpy(board->captures, m->captures, sizeof(m->captures));
+	board->komi = m->komi;
+	board->moves = m->moves;
+	board->last_move = m->last_move;
+	board->last_move2 = m->last_move2;
+	board->last_move3 = m->last_move3;
+	board->last_move4 = m->last_move4;
+	board->superko_violation = m->superko_violation;
+	board->flen = m->flen;
+#ifdef WANT_BOARD_C
+	board->clen = m->clen;
+#endif
+#ifdef BOARD_TRAITS
+	board->tqlen = m->tqlen;
+#endif
+#ifdef BOARD_SPATHASH
+	board->spathash_ndirty = m->spathash_ndirty;
+#endif
+	board->symmetry = m->symmetry;
+	board->last_ko = m->last_ko;
+	board->last_ko_age = m->last_ko_age;
+	board->ko = m->ko;
+	board->hash = m->hash;
+	memcpy(board->qhash, m->qhash, sizeof(m->qhash));
+
+	j->npoints = m->npoints;
+	j->nslots = m->nslots;
+	j->nhashes = m->nhashes;
+	j->nmarks = mark;
+	j->epoch = mark ? j->marks[mark - 1].epoch : 0;
+}
+
+void
+board_journal_touch(struct board *board, coord_t coord)
+{
+	journal_touch(board, coord);
+}
+
+
 /* Undo, supported only for pass moves. This form of undo is required by KGS
  * to settle disputes on dead groups. See also fast_board_undo() */
 int board_undo(struct board *board)
@@ -1960,18 +2411,22 @@ board_get_one_point_eye(struct board *board, coord_t coord)
 floating_t
 board_fast_score(struct board *board)
 {
-	int scores[S_MAX];
-	memset(scores, 0, sizeof(scores));
+	/* Branch-free count over all the points between the first and last
+	 * board row (margin points just count as S_OFFBOARD), so that the
+	 * compiler can vectorize the loop. */
+	int stride = board_size(board);
+	int end = board_size2(board) - stride - 1;
+	int eyes = board->rules != RULES_STONES_ONLY;
+	int black = 0, white = 0;
 
-	foreach_point(board) {
+	for (coord_t c = stride + 1; c < end; c++) {
 		enum stone color = board_at(board, c);
-		if (color == S_NONE && board->rules != RULES_STONES_ONLY)
-			color = board_get_one_point_eye(board, c);
-		scores[color]++;
-		// fprintf(stderr, "%d, %d ++%d = %d\n", coord_x(c, board), coord_y(c, board), color, scores[color]);
-	} foreach_point_end;
+		enum stone eye = eyes ? board_fast_eye(board, c) : S_NONE;
+		white += (color == S_WHITE) | ((color == S_NONE) & (eye == S_WHITE));
+		black += (color == S_BLACK) | ((color == S_NONE) & (eye == S_BLACK));
+	}
 
-	return board->komi + (board->rules != RULES_SIMING ? board->handicap : 0) + scores[S_WHITE] - scores[S_BLACK];
+	return board->komi + (board->rules != RULES_SIMING ? board->handicap : 0) + white - black;
 }
 
 /* Owner map: 0: undecided; 1: black; 2: white; 3: dame */
@@ -27,11 +27,14 @@ struct fbook;
 
 //#define BOARD_SIZE 9 // constant board size, allows better optimization
 
-//#define BOARD_SPATHASH // incremental patternsp.h hashes
-#define BOARD_SPATHASH_MAXD 3 // maximal diameter
+#define BOARD_SPATHASH // incremental patternsp.h hashes
+#define BOARD_SPATHASH_MAXD 7 // maximal diameter (up to MAX_PATTERN_DIST)
+#define BOARD_SPATHASH_DIRTY 64 // queued changes before full recompute
 
 #define BOARD_PAT3 // incremental 3x3 pattern codes
 
+//#define BOARD_LIBSET // exact per-group liberty bitsets (see struct group)
+
 //#define BOARD_TRAITS 1 // incremental point traits (see struct btraits)
 //#define BOARD_TRAIT_SAFE 1 // include btraits.safe (rather expensive, unused)
 //#define BOARD_TRAIT_SAFE 2 // include btraits.safe based on full is_bad_selfatari()
@@ -93,6 +96,13 @@ struct group {
 	 * It denotes only number of items in lib[], thus you can rely
 	 * on it to store real liberties only up to <= GROUP_REFILL_LIBS. */
 	int libs;
+#ifdef BOARD_LIBSET
+	/* Exact set of all liberties, one bit per coord, and its size.
+	 * Use board_group_libs() to get the real liberty count. */
+#define BOARD_LIBSET_WORDS ((BOARD_MAX_COORDS + 63) / 64)
+	uint64_t libset[BOARD_LIBSET_WORDS];
+	int nlibs;
+#endif
 };
 
 struct neighbor_colors {
@@ -134,6 +144,10 @@ struct btraits {
 #define flen flen_field_not_supported_for_quick_boards
 #endif
 
+#ifdef BOARD_SPATHASH
+typedef uint32_t spathash_t[BOARD_SPATHASH_MAXD][2];
+#endif
+
 /* You should treat this struct as read-only. Always call functions below if
  * you want to change it. */
 
@@ -203,12 +217,18 @@ FB_ONLY(bool superko_violation);
 	/* Zobrist hash for each position */
 	hash_t *h;
 #ifdef BOARD_SPATHASH
-	/* For spatial hashes, we use only 24 bits. */
+	/* For spatial hashes, we use only the low spatial_hash_bits. */
 	/* [0] is d==1, we don't keep hash for d==0. */
 	/* We keep hashes for black-to-play ([][0]) and white-to-play
 	 * ([][1], reversed stone colors since we match all patterns as
-	 * black-to-play). */
-FB_ONLY(uint32_t (*spathash))[BOARD_SPATHASH_MAXD][2];
+	 * black-to-play). Valid only for points on the board. */
+	/* The hashes are brought up to date lazily: board_play() merely
+	 * queues the changed points in spathash_dirty[] (coord << 2 | color),
+	 * board_spathash_sync() applies them when someone needs the hashes.
+	 * Too many changes (e.g. playouts) just mean a full recompute. */
+FB_ONLY(spathash_t *spathash);
+FB_ONLY(coord_t spathash_dirty)[BOARD_SPATHASH_DIRTY];
+FB_ONLY(int spathash_ndirty); /* > BOARD_SPATHASH_DIRTY: recompute all */
 #endif
 #ifdef BOARD_PAT3
 	/* 3x3 pattern code for each position; see pattern3.h for encoding
@@ -265,6 +285,9 @@ FB_ONLY(int last_ko_age);
 	 * initialized by play_random_game() and free()'d at board destroy time */
 	void *ps;
 
+	/* Undo journal, see board_journal_mark(). Not shared by copies. */
+	struct board_journal *journal;
+
 
 	/* --- PRIVATE DATA --- */
 
@@ -366,6 +389,12 @@ struct board_undo {
 #define group_is_onestone(b_, g_) (groupnext_at(b_, group_base(g_)) == 0)
 #define board_group_info(b_, g_) ((b_)->gi[(g_)])
 #define board_group_captured(b_, g_) (board_group_info(b_, g_).libs == 0)
+/* Real number of liberties with BOARD_LIBSET, lower bound otherwise. */
+#ifdef BOARD_LIBSET
+#define board_group_libs(b_, g_) (board_group_info(b_, g_).nlibs)
+#else
+#define board_group_libs(b_, g_) (board_group_info(b_, g_).libs)
+#endif
 /* board_group_other_lib() makes sense only for groups with two liberties. */
 #define board_group_other_lib(b_, g_, l_) (board_group_info(b_, g_).lib[board_group_info(b_, g_).lib[0] != (l_) ? 0 : 1])
 
@@ -373,6 +402,12 @@ struct board_undo {
 
 struct board *board_init(char *fbookfile);
 struct board *board_copy(struct board *board2, struct board *board1);
+/* Like board_copy(), but the board arrays are placed in the caller's
+ * buffer *buf of *bufsize bytes, reallocated only if too small; this
+ * saves the heap traffic for repeated copies. Release the board with
+ * board_done_buf(), which keeps the buffer. */
+struct board *board_copy_buf(struct board *board2, struct board *board1, void **buf, size_t *bufsize);
+void board_done_buf(struct board *board);
 void board_done_noalloc(struct board *board);
 void board_done(struct board *board);
 /* size here is without the S_OFFBOARD margin. */
@@ -395,6 +430,9 @@ void board_handicap(struct board *board, int stones, FILE *f);
 
 /* Returns group id, 0 on allowed suicide, pass or resign, -1 on error */
 int board_play(struct board *board, struct move *m);
+/* Bring board->spathash up to date; no-op without BOARD_SPATHASH. Not
+ * thread-safe, sync shared boards before handing them out to threads. */
+void board_spathash_sync(struct board *board);
 /* Like above, but plays random move; the move coordinate is recorded
  * to *coord. This method will never fill your own eye. pass is played
  * when no move can be played. You can impose extra restrictions if you
@@ -438,6 +476,10 @@ bool board_is_false_eyelike(struct board *board, coord_t coord, enum stone eye_c
 bool board_is_one_point_eye(struct board *board, coord_t c, enum stone eye_color);
 /* Returns color of a 1pt eye owner, S_NONE if not an eye. */
 enum stone board_get_one_point_eye(struct board *board, coord_t c);
+/* Like board_get_one_point_eye(), but branch-free for use in vectorized
+ * loops. Must not be called on the outer margin rows; the result is
+ * meaningless for non-empty points. */
+static enum stone board_fast_eye(struct board *board, coord_t c);
 
 /* board_official_score() is the scoring method for yielding score suitable
  * for external presentation. For fast scoring of entirely filled boards
@@ -475,6 +517,26 @@ bool board_set_rules(struct board *board, char *name);
 int  board_quick_play(struct board *board, struct move *m, struct board_undo *u);
 void board_quick_undo(struct board *b, struct move *m, struct board_undo *u);
 
+/* Full undo journal. Unlike quick_play() / quick_undo(), this keeps
+ * everything maintained by board_play() (hashes, pat3, free and
+ * capturable lists, history...) and supports any number of moves:
+ *
+ *	board_journal_init(b);  // once, freed by board_done*()
+ *	int mark = board_journal_mark(b);
+ *	... board_play() etc ...
+ *	board_journal_rollback(b, mark);  // b is back to where it was
+ *
+ * Marks nest; rollback to a mark drops the later ones as well.
+ * Only changes done by board_play*() and board_quick_play() are
+ * recorded, don't board_clear() / board_handicap() in between.
+ * Code writing the board arrays directly must board_journal_touch()
+ * each point first. */
+void board_journal_init(struct board *board);
+void board_journal_done(struct board *board);
+int  board_journal_mark(struct board *board);
+void board_journal_rollback(struct board *board, int mark);
+void board_journal_touch(struct board *board, coord_t coord);
+
 /* quick_play() + quick_undo() combo.
  * Body is executed only if move is valid (silently ignored otherwise).
  * Can break out in body, but definitely *NOT* return / jump around !
@@ -583,6 +645,20 @@ board_is_eyelike(struct board *board, coord_t coord, enum stone eye_color)
 	        + neighbor_count_at(board, coord, S_OFFBOARD)) == 4;
 }
 
+static inline enum stone
+board_fast_eye(struct board *board, coord_t coord)
+{
+	int s = board_size(board);
+	enum stone d0 = board_at(board, coord - s - 1), d1 = board_at(board, coord - s + 1);
+	enum stone d2 = board_at(board, coord + s - 1), d3 = board_at(board, coord + s + 1);
+	int edge = (d0 == S_OFFBOARD) | (d1 == S_OFFBOARD) | (d2 == S_OFFBOARD) | (d3 == S_OFFBOARD);
+	int dblack = (d0 == S_BLACK) + (d1 == S_BLACK) + (d2 == S_BLACK) + (d3 == S_BLACK) + edge;
+	int dwhite = (d0 == S_WHITE) + (d1 == S_WHITE) + (d2 == S_WHITE) + (d3 == S_WHITE) + edge;
+	int weye = board_is_eyelike(board, coord, S_WHITE) & (dblack < 2);
+	int beye = board_is_eyelike(board, coord, S_BLACK) & (dwhite < 2);
+	return weye ? S_WHITE : beye ? S_BLACK : S_NONE;
+}
+
 /* Group suicides allowed */
 static inline bool
 board_is_valid_play(struct board *board, enum stone color, coord_t coord)
@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
@@ -65,24 +66,21 @@ dcnn_init()
 		fprintf(stderr, "Initialized dcnn.\n");
 }
 
-void
-dcnn_get_moves(struct board *b, enum stone color, float result[])
-{
-	assert(real_board_size(b) == 19);
+/* The net is not reentrant, the root prior and the evaluator thread
+ * of asynchronous priors may use it at the same time. */
+static pthread_mutex_t net_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+static void
+dcnn_fill_input(struct board *b, enum stone color, float *data)
+{
 	int size = 19;
-	int dsize = 13 * size * size;
-	float *data = new float[dsize];
-	for (int i = 0; i < dsize; i++) 
-		data[i] = 0.0;
-
 	for (int j = 0; j < size; j++) {
 		for(int k = 0; k < size; k++) {
 			int p = size * j + k;
 			coord_t c = coord_xy(b, j+1, k+1);
 			group_t g = group_at(b, c);
 			enum stone bc = board_at(b, c);
-			int libs = board_group_info(b, g).libs - 1;
+			int libs = board_group_libs(b, g) - 1;
 			if (libs > 3) libs = 3;
 			if (bc == S_NONE) 
 				data[8*size*size + p] = 1.0;
@@ -102,23 +100,52 @@ dcnn_get_moves(struct board *b, enum stone color, float result[])
 			
 		}
 	}
+}
+
+void
+dcnn_get_moves_batch(struct board **b, enum stone *color, float **result, int n)
+{
+	int size = 19;
+	int dsize = 13 * size * size;
+	float *data = new float[n * dsize];
+	for (int i = 0; i < n * dsize; i++) 
+		data[i] = 0.0;
+	for (int i = 0; i < n; i++) {
+		assert(real_board_size(b[i]) == 19);
+		dcnn_fill_input(b[i], color[i], data + i * dsize);
+	}
 
-	Blob<float> *blob = new Blob<float>(1,13,size,size);
+	Blob<float> *blob = new Blob<float>(n,13,size,size);
 	blob->set_cpu_data(data);
 	vector<Blob<float>*> bottom;
 	bottom.push_back(blob);
 	assert(net);
+
+	pthread_mutex_lock(&net_mutex);
+	Blob<float> *input = net->input_blobs()[0];
+	if (input->num() != n) {
+		input->Reshape(n, 13, size, size);
+		net->Reshape();
+	}
 	const vector<Blob<float>*>& rr = net->Forward(bottom);
 	
-	for (int i = 0; i < size * size; i++) {
-		result[i] = rr[0]->cpu_data()[i];
-		if (result[i] < 0.00001)
-			result[i] = 0.00001;
-	}
+	for (int k = 0; k < n; k++)
+		for (int i = 0; i < size * size; i++) {
+			result[k][i] = rr[0]->cpu_data()[k * size * size + i];
+			if (result[k][i] < 0.00001)
+				result[k][i] = 0.00001;
+		}
+	pthread_mutex_unlock(&net_mutex);
 	delete[] data;
 	delete blob;
 }
 
+void
+dcnn_get_moves(struct board *b, enum stone color, float result[])
+{
+	dcnn_get_moves_batch(&b, &color, &result, 1);
+}
+
 void
 find_dcnn_best_moves(struct board *b, float *r, coord_t *best, float *best_r)
 {
@@ -12,6 +12,8 @@ extern "C" {
 #define DCNN_BEST_N 5
 
 void dcnn_get_moves(struct board *b, enum stone color, float result[]);
+/* Evaluate n positions in a single forward pass. */
+void dcnn_get_moves_batch(struct board **b, enum stone *color, float **result, int n);
 bool using_dcnn(struct board *b);
 void dcnn_quiet_caffe(int argc, char *argv[]);
 void dcnn_init();
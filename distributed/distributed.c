@@ -40,6 +40,15 @@
 /* The master-slave protocol has fault tolerance. If a slave is
  * out of sync, the master sends it the appropriate command history. */
 
+/* With the slave option, the distributed engine is a relay: it is
+ * a slave for its parent master and a master for its own slaves.
+ * The stats received from the parent are inserted in the receive
+ * queue like those of another slave, so our slaves get the stats of
+ * the whole tree. Our own slaves' stats are merged and sent to the
+ * parent as one stream, so that the parent only has to merge one
+ * buffer per relay. Relays can be nested. The top level nodes sent to
+ * the parent are averaged over our slaves, like the master does. */
+
 /* Pass me arguments like a=b,c=d,...
  * Supported arguments:
  * slave_port=SLAVE_PORT     slaves connect to this port; this parameter is mandatory.
@@ -47,6 +56,9 @@
  * shared_nodes=SHARED_NODES default 10K
  * stats_hbits=STATS_HBITS   default 21. 2^stats_bits = hash table size
  * slaves_quit=0|1           quit gtp command also sent to slaves, default false.
+ * slave                     act as a relay, slave of the master given by -g.
+ * shm                       keep stats buffers in shared memory for slaves
+ *                           on the same machine started with -g shm:host:port
  * proxy_port=PROXY_PORT     slaves optionally send their logs to this port.
  *    Warning: with proxy_port, the master stderr mixes the logs of all
  *    machines but you can separate them again:
@@ -64,6 +76,14 @@
  * If the master itself runs on a machine other than that running gogui,
  * gogui-twogtp, kgsGtp or cgosGtp, it can redirect its gtp port:
  *    pachi -e distributed -g 10000 slave_port=1234,proxy_port=1235
+ * With several slaves on the master machine, stats can be exchanged in
+ * shared memory instead of the socket:
+ *    pachi -e distributed slave_port=1234,shm
+ *    pachi -e uct -g shm:localhost:1234 slave
+ * With relays, on each relayhost:
+ *    pachi -e distributed -g masterhost:1234 slave,slave_port=1236
+ * and the slaves of each relay:
+ *    pachi -e uct -g relayhost:1236 slave
  */
 
 #include <assert.h>
@@ -95,6 +115,10 @@ struct distributed {
 	int shared_nodes;
 	int stats_hbits;
 	bool slaves_quit;
+	bool slave;
+	bool shm;
+	/* Relay only: genmoves already sent to our slaves at this move. */
+	bool searching;
 	struct move my_last_move;
 	struct move_stats my_last_stats;
 	int slaves;
@@ -138,6 +162,10 @@ path2sstr(path_t path, struct board *b)
 	static int bi = 0;
 	char *b2;
 	b2 = buf[bi++ & 15];
+	if (is_deep_path(path)) {
+		snprintf(b2, 64, "deep:%"PRIpath, path);
+		return b2;
+	}
 	*b2 = '\0';
 	char *s = b2;
 	char *end = b2 + 64;
@@ -157,6 +185,23 @@ static enum parse_code
 distributed_notify(struct engine *e, struct board *b, int id, char *cmd, char *args, char **reply)
 {
 	struct distributed *dist = e->data;
+	enum parse_code ok = P_OK;
+
+	if (dist->slave) {
+		/* As a relay, behave like a uct slave toward our parent
+		 * (see uct/slave.c:uct_notify()). */
+		if (move_number(id) != b->moves && !reply_disabled(id) && !is_reset(cmd)) {
+			static char buf[128];
+			snprintf(buf, sizeof(buf), "Out of sync, %d %s, move %d expected", id, cmd, b->moves);
+			if (DEBUGL(0))
+				fprintf(stderr, "%s\n", buf);
+			*reply = buf;
+			if (!gtp_is_valid(e, cmd)) return P_OK;
+			return P_DONE_ERROR;
+		}
+		if (reply_disabled(id)) ok = P_NOREPLY;
+		dist->searching = false;
+	}
 
 	/* Commands that should not be sent to slaves.
 	 * time_left will be part of next pachi-genmoves,
@@ -172,26 +217,28 @@ distributed_notify(struct engine *e, struct board *b, int id, char *cmd, char *a
 	    || !strcasecmp(cmd, "kgs-genmove_cleanup")
 	    || !strcasecmp(cmd, "final_score")
 	    || !strcasecmp(cmd, "final_status_list"))
-		return P_OK;
+		return ok;
 
 	protocol_lock();
 
-	// Create a new command to be sent by the slave threads.
+	// Create a new command to be sent to the slaves.
 	new_cmd(b, cmd, args);
 
 	/* Wait for replies here. If we don't wait, we run the
 	 * risk of getting out of sync with most slaves and
 	 * sending command history too frequently. But don't wait
 	 * for all slaves otherwise we can lose on time because of
-	 * a single slow slave when replaying a whole game. */
+	 * a single slow slave when replaying a whole game.
+	 * A relay must reply before its parent gives up waiting. */
 	int min_slaves = active_slaves > 1 ? 3 * active_slaves / 4 : 1;
-	get_replies(time_now() + MAX_FAST_CMD_WAIT, min_slaves);
+	double wait = dist->slave ? MAX_FAST_CMD_WAIT / 2 : MAX_FAST_CMD_WAIT;
+	get_replies(time_now() + wait, min_slaves);
 
 	protocol_unlock();
 
 	// At the beginning wait even more for late slaves.
-	if (b->moves == 0) sleep(1);
-	return P_OK;
+	if (b->moves == 0 && !dist->slave) sleep(1);
+	return ok;
 }
 
 /* The playouts sent by slaves for the children of the root node
@@ -401,6 +448,75 @@ distributed_genmove(struct engine *e, struct board *b, struct time_info *ti,
 	return coord_copy(best);
 }
 
+/* Reply to pachi-genmoves from our parent when we are a relay.
+ * args has the same format as in uct/slave.c:uct_genmoves(); the
+ * args are forwarded to our slaves but the binary stats go to the
+ * receive queue. Return the same reply as uct/slave.c:report_stats()
+ * with the sums for all our slaves, and the stats merged from all
+ * our slaves in *stats_buf. Keep this code in sync with
+ * uct/slave.c:uct_genmoves() and distributed_genmove(). */
+static char *
+distributed_genmoves(struct engine *e, struct board *b, struct time_info *ti, enum stone color,
+		     char *args, bool pass_all_alive, void **stats_buf, int *stats_size)
+{
+	struct distributed *dist = e->data;
+	char *cmd = pass_all_alive ? "pachi-genmoves_cleanup" : "pachi-genmoves";
+
+	int size = 0, format = STATS_RAW, parent_format = STATS_RAW;
+	char *sizep = strchr(args, '@');
+	if (sizep) sscanf(sizep, "@%d:%d:%d", &size, &format, &parent_format);
+	int reply_format = parent_format < STATS_FORMAT_MAX ? parent_format : STATS_FORMAT_MAX;
+
+	/* Forward the args without our binary size; each slave
+	 * gets its own (see get_binary_arg()). */
+	char slave_args[CMDS_SIZE];
+	int len = strcspn(args, "@\n");
+	while (len > 0 && args[len-1] == ' ') len--;
+	snprintf(slave_args, sizeof(slave_args), "%s %.*s%s", stone2str(color), len, args,
+		 dist->searching ? " @0\n" : "\n");
+
+	protocol_lock();
+	if (!dist->searching) clear_receive_queue();
+	if (!relay_receive_stats(stdin, size, format)) {
+		protocol_unlock();
+		return NULL;
+	}
+	if (!dist->searching) {
+		/* Send the first genmoves without stats. */
+		new_cmd(b, cmd, slave_args);
+		dist->searching = true;
+	} else {
+		update_cmd(b, cmd, slave_args, false);
+	}
+
+	/* Reply with fresh stats but without delaying our parent. */
+	get_replies(time_now() + MAX_GENMOVES_WAIT, 1);
+
+	struct large_stats stats_array[board_size2(b) + 2], *stats;
+	stats = &stats_array[2];
+	int played, playouts, threads;
+	bool keep_looking;
+	select_best_move(b, stats, &played, &playouts, &threads, &keep_looking);
+
+	*stats_buf = relay_send_stats(reply_format, stats_size);
+	protocol_unlock();
+
+	static char reply[10240];
+	char *r = reply;
+	char *end = reply + sizeof(reply);
+	r += snprintf(r, end - r, "%d %d %d %d @%d", played, playouts,
+		      threads, keep_looking, *stats_size);
+	/* Old masters do not know about formats. */
+	if (reply_format != STATS_RAW)
+		r += snprintf(r, end - r, ":%d", reply_format);
+	for (coord_t c = resign; c < board_size2(b); c++) {
+		if (stats[c].playouts <= 0) continue;
+		r += snprintf(r, end - r, "\n%s %d %.16f", coord2sstr(c, b),
+			      (int)stats[c].playouts, stats[c].value);
+	}
+	return reply;
+}
+
 static char *
 distributed_chat(struct engine *e, struct board *b, bool opponent, char *from, char *cmd)
 {
@@ -486,6 +602,12 @@ distributed_state_init(char *arg, struct board *b)
 				dist->stats_hbits = atoi(optval);
 			} else if (!strcasecmp(optname, "slaves_quit")) {
 				dist->slaves_quit = !optval || atoi(optval);
+			} else if (!strcasecmp(optname, "slave")) {
+				/* Act as a relay, slave of another master. */
+				dist->slave = !optval || atoi(optval);
+			} else if (!strcasecmp(optname, "shm")) {
+				/* Shared memory buffers for local slaves. */
+				dist->shm = !optval || atoi(optval);
 			} else {
 				fprintf(stderr, "distributed: Invalid engine argument %s or missing value\n", optname);
 			}
@@ -499,8 +621,11 @@ distributed_state_init(char *arg, struct board *b)
 		exit(1);
 	}
 
-	merge_init(&default_sstate, dist->shared_nodes, dist->stats_hbits, dist->max_slaves);
-	protocol_init(dist->slave_port, dist->proxy_port, dist->max_slaves);
+	/* A relay merges the stats of its parent as those of one more slave. */
+	merge_init(&default_sstate, dist->shared_nodes, dist->stats_hbits,
+		   dist->max_slaves + dist->slave);
+	protocol_init(dist->slave_port, dist->proxy_port, dist->max_slaves,
+		      dist->slave, dist->shm);
 
 	return dist;
 }
@@ -516,6 +641,7 @@ engine_distributed_init(char *arg, struct board *b)
 		"Anyone can send me 'winrate' in private chat to get my assessment of the position.";
 	e->notify = distributed_notify;
 	e->genmove = distributed_genmove;
+	if (dist->slave) e->genmoves = distributed_genmoves;
 	e->dead_group_list = distributed_dead_group_list;
 	e->chat = distributed_chat;
 	e->data = dist;
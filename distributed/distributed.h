@@ -2,6 +2,7 @@
 #define PACHI_DISTRIBUTED_DISTRIBUTED_H
 
 #include <limits.h>
+#include <math.h>
 
 #include "engine.h"
 #include "stats.h"
@@ -10,19 +11,39 @@
  * A1->B2->C3 is encoded as coord(A1)<<18 + coord(B2)<<9 + coord(C3)
  * for 19x19. In this version the table is not a transposition table
  * so A1->B2->C3 and C3->B2->A1 are different.
- * The depth is limited to 7 for 19x19 (9 for 9x9) to fit in 64 bits.
+ * Exact paths are kept below PATH_DEEP, so they are limited to 6 levels
+ * for 19x19 (8 for 9x9). Deeper nodes get a hash of their parent path
+ * and coord instead, at or above PATH_DEEP. A deep path cannot be
+ * decoded: a slave only finds the nodes it has reached itself (see
+ * uct/slave.c:track_children()).
  * path_t is signed to include pass and resign. */
 typedef int64_t path_t;
 #define PRIpath PRIx64
 #define PATH_T_MAX INT64_MAX
+#define PATH_DEEP (((path_t)1) << 62)
 
 #define hash_mask(bits) ((1<<(bits))-1)
 
-/* parent_path() must never be used if path might be pass or resign. */
+#define is_deep_path(path) ((path) >= PATH_DEEP)
+/* parent_path() and leaf_coord() must never be used if path might
+ * be pass, resign or a deep path. */
 #define parent_path(path, board) ((path) >> board_bits2(board))
 #define leaf_coord(path, board) ((path) & hash_mask(board_bits2(board)))
-#define append_child(path, c, board) (((path) << board_bits2(board)) | (c))
-#define max_parent_path(u, b) (((path_t)1) << (((u)->shared_levels - 1) * board_bits2(b)))
+
+static inline path_t
+append_child(path_t path, coord_t c, struct board *b)
+{
+	if (path < PATH_DEEP >> board_bits2(b))
+		return (path << board_bits2(b)) | c;
+
+	/* splitmix64 finalizer. The result stays below PATH_T_MAX,
+	 * which is the terminator value in the master. */
+	uint64_t h = (uint64_t)path * 0x9e3779b97f4a7c15ULL + c;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return PATH_DEEP | (path_t)(h >> 3);
+}
 
 
 /* For debugging only */
@@ -65,12 +86,122 @@ struct incr_stats {
 	struct move_stats incr;
 };
 
+/* Binary formats of the incr_stats arrays. The format is negotiated
+ * per slave connection (see protocol.c:get_binary_arg()); old peers
+ * only know STATS_RAW.
+ * STATS_RAW is an array of incr_stats structs.
+ * STATS_COMPACT is the varint node count, then for each node the
+ * varint delta from the previous coord path (paths are sorted), the
+ * varint playouts and the value quantized to 16 bits. A node takes
+ * about 5 bytes instead of 16, and never more than an incr_stats struct,
+ * so the same buffers can hold both formats. */
+enum stats_format {
+	STATS_RAW = 0,
+	STATS_COMPACT = 1,
+	STATS_FORMAT_MAX = STATS_COMPACT,
+};
+
+/* Flag added to the format when the binary data is in the master's
+ * shared memory ring instead of following on the socket (see shm.c).
+ * It is only used if the master gave the buffer position. */
+#define STATS_SHM 0x100
+
+/* Smallest compact node: 1-byte delta, 1-byte playouts, 2-byte value. */
+#define STATS_COMPACT_MIN_NODE 4
+
+static inline unsigned char *
+varint_put(unsigned char *p, uint64_t x)
+{
+	while (x >= 0x80) {
+		*p++ = x | 0x80;
+		x >>= 7;
+	}
+	*p++ = x;
+	return p;
+}
+
+/* Return NULL if the varint is truncated or too long. */
+static inline unsigned char *
+varint_get(unsigned char *p, unsigned char *end, uint64_t *x)
+{
+	uint64_t v = 0;
+	for (int shift = 0; p < end && shift < 64; shift += 7) {
+		unsigned char c = *p++;
+		v |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			*x = v;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/* Encode nodes stats sorted by increasing coord path in the
+ * compact format. Return the byte size. */
+static inline int
+stats_encode(struct incr_stats *s, int nodes, void *buf)
+{
+	unsigned char *p = varint_put(buf, nodes);
+	path_t prev = 0;
+	for (int n = 0; n < nodes; n++) {
+		p = varint_put(p, s[n].coord_path - prev);
+		prev = s[n].coord_path;
+		p = varint_put(p, s[n].incr.playouts);
+		long q = lrint(s[n].incr.value * 65535);
+		if (q < 0) q = 0;
+		if (q > 65535) q = 65535;
+		*p++ = q; *p++ = q >> 8;
+	}
+	return p - (unsigned char *)buf;
+}
+
+/* Sequential reader of a compact stats buffer. It never reads
+ * beyond the buffer so it is safe on a buffer being recycled. */
+struct stats_reader {
+	unsigned char *p, *end;
+	int nodes; // nodes left
+	path_t path;
+};
+
+static inline void
+stats_reader_init(struct stats_reader *r, void *buf, int size)
+{
+	uint64_t nodes;
+	r->end = (unsigned char *)buf + size;
+	r->p = varint_get(buf, r->end, &nodes);
+	r->nodes = r->p && nodes <= (uint64_t)size / STATS_COMPACT_MIN_NODE ? nodes : 0;
+	r->path = 0;
+}
+
+/* Decode the next node. Return false at the end or on error. */
+static inline bool
+stats_read(struct stats_reader *r, struct incr_stats *s)
+{
+	uint64_t delta, playouts;
+	if (r->nodes <= 0
+	    || !(r->p = varint_get(r->p, r->end, &delta))
+	    || !(r->p = varint_get(r->p, r->end, &playouts))
+	    || r->end - r->p < 2) {
+		r->nodes = 0;
+		return false;
+	}
+	r->path += delta;
+	s->coord_path = r->path;
+	s->incr.playouts = playouts;
+	s->incr.value = (r->p[0] | r->p[1] << 8) / 65535.0;
+	r->p += 2;
+	r->nodes--;
+	return true;
+}
+
 /* A slave machine updates at most 7 (19x19) or 9 (9x9) nodes for each
  * update of the root node. If we have at most 20 threads at 1500
  * games/s each, a slave machine can do at most 30K games/s. */
 
 /* At 30K games/s a slave can output 270K nodes/s or 4.2 MB/s. The master
- * with a 100 MB/s network can thus support at most 24 slaves. */
+ * with a 100 MB/s network can thus support at most 24 slaves. With
+ * STATS_COMPACT a slave outputs about 1.3 MB/s, so max_slaves can be
+ * raised about 3x if all slaves support it. */
 #define DEFAULT_MAX_SLAVES 24
 
 /* In a 30s move at 270K nodes/s a slave can send and receive at most
@@ -70,34 +70,71 @@ stats_tally(struct incr_stats *s, struct slave_state *sstate, int *bucket_count)
 
 static struct incr_stats terminator = { .coord_path = INT64_MAX };
 
-/* Initialize the next pointers (see merge_new_stats()).
- * Exclude invalid buffers and my own buffers by setting their next pointer
+/* Position of the N-way merge in one receive buffer. Raw buffers
+ * are read in place; compact buffers are decoded on the fly. */
+struct merge_cursor {
+	struct incr_stats s; // current node, terminator at the end
+	struct incr_stats *raw; // next raw node, NULL if compact
+	struct stats_reader compact;
+};
+
+static inline void
+cursor_next(struct merge_cursor *c)
+{
+	if (c->raw) {
+		c->s = *c->raw++;
+	} else if (!stats_read(&c->compact, &c->s)) {
+		c->s = terminator;
+	}
+}
+
+static inline void
+cursor_stop(struct merge_cursor *c)
+{
+	c->s = terminator;
+	c->raw = NULL;
+	c->compact.nodes = 0;
+}
+
+/* Initialize the cursors (see merge_new_stats()).
+ * Exclude invalid buffers and my own buffers by setting their cursor
  * to a terminator value. Update min if there are too many nodes to merge,
  * so that merge time remains reasonable and the merge buffer doesn't overflow.
- * (We skip the oldest buffers if the slave thread is too much behind. It is
+ * (We skip the oldest buffers if the slave is too much behind. It is
  * more important to get frequent incomplete updates than late complete updates.)
  * Return the total number of nodes to be merged.
  * The slave lock is not held on either entry or exit of this function. */
 static int
-filter_buffers(struct slave_state *sstate, struct incr_stats **next,
+filter_buffers(struct slave_state *sstate, struct merge_cursor *next,
 	       int *min, int max)
 {
-	int size = 0;
-	int max_size = sstate->max_merged_nodes * sizeof(struct incr_stats);
+	int nodes = 0;
  
 	for (int q = max; q >= *min; q--) {
-		if (!receive_queue[q] || receive_queue[q]->owner == sstate->thread_id) {
-			next[q] = &terminator;
-		} else if (size + receive_queue[q]->size > max_size) {
+		struct buf_state *bs = receive_queue[q];
+		if (!bs || bs->owner == sstate->thread_id) {
+			cursor_stop(&next[q]);
+			continue;
+		}
+		int size = bs->size;
+		int buf_nodes;
+		if (bs->format == STATS_COMPACT) {
+			stats_reader_init(&next[q].compact, bs->buf, size);
+			next[q].raw = NULL;
+			buf_nodes = next[q].compact.nodes;
+		} else {
+			next[q].raw = (struct incr_stats *)bs->buf;
+			buf_nodes = size / sizeof(struct incr_stats);
+		}
+		if (nodes + buf_nodes > sstate->max_merged_nodes) {
 			*min = q + 1;
 			assert(*min <= max);
 			break;
-		} else {
-			next[q] = (struct incr_stats *)receive_queue[q]->buf;
-			size += receive_queue[q]->size;
 		}
+		nodes += buf_nodes;
+		cursor_next(&next[q]);
 	}
-	return size / sizeof(struct incr_stats);
+	return nodes;
 }
 
 /* Return the minimum coord path of next[min..max].
@@ -108,12 +145,12 @@ filter_buffers(struct slave_state *sstate, struct incr_stats **next,
  * been invalidated, the caller must check for this; in this
  * case the returned value is < the correct value. */
 static inline path_t
-min_coord(struct incr_stats **next, int min, int max)
+min_coord(struct merge_cursor *next, int min, int max)
 {
-	path_t min_c = next[min]->coord_path;
+	path_t min_c = next[min].s.coord_path;
 	for (int q = min + 1; q <= max; q++) {
-		if (next[q]->coord_path < min_c)
-			min_c = next[q]->coord_path;
+		if (next[q].s.coord_path < min_c)
+			min_c = next[q].s.coord_path;
 	}
 	return min_c;
 }
@@ -122,7 +159,8 @@ min_coord(struct incr_stats **next, int min, int max)
  * update the hash table, set the bucket counts, and save the
  * list of updated hash table entries. The input buffers and
  * the output buffer are all sorted by increasing coord path.
- * The input buffers end with a terminator value INT64_MAX.
+ * Raw input buffers end with a terminator value INT64_MAX,
+ * compact ones are read up to their node count.
  * Return the number of updated hash table entries. */
 
 /* The slave lock is not held on either entry or exit of this function,
@@ -138,8 +176,8 @@ merge_new_stats(struct slave_state *sstate, int min, int max,
 	if (max < min) return 0;
 
 	/* next[q] is the next value to be checked in receive_queue[q]->buf */
-	struct incr_stats *next_[max - min + 1];
-	struct incr_stats **next = next_ - min;
+	struct merge_cursor next_[max - min + 1];
+	struct merge_cursor *next = next_ - min;
 	*nodes_read = filter_buffers(sstate, next, &min, max);
 
 	/* prev_min_c is only used for debugging. */
@@ -156,7 +194,7 @@ merge_new_stats(struct slave_state *sstate, int min, int max,
 		struct incr_stats sum = { .coord_path = min_c,
 					  .incr = { .playouts = 0, .value = 0.0 }};
 		for (int q = min; q <= max; q++) {
-			struct incr_stats s = *(next[q]);
+			struct incr_stats s = next[q].s;
 
 			/* If s.coord_path != min_c, we must skip s.coord_path for now.
 			 * If min_c is invalid, a future iteration will get a stable
@@ -168,7 +206,7 @@ merge_new_stats(struct slave_state *sstate, int min, int max,
 			 * to avoid a race condition, and also to avoid multiple useless
 			 * checks for the same coord_path. */
 			if (unlikely(!receive_queue[q])) {
-				next[q] = &terminator;
+				cursor_stop(&next[q]);
 				continue;
 			}
 
@@ -182,11 +220,11 @@ merge_new_stats(struct slave_state *sstate, int min, int max,
 
 			assert(s.coord_path && s.incr.playouts);
 			stats_add_result(&sum.incr, s.incr.value, s.incr.playouts);
-			next[q]++;
+			cursor_next(&next[q]);
 		}
 		/* All the buffers containing min_c may have been invalidated
-		 * so sum may still be zero. But in this case the next[q] which
-		 * contained min_c have been reset to &terminator so we will
+		 * so sum may still be zero. But in this case their cursors
+		 * have been reset to the terminator so we will
 		 * not loop forever. */
 		if (!sum.incr.playouts) continue;
 
@@ -246,7 +284,8 @@ output_stats(struct incr_stats *buf, struct slave_state *sstate,
 }
 
 /* Get all incremental stats received from other slaves since the
- * last send. Store in buf the stats with largest playout increments.
+ * last send. Store in buf the stats with largest playout increments,
+ * in the format negotiated with the slave.
  * Return the byte size of the resulting buffer. The caller must
  * check that the result is still valid.
  * The slave lock is held on both entry and exit of this function. */
@@ -289,21 +328,28 @@ get_new_stats(struct incr_stats *buf, struct slave_state *sstate, int cmd_id)
 		for (int q = min; q <= max; q++) missed += !receive_queue[q];
 
 	/* Put the best increments in the output buffer. */
-	int output_nodes = output_stats(buf, sstate, bucket_count, merge_count);
+	int output_nodes, size;
+	if (sstate->stats_format == STATS_COMPACT) {
+		output_nodes = output_stats(sstate->out_stats, sstate, bucket_count, merge_count);
+		size = output_nodes ? stats_encode(sstate->out_stats, output_nodes, buf) : 0;
+	} else {
+		output_nodes = output_stats(buf, sstate, bucket_count, merge_count);
+		size = output_nodes * sizeof(*buf);
+	}
 
 	if (DEBUGVV(2)) {
 		char b[1024];
 		snprintf(b, sizeof(b), "merged %d..%d missed %d %d/%d nodes,"
-			 " output %d/%d nodes in %.3fms (clear %.3fms)\n",
+			 " output %d/%d nodes %d bytes in %.3fms (clear %.3fms)\n",
 			 min, max, missed, merge_count, nodes_read, output_nodes,
-			 sstate->max_buf_size / (int)sizeof(*buf),
+			 sstate->max_buf_size / (int)sizeof(*buf), size,
 			 (time_now() - start)*1000, clear_time*1000);
 		logline(&sstate->client, "= ", b);
 	}
 
 	protocol_lock();
 
-	return output_nodes * sizeof(*buf);
+	return size;
 }
 
 /* Allocate the buffers in the merge specific part of the slave sate,
@@ -313,14 +359,16 @@ merge_state_alloc(struct slave_state *sstate)
 {
 	sstate->stats_htable = calloc2(1 << sstate->stats_hbits, sizeof(struct incr_stats));
 	sstate->merged = malloc2(sstate->max_merged_nodes * sizeof(int));
+	sstate->out_stats = malloc2(sstate->max_buf_size);
 	sstate->max_buf_size -= sizeof(struct incr_stats);
 }
 
-/* Append a terminator value to make merge_new_stats() more
- * efficient. merge_state_alloc() has reserved enough space. */
+/* Append a terminator value to raw buffers to make merge_new_stats()
+ * more efficient. merge_state_alloc() has reserved enough space. */
 static void
-merge_insert_hook(struct incr_stats *buf, int size)
+merge_insert_hook(struct incr_stats *buf, int size, int format)
 {
+	if (format != STATS_RAW) return;
 	int nodes = size / sizeof(*buf);
 	buf[nodes].coord_path = INT64_MAX;
 }
@@ -337,7 +385,7 @@ merge_init(struct slave_state *sstate, int shared_nodes, int stats_hbits, int ma
 	sstate->alloc_hook = merge_state_alloc;
 	sstate->args_hook = (getargs_hook)get_new_stats;
 
-	/* At worst one late slave thread may have to merge up to
+	/* At worst one late slave may have to merge up to
 	 *   shared_nodes * BUFFERS_PER_SLAVE * (max_slaves - 1)
 	 * nodes but on average it should not have to merge more than
 	 *   dist->shared_nodes * (max_slaves - 1)
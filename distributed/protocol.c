@@ -12,6 +12,8 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <pthread.h>
 #include <ctype.h>
 #include <unistd.h>
@@ -25,6 +27,7 @@
 #include "debug.h"
 #include "distributed/distributed.h"
 #include "distributed/protocol.h"
+#include "distributed/shm.h"
 
 /* All gtp commands for current game separated by \n */
 static char gtp_cmds[CMDS_SIZE];
@@ -64,9 +67,6 @@ static int queue_max_length;
  * read without the lock but is only written with lock held. */
 static pthread_mutex_t slave_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/* Condition signaled when a new gtp command is available. */
-static pthread_cond_t cmd_cond = PTHREAD_COND_INITIALIZER;
-
 /* Condition signaled when reply_count increases. */
 static pthread_cond_t reply_cond = PTHREAD_COND_INITIALIZER;
 
@@ -80,6 +80,12 @@ static double start_time;
 /* Default slave state. */
 struct slave_state default_sstate;
 
+/* Maximum number of slave connections. */
+static int max_slaves;
+
+/* Slave port if the binary buffers are in shared memory. */
+static char *shm_port = NULL;
+
 
 /* Get exclusive access to the threads and commands state. */
 void
@@ -137,113 +143,6 @@ proxy_thread(void *arg)
 	pthread_exit(NULL);
 }
 
-/* Get a reply to one gtp command. Return the gtp command id,
- * or -1 if error. reply must have at least CMDS_SIZE bytes.
- * The ascii reply ends with an empty line; if the first line
- * contains "@size", a binary reply of size bytes follows the
- * empty line. @size is not standard gtp, it is only used
- * internally by Pachi for the genmoves command; it must be the
- * last parameter on the line.
- * *bin_size is the maximum size upon entry, actual size on return.
- * slave_lock is not held on either entry or exit of this function. */
-static int
-get_reply(FILE *f, struct in_addr client, char *reply, void *bin_reply, int *bin_size)
-{
-	double start = time_now();
-
-	int reply_id = -1;
-	*reply = '\0';
-	if (!fgets(reply, CMDS_SIZE, f)) return -1;
-
-	/* Check for binary reply. */
-	char *s = strchr(reply, '@');
-	int size = 0;
-	if (s) size = atoi(s+1);
-	assert(size <= *bin_size);
-	*bin_size = size;
-
-	if (DEBUGV(s, 2))
-		logline(&client, "<<", reply);
-	if ((*reply == '=' || *reply == '?') && isdigit(reply[1]))
-		reply_id = atoi(reply+1);
-
-	/* Read the rest of the ascii reply */
-	char *line = reply + strlen(reply);
-	while (fgets(line, reply + CMDS_SIZE - line, f) && *line != '\n') {
-		if (DEBUGL(3))
-			logline(&client, "<<", line);
-		line += strlen(line);
-	}
-	if (*line != '\n') return -1;
-
-	/* Read the binary reply if any. */
-	int len;
-	while (size && (len = fread(bin_reply, 1, size, f)) > 0) {
-		bin_reply = (char *)bin_reply + len;
-		size -= len;
-	}
-	if (*bin_size && DEBUGVV(2)) {
-		char buf[1024];
-		snprintf(buf, sizeof(buf), "read reply %d+%d bytes in %.4fms\n",
-			 (int)strlen(reply), *bin_size,
-			 (time_now() - start)*1000);
-		logline(&client, "= ", buf);
-	}
-	return size ? -1 : reply_id;
-}
-
-/* Send the gtp command to_send and get a reply from the slave machine.
- * Write the reply in buf which must have at least CMDS_SIZE bytes.
- * If *bin_size > 0, send bin_buf after the gtp command.
- * Return any binary reply in bin_buf and set its size in bin_size.
- * bin_buf is private to the slave and need not be copied.
- * Return the gtp command id, or -1 if error.
- * slave_lock is held on both entry and exit of this function. */
-static int
-send_command(char *to_send, void *bin_buf, int *bin_size,
-	     FILE *f, struct slave_state *sstate, char *buf)
-{
-	assert(to_send && gtp_cmd && bin_buf && bin_size);
-	strncpy(buf, to_send, CMDS_SIZE);
-	bool resend = to_send != gtp_cmd;
-
-	pthread_mutex_unlock(&slave_lock);
-
-	if (DEBUGL(1) && resend)
-		logline(&sstate->client, "? ",
-			to_send == gtp_cmds ? "resend all\n" : "partial resend\n");
-
-	double start = time_now();
-	fputs(buf, f);
-
-	if (*bin_size)
-		fwrite(bin_buf, 1, *bin_size, f);
-	fflush(f);
-
-	if (DEBUGV(strchr(buf, '@'), 2)) {
-		double ms = (time_now() - start) * 1000.0;
-		if (!DEBUGL(3)) {
-			char *s = strchr(buf, '\n');
-			if (s) s[1] = '\0';
-		}
-		logline(&sstate->client, ">>", buf);
-		if (*bin_size) {
-			char b[1024];
-			snprintf(b, sizeof(b),
-				 "sent cmd %d+%d bytes in %.4fms\n",
-				 (int)strlen(buf), *bin_size, ms);
-			logline(&sstate->client, "= ", b);
-		}
-	}
-
-	/* Reuse the buffers for the reply. */
-	*bin_size = sstate->max_buf_size;
-	int reply_id = get_reply(f, sstate->client, buf, bin_buf, bin_size);
-
-	pthread_mutex_lock(&slave_lock);
-	return reply_id;
-}
-
 /* Return the command sent after that with the given gtp id,
  * or gtp_cmds if the id wasn't used in this game. If a play command
  * has overwritten a genmoves command, return the play command.
@@ -268,14 +167,20 @@ next_command(int cmd_id)
 	return next;
 }
 
-/* Allocate buffers for a slave thread. The state should have been
+/* Allocate buffers for a slave. The state should have been
  * initialized already as a copy of the default slave state.
  * slave_lock is not held on either entry or exit of this function. */
 static void
 slave_state_alloc(struct slave_state *sstate)
 {
+	char *ring = NULL;
+	if (shm_port && sstate->thread_id < max_slaves)
+		ring = shm_ring_create(shm_port, sstate->thread_id,
+				       BUFFERS_PER_SLAVE, sstate->max_buf_size);
+	sstate->shm_ring = ring != NULL;
 	for (int n = 0; n < BUFFERS_PER_SLAVE; n++) {
-		sstate->b[n].buf = malloc2(sstate->max_buf_size);
+		sstate->b[n].buf = ring ? ring + n * sstate->max_buf_size
+				   : malloc2(sstate->max_buf_size);
 		sstate->b[n].owner = sstate->thread_id;
 	}
 	if (sstate->alloc_hook) sstate->alloc_hook(sstate);
@@ -318,7 +223,7 @@ get_free_buf(struct slave_state *sstate)
  * recent buffer allocated by the calling thread.
  * slave_lock is held on both entry and exit of this function. */
 static void
-insert_buf(struct slave_state *sstate, void *buf, int size)
+insert_buf(struct slave_state *sstate, void *buf, int size, int format)
 {
 	assert(queue_length < queue_max_length);
 
@@ -327,7 +232,7 @@ insert_buf(struct slave_state *sstate, void *buf, int size)
 
 	/* Update the buffer if necessary before making it
 	 * available to other threads. */
-	if (sstate->insert_hook) sstate->insert_hook(buf, size);
+	if (sstate->insert_hook) sstate->insert_hook(buf, size, format);
 
 	if (DEBUGVV(7)) {
 		char b[1024];
@@ -338,6 +243,7 @@ insert_buf(struct slave_state *sstate, void *buf, int size)
 	}
 	receive_queue[queue_length] = &sstate->b[newest];
 	receive_queue[queue_length]->size = size;
+	receive_queue[queue_length]->format = format;
 	receive_queue[queue_length]->queue_index = queue_length;
 	queue_length++;
 }
@@ -365,7 +271,7 @@ clear_receive_queue(void)
  * slave_lock is held on both entry and exit of this function. */
 static bool
 process_reply(int reply_id, char *reply, char *reply_buf,
-	      void *bin_reply, int bin_size, int *last_reply_id,
+	      void *bin_reply, int bin_size, int bin_format, int *last_reply_id,
 	      int *reply_slot, struct slave_state *sstate)
 {
 	/* Resend everything if slave returned an error. */
@@ -390,7 +296,9 @@ process_reply(int reply_id, char *reply, char *reply_buf,
 		*reply_slot = reply_count++;
 	gtp_replies[*reply_slot] = reply_buf;
 
-	if (bin_size) insert_buf(sstate, bin_reply, bin_size);
+	/* The slave replies in the best format we both know. */
+	if (bin_format >= 0) sstate->stats_format = bin_format;
+	if (bin_size) insert_buf(sstate, bin_reply, bin_size, bin_format);
 
 	pthread_cond_signal(&reply_cond);
 	*last_reply_id = reply_id;
@@ -404,6 +312,12 @@ process_reply(int reply_id, char *reply, char *reply_buf,
  * but still return a buffer, to be used for the reply.
  * Return NULL if the binary arg is obsolete by the time we have
  * finished computing it, because a new command is available.
+ * The binary arg is in the format negotiated with the slave; we send
+ * "@size:format:max" with max the best format we know, and the slave
+ * tells the format of its reply (see parse_reply_header()). Old slaves only
+ * read size and always reply in STATS_RAW. If the buffers are in shared
+ * memory we add ":slot:index", the position of buf in the shared ring,
+ * and set STATS_SHM in format if the slave uses it (see shm.c).
  * This version only gets the buffer for the reply, to be completed
  * in future commits.
  * slave_lock is held on both entry and exit of this function. */
@@ -427,127 +341,659 @@ get_binary_arg(struct slave_state *sstate, char *cmd, int cmd_size, int *bin_siz
 	*bin_size = size;
 	s = strchr(cmd, '@');
 	assert(s);
-	snprintf(s, cmd + cmd_size - s, "@%d\n", size);
+	int format = sstate->stats_format | (sstate->shm ? STATS_SHM : 0);
+	if (sstate->shm_ring) {
+		snprintf(s, cmd + cmd_size - s, "@%d:%d:%d:%d:%d\n", size, format, STATS_FORMAT_MAX,
+			 sstate->thread_id, sstate->newest_buf);
+	} else {
+		snprintf(s, cmd + cmd_size - s, "@%d:%d:%d\n", size, format, STATS_FORMAT_MAX);
+	}
 	return buf;
 }
 
-/* Main loop of a slave thread.
- * Send the current command to the slave machine and wait for a reply.
- * Resend command history if the slave machine is out of sync.
- * Returns when the connection with the slave machine is cut.
+/* State of the parent of a relay (see distributed.c). The parent
+ * sends the stats of all other subtrees, which are inserted in the
+ * receive queue like those of a slave, and gets the stats merged
+ * from all our slaves. Its thread_id is max_slaves. NULL if we are
+ * not a relay. */
+static struct slave_state *parent_sstate = NULL;
+
+/* Read from f the binary stats sent by our parent, and insert them
+ * in the receive queue for our slaves. Return false if error.
+ * slave_lock is held on both entry and exit of this function. */
+bool
+relay_receive_stats(FILE *f, int size, int format)
+{
+	struct slave_state *sstate = parent_sstate;
+	assert(sstate);
+	if (!size) return true;
+	if (size < 0 || size > sstate->max_buf_size || format > STATS_FORMAT_MAX)
+		return false;
+	void *buf = get_free_buf(sstate);
+
+	/* Only this thread uses the parent buffers, don't block
+	 * the slaves while reading. */
+	pthread_mutex_unlock(&slave_lock);
+	bool ok = fread(buf, 1, size, f) == (size_t)size;
+	pthread_mutex_lock(&slave_lock);
+
+	if (ok) insert_buf(sstate, buf, size, format);
+	return ok;
+}
+
+/* Get the stats received from all our slaves since the last call,
+ * merged and encoded in the given format for our parent.
+ * Set *size to the byte size of the returned buffer.
+ * slave_lock is held on both entry and exit of this function. */
+void *
+relay_send_stats(int format, int *size)
+{
+	struct slave_state *sstate = parent_sstate;
+	assert(sstate && gtp_cmd);
+	void *buf = get_free_buf(sstate);
+	sstate->stats_format = format;
+	*size = sstate->args_hook(buf, sstate, atoi(gtp_cmd));
+	return buf;
+}
+
+/* Slave connections are all handled by a single I/O thread waiting
+ * for socket events (epoll on Linux, poll elsewhere). Sockets are
+ * non-blocking and each slave has its own receive buffer, so a slow
+ * slave cannot delay the others. Computing the binary arg of genmoves
+ * (merging stats) is done by a pool of prepare threads, because it
+ * can take a while and needs slave_lock. Binary replies are read
+ * directly into the slave's ring of buffers, which are then inserted
+ * in the receive queue without copy.
+ *
+ * A slave slot goes through these states. The I/O thread owns the
+ * connection in all states except SLAVE_PREPARING, where a prepare
+ * thread owns the command buffers. */
+enum slave_io {
+	SLAVE_FREE,       // no connection
+	SLAVE_HANDSHAKE,  // waiting for reply to "name"
+	SLAVE_IDLE,       // waiting for a new command
+	SLAVE_PREPARING,  // in prepare queue or computing binary arg
+	SLAVE_SENDING,    // sending command and binary arg
+	SLAVE_RECEIVING,  // reading reply
+};
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Max number of socket events handled per wakeup. */
+#define MAX_IO_EVENTS 64
+
+/* All slave slots, indexed by thread_id. */
+static struct slave_state *slaves;
+/* Number of slots not in SLAVE_FREE state. */
+static int connected_slaves = 0;
+
+static int listen_sock = -1;
+/* The I/O thread is woken up by writing to wake_pipe[1]. */
+static int wake_pipe[2];
+
+/* Slaves waiting for a prepare thread, and slaves whose command
+ * is ready to be sent. Both protected by slave_lock. */
+static struct slave_state *prepare_head = NULL, *prepare_tail = NULL;
+static struct slave_state *send_queue = NULL;
+
+/* Condition signaled when the prepare queue is not empty. */
+static pthread_cond_t prepare_cond = PTHREAD_COND_INITIALIZER;
+
+/* Value of cmd_count when the I/O thread last looked for idle slaves. */
+static int io_cmd_count = 0;
+
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+
+static int epoll_fd;
+
+static void
+io_init(void)
+{
+	epoll_fd = epoll_create(max_slaves + 2);
+	if (epoll_fd < 0) {
+		perror("epoll_create");
+		exit(42);
+	}
+}
+
+/* Watch fd for input, and also for output if out is true.
+ * ptr is returned by io_wait() when an event occurs. */
+static void
+io_watch(int fd, void *ptr, bool out, bool add)
+{
+	struct epoll_event ev = { .events = EPOLLIN | (out ? EPOLLOUT : 0), .data.ptr = ptr };
+	if (epoll_ctl(epoll_fd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev)) {
+		perror("epoll_ctl");
+		exit(42);
+	}
+}
+
+static void
+io_unwatch(int fd)
+{
+	struct epoll_event ev;
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+/* Wait for events, return the ptrs of the ready fds. */
+static int
+io_wait(void **ready)
+{
+	struct epoll_event ev[MAX_IO_EVENTS];
+	int n = epoll_wait(epoll_fd, ev, MAX_IO_EVENTS, -1);
+	for (int i = 0; i < n; i++)
+		ready[i] = ev[i].data.ptr;
+	return n < 0 ? 0 : n;
+}
+
+#else /* !__linux__ */
+
+#include <poll.h>
+
+static struct pollfd *poll_fds;
+static void **poll_ptrs;
+static int poll_count = 0;
+
+static void
+io_init(void)
+{
+	poll_fds = calloc2(max_slaves + 2, sizeof(*poll_fds));
+	poll_ptrs = calloc2(max_slaves + 2, sizeof(*poll_ptrs));
+}
+
+static void
+io_watch(int fd, void *ptr, bool out, bool add)
+{
+	int i = 0;
+	if (add) {
+		i = poll_count++;
+	} else {
+		while (poll_fds[i].fd != fd) i++;
+	}
+	poll_fds[i].fd = fd;
+	poll_fds[i].events = POLLIN | (out ? POLLOUT : 0);
+	poll_ptrs[i] = ptr;
+}
+
+static void
+io_unwatch(int fd)
+{
+	for (int i = 0; i < poll_count; i++) {
+		if (poll_fds[i].fd != fd) continue;
+		poll_count--;
+		poll_fds[i] = poll_fds[poll_count];
+		poll_ptrs[i] = poll_ptrs[poll_count];
+		return;
+	}
+}
+
+static int
+io_wait(void **ready)
+{
+	int n = 0;
+	if (poll(poll_fds, poll_count, -1) <= 0) return 0;
+	for (int i = 0; i < poll_count && n < MAX_IO_EVENTS; i++) {
+		if (poll_fds[i].revents)
+			ready[n++] = poll_ptrs[i];
+	}
+	return n;
+}
+
+#endif /* __linux__ */
+
+
+/* Wake up the I/O thread. */
+static void
+wake_io_thread(void)
+{
+	char c = 0;
+	if (write(wake_pipe[1], &c, 1) < 0 && errno != EAGAIN)
+		perror("write");
+}
+
+/* Errors which only mean that the operation would block. */
+static bool
+io_again(void)
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+/* Queue the slave for a prepare thread if it has something to send.
+ * slave_lock is held on both entry and exit of this function. */
+static void
+maybe_prepare(struct slave_state *sstate)
+{
+	if (sstate->io_state != SLAVE_IDLE || !gtp_cmd) return;
+	if (!sstate->resend && sstate->last_cmd_count == cmd_count) return;
+
+	sstate->io_state = SLAVE_PREPARING;
+	sstate->next_io = NULL;
+	if (prepare_tail)
+		prepare_tail->next_io = sstate;
+	else
+		prepare_head = sstate;
+	prepare_tail = sstate;
+	pthread_cond_signal(&prepare_cond);
+}
+
+/* Get the command to send to the slave machine, with binary
+ * arguments if necessary. If the slave was out of sync,
+ * send the history.
+ * Several commands may have been created since the slave was last
+ * idle (for example play then genmoves before the prepare thread
+ * runs), so we send the history unless the last reply of the slave
+ * was for the current gtp id.
  * slave_lock is held on both entry and exit of this function. */
 static void
-slave_loop(FILE *f, char *reply_buf, struct slave_state *sstate, bool resend)
+prepare_command(struct slave_state *sstate)
 {
 	char *to_send;
-	int last_cmd_count = 0;
-	int last_reply_id = -1;
-	int reply_slot = -1;
+	void *bin_buf;
+	int bin_size;
+	/* The slave did not reply to the last command sent, or replied
+	 * with an error; it is not just behind by a few new commands. */
+	bool out_of_sync = sstate->last_reply_id != sstate->last_sent_id;
+	do {
+		/* Resend complete or partial history if necessary. */
+		bool in_sync = sstate->last_reply_id == atoi(gtp_cmd);
+		to_send = in_sync ? gtp_cmd : next_command(sstate->last_reply_id);
+		/* Check that the command is still valid. */
+		bin_buf = get_binary_arg(sstate, gtp_cmd, gtp_cmds + CMDS_SIZE - gtp_cmd,
+					 &bin_size);
+	} while (!bin_buf);
+
+	sstate->last_cmd_count = cmd_count;
+	sstate->last_sent_id = atoi(gtp_cmd);
+	sstate->resend = to_send != gtp_cmd;
+	sstate->resend_msg = !sstate->resend || !out_of_sync ? NULL
+		: to_send == gtp_cmds ? "resend all\n" : "partial resend\n";
+	sstate->io_len = snprintf(sstate->io_buf, CMDS_SIZE, "%s", to_send);
+	if (sstate->io_len >= CMDS_SIZE) sstate->io_len = CMDS_SIZE - 1;
+	sstate->io_pos = 0;
+	sstate->bin_buf = bin_buf;
+	sstate->bin_size = bin_size;
+	/* With shared memory the slave reads bin_buf directly. */
+	sstate->bin_pos = sstate->shm ? bin_size : 0;
+}
+
+/* Thread computing the commands to be sent by the I/O thread.
+ * The I/O thread can thus keep serving other slaves while
+ * stats are merged. */
+static void * __attribute__((noreturn))
+prepare_thread(void *arg)
+{
+	pthread_mutex_lock(&slave_lock);
 	for (;;) {
-		if (resend) {
-			/* Resend complete or partial history */
-			to_send = next_command(last_reply_id);
-		} else {
-			/* Wait for a new command. */
-			while (last_cmd_count == cmd_count)
-				pthread_cond_wait(&cmd_cond, &slave_lock);
-			to_send = gtp_cmd;
+		while (!prepare_head)
+			pthread_cond_wait(&prepare_cond, &slave_lock);
+		struct slave_state *sstate = prepare_head;
+		prepare_head = sstate->next_io;
+		if (!prepare_head) prepare_tail = NULL;
+
+		prepare_command(sstate);
+
+		sstate->next_io = send_queue;
+		send_queue = sstate;
+		wake_io_thread();
+	}
+	pthread_exit(NULL);
+}
+
+/* Close the connection with a slave machine. If the slave was
+ * active, unblock the main thread if it was waiting for it.
+ * We do not invalidate the received buffers; they are still
+ * useful for other slaves. The next slave using this slot must
+ * get the full command history.
+ * slave_lock is not held on either entry or exit of this function. */
+static void
+close_slave(struct slave_state *sstate, char *msg)
+{
+	io_unwatch(sstate->fd);
+	close(sstate->fd);
+	sstate->fd = -1;
+
+	pthread_mutex_lock(&slave_lock);
+	if (sstate->io_state != SLAVE_HANDSHAKE) {
+		assert(active_slaves > 0);
+		active_slaves--;
+		pthread_cond_signal(&reply_cond);
+		sstate->resend = true;
+	}
+	sstate->io_state = SLAVE_FREE;
+	pthread_mutex_unlock(&slave_lock);
+
+	if (connected_slaves-- == max_slaves)
+		io_watch(listen_sock, &listen_sock, false, true);
+	if (DEBUGL(2))
+		logline(&sstate->client, "= ", msg);
+}
+
+/* Accept all pending connections from slave machines, and send
+ * them a minimal identity check. The large buffers are allocated
+ * only once we get a first connection, to avoid wasting memory
+ * if max_slaves is too large. */
+static void
+accept_slaves(void)
+{
+	while (connected_slaves < max_slaves) {
+		struct in_addr client;
+		int fd = accept_server_connection(listen_sock, &client);
+		if (fd < 0) return;
+
+		/* Prefer a slot which already has its buffers. */
+		struct slave_state *sstate = NULL;
+		for (int id = 0; id < max_slaves; id++) {
+			if (slaves[id].io_state != SLAVE_FREE) continue;
+			if (!sstate || (slaves[id].io_buf && !sstate->io_buf))
+				sstate = &slaves[id];
 		}
+		assert(sstate);
+		if (!sstate->io_buf) {
+			sstate->io_buf = malloc2(CMDS_SIZE);
+			sstate->reply_buf = malloc2(CMDS_SIZE);
+		}
+		sstate->fd = fd;
+		sstate->io_lost = false;
+		sstate->client = client;
+		sstate->io_len = 0;
+		sstate->io_state = SLAVE_HANDSHAKE;
+		if (DEBUGL(2)) {
+			char buf[128];
+			snprintf(buf, sizeof(buf), "new slave, id %d\n", sstate->thread_id);
+			logline(&client, "= ", buf);
+		}
+		if (++connected_slaves == max_slaves)
+			io_unwatch(listen_sock);
 
-		/* Command available, send it to slave machine.
-		 * If slave was out of sync, send the history.
-		 * But first get binary arguments if necessary. */
-		int bin_size = 0;
-		void *bin_buf = get_binary_arg(sstate, gtp_cmd,
-					       gtp_cmds + CMDS_SIZE - gtp_cmd,
-					       &bin_size);
-		/* Check that the command is still valid. */
-		resend = true;
-		if (!bin_buf) continue;
+		set_nonblocking(fd);
+		io_watch(fd, sstate, false, true);
+		if (send(fd, "name\n", 5, MSG_NOSIGNAL) != 5)
+			close_slave(sstate, "lost slave\n");
+	}
+}
 
-		/* Send the command and get the reply, which always ends with \n\n
-		 * The slave machine sends "=id reply" or "?id reply"
-		 * with id == cmd_id if it is in sync. */
-		last_cmd_count = cmd_count;
-		char buf[CMDS_SIZE];
-		int reply_id = send_command(to_send, bin_buf, &bin_size, f,
-					    sstate, buf);
-		if (reply_id == -1) return;
+/* Read available input until the ascii reply is complete;
+ * it ends with an empty line. Return 1 if complete, 0 if more
+ * input is needed, -1 if error. */
+static int
+read_text(struct slave_state *sstate)
+{
+	int room = CMDS_SIZE - 1 - sstate->io_len;
+	if (room <= 0) return -1;
+	int len = recv(sstate->fd, sstate->io_buf + sstate->io_len, room, 0);
+	if (len < 0 && io_again()) return 0;
+	if (len <= 0) return -1;
+	sstate->io_len += len;
+	sstate->io_buf[sstate->io_len] = '\0';
+
+	char *end = strstr(sstate->io_buf, "\n\n");
+	if (!end) return 0;
+	sstate->io_pos = end + 2 - sstate->io_buf;
+	return 1;
+}
 
-		resend = process_reply(reply_id, buf, reply_buf, bin_buf, bin_size,
-				       &last_reply_id, &reply_slot, sstate);
+/* Minimimal check of slave identity: the reply to "name" must be
+ * a single line starting with "= Pachi". */
+static void
+read_handshake(struct slave_state *sstate)
+{
+	int done = read_text(sstate);
+	if (!done) return;
+	if (done < 0
+	    || strncasecmp(sstate->io_buf, "= Pachi", 7)
+	    || strchr(sstate->io_buf, '\n') + 2 != sstate->io_buf + sstate->io_pos) {
+		logline(&sstate->client, "? ", "bad slave\n");
+		close_slave(sstate, "lost slave\n");
+		return;
 	}
+
+	if (!sstate->b[0].buf) slave_state_alloc(sstate);
+	sstate->stats_format = STATS_RAW;
+	sstate->shm = false;
+	sstate->last_cmd_count = 0;
+	sstate->last_reply_id = -1;
+	sstate->last_sent_id = -1;
+	sstate->reply_slot = -1;
+
+	pthread_mutex_lock(&slave_lock);
+	active_slaves++;
+	sstate->io_state = SLAVE_IDLE;
+	maybe_prepare(sstate);
+	pthread_mutex_unlock(&slave_lock);
 }
 
-/* Minimimal check of slave identity. Close the file if error. */
+/* Send as much as possible of the command and its binary arg.
+ * Once all is sent, wait for the reply, which always ends with \n\n
+ * The slave machine sends "=id reply" or "?id reply" with id == cmd_id
+ * if it is in sync. The command buffers are reused for the reply. */
+static void
+send_command(struct slave_state *sstate)
+{
+	while (sstate->io_pos < sstate->io_len) {
+		int len = send(sstate->fd, sstate->io_buf + sstate->io_pos,
+			       sstate->io_len - sstate->io_pos, MSG_NOSIGNAL);
+		if (len < 0 && io_again()) return;
+		if (len <= 0) goto lost;
+		sstate->io_pos += len;
+	}
+	while (sstate->bin_pos < sstate->bin_size) {
+		int len = send(sstate->fd, (char *)sstate->bin_buf + sstate->bin_pos,
+			       sstate->bin_size - sstate->bin_pos, MSG_NOSIGNAL);
+		if (len < 0 && io_again()) return;
+		if (len <= 0) goto lost;
+		sstate->bin_pos += len;
+	}
+
+	if (DEBUGV(strchr(sstate->io_buf, '@'), 2)) {
+		double ms = (time_now() - sstate->io_start) * 1000.0;
+		if (!DEBUGL(3)) {
+			char *s = strchr(sstate->io_buf, '\n');
+			if (s) s[1] = '\0';
+		}
+		logline(&sstate->client, ">>", sstate->io_buf);
+		if (sstate->bin_size) {
+			char b[1024];
+			snprintf(b, sizeof(b),
+				 "sent cmd %d+%d bytes in %.4fms\n",
+				 sstate->io_len, sstate->bin_size, ms);
+			logline(&sstate->client, "= ", b);
+		}
+	}
+
+	sstate->io_state = SLAVE_RECEIVING;
+	sstate->io_start = time_now();
+	sstate->io_len = 0;
+	sstate->bin_size = -1;
+	io_watch(sstate->fd, sstate, false, false);
+	return;
+lost:
+	close_slave(sstate, "lost slave\n");
+}
+
+/* Start sending a command prepared by a prepare thread. */
+static void
+start_command(struct slave_state *sstate)
+{
+	if (sstate->io_lost) {
+		close_slave(sstate, "lost slave\n");
+		return;
+	}
+	if (DEBUGL(1) && sstate->resend_msg)
+		logline(&sstate->client, "? ", sstate->resend_msg);
+	sstate->io_state = SLAVE_SENDING;
+	sstate->io_start = time_now();
+	io_watch(sstate->fd, sstate, true, false);
+	send_command(sstate);
+}
+
+/* Parse the first line of an ascii reply. If it contains "@size",
+ * a binary reply of size bytes follows the empty line. @size is not
+ * standard gtp, it is only used internally by Pachi for the genmoves
+ * command; it must be the last parameter on the line. A slave
+ * supporting binary formats other than STATS_RAW sends "@size:format".
+ * With STATS_SHM in format the binary reply is already in bin_buf.
+ * Set sstate->bin_format to the binary format, or -1 without "@size".
+ * Return false if the binary size is invalid. */
 static bool
-is_pachi_slave(FILE *f, struct in_addr *client)
-{
-	char buf[1024];
-	fputs("name\n", f);
-	if (!fgets(buf, sizeof(buf), f)
-	    || strncasecmp(buf, "= Pachi", 7)
-	    || !fgets(buf, sizeof(buf), f)
-	    || strcmp(buf, "\n")) {
-		logline(client, "? ", "bad slave\n");
-		fclose(f);
-		sleep(1); // avoid busy loop if error
-		return false;
+parse_reply_header(struct slave_state *sstate)
+{
+	char *reply = sstate->io_buf;
+	char *eol = strchr(reply, '\n');
+	char *s = memchr(reply, '@', eol - reply);
+	int size = 0;
+	sstate->bin_format = -1;
+	if (s && sscanf(s, "@%d:%d", &size, &sstate->bin_format) < 2)
+		sstate->bin_format = STATS_RAW;
+	if (size < 0 || size > sstate->max_buf_size) return false;
+	sstate->bin_size = size;
+	sstate->bin_pos = 0;
+	if (sstate->bin_format >= 0 && (sstate->bin_format & STATS_SHM)) {
+		if (!sstate->shm_ring) return false;
+		sstate->shm = true;
+		sstate->bin_format &= ~STATS_SHM;
+		sstate->bin_pos = size;
+		size = 0;
+	}
+
+	if (DEBUGV(s, 2)) {
+		char line[BSIZE];
+		snprintf(line, sizeof(line), "%.*s", (int)(eol + 1 - reply), reply);
+		logline(&sstate->client, "<<", line);
 	}
+	if (DEBUGL(3) && eol[1] != '\n')
+		logline(&sstate->client, "<<", eol + 1);
+
+	/* Move the start of the binary reply if already read. */
+	int extra = sstate->io_len - sstate->io_pos;
+	if (extra > size) return false;
+	memcpy(sstate->bin_buf, reply + sstate->io_pos, extra);
+	sstate->bin_pos += extra;
+	reply[sstate->io_pos] = '\0';
 	return true;
 }
 
-/* Thread sending gtp commands to one slave machine, and
- * reading replies. If a slave machine dies, this thread waits
- * for a connection from another slave.
- * The large buffers are allocated only once we get a first
- * connection, to avoid wasting memory if max_slaves is too large.
- * We do not invalidate the received buffers if a slave disconnects;
- * they are still useful for other slaves. */
-static void * __attribute__((noreturn))
-slave_thread(void *arg)
+/* Read the reply to the last command, then process it and get
+ * the next command if any. The binary reply is read directly into
+ * the buffer which will be inserted in the receive queue. */
+static void
+read_reply(struct slave_state *sstate)
 {
-	struct slave_state sstate = default_sstate;
-	sstate.thread_id = (intptr_t)arg;
+	if (sstate->bin_size < 0) {
+		int done = read_text(sstate);
+		if (!done) return;
+		if (done < 0 || !parse_reply_header(sstate)) goto lost;
+	}
+	while (sstate->bin_pos < sstate->bin_size) {
+		int len = recv(sstate->fd, (char *)sstate->bin_buf + sstate->bin_pos,
+			       sstate->bin_size - sstate->bin_pos, 0);
+		if (len < 0 && io_again()) return;
+		if (len <= 0) goto lost;
+		sstate->bin_pos += len;
+	}
 
-	assert(sstate.slave_sock >= 0);
-	char reply_buf[CMDS_SIZE];
-	bool resend = false;
+	char *reply = sstate->io_buf;
+	if (sstate->bin_size && DEBUGVV(2)) {
+		char buf[1024];
+		snprintf(buf, sizeof(buf), "read reply %d+%d bytes in %.4fms\n",
+			 (int)strlen(reply), sstate->bin_size,
+			 (time_now() - sstate->io_start)*1000);
+		logline(&sstate->client, "= ", buf);
+	}
+	if ((*reply != '=' && *reply != '?') || !isdigit(reply[1])) goto lost;
+	int reply_id = atoi(reply+1);
 
-	for (;;) {
-		/* Wait for a connection from any slave. */
-		struct in_addr client;
-		int conn = open_server_connection(sstate.slave_sock, &client);
+	pthread_mutex_lock(&slave_lock);
+	sstate->resend = process_reply(reply_id, reply, sstate->reply_buf,
+				       sstate->bin_buf, sstate->bin_size, sstate->bin_format,
+				       &sstate->last_reply_id, &sstate->reply_slot, sstate);
+	sstate->io_state = SLAVE_IDLE;
+	maybe_prepare(sstate);
+	pthread_mutex_unlock(&slave_lock);
+	return;
+lost:
+	close_slave(sstate, "lost slave\n");
+}
 
-		FILE *f = fdopen(conn, "r+");
-		if (DEBUGL(2)) {
-			snprintf(reply_buf, sizeof(reply_buf),
-				 "new slave, id %d\n", sstate.thread_id);
-			logline(&client, "= ", reply_buf);
-		}
-		if (!is_pachi_slave(f, &client)) continue;
+/* Input from an idle slave: only end of file is expected.
+ * If the slave is being prepared, closing must wait until
+ * the prepare thread is done. */
+static void
+check_idle_slave(struct slave_state *sstate)
+{
+	char buf[BSIZE];
+	int len = recv(sstate->fd, buf, sizeof(buf), 0);
+	if (len > 0 || (len < 0 && io_again())) return;
+
+	if (sstate->io_state == SLAVE_PREPARING) {
+		/* start_command() will close the connection. */
+		sstate->io_lost = true;
+		io_unwatch(sstate->fd);
+	} else {
+		close_slave(sstate, "lost slave\n");
+	}
+}
 
-		if (!resend) slave_state_alloc(&sstate);
-		sstate.client = client;
+/* Start sending the prepared commands, and get the next
+ * command for idle slaves if gtp_cmd has changed. */
+static void
+process_wakeup(void)
+{
+	char buf[256];
+	while (read(wake_pipe[0], buf, sizeof(buf)) > 0);
 
-		pthread_mutex_lock(&slave_lock);
-		active_slaves++;
-		slave_loop(f, reply_buf, &sstate, resend);
+	pthread_mutex_lock(&slave_lock);
+	struct slave_state *ready = send_queue;
+	send_queue = NULL;
+	if (io_cmd_count != cmd_count) {
+		io_cmd_count = cmd_count;
+		for (int id = 0; id < max_slaves; id++)
+			maybe_prepare(&slaves[id]);
+	}
+	pthread_mutex_unlock(&slave_lock);
 
-		assert(active_slaves > 0);
-		active_slaves--;
-		// Unblock main thread if it was waiting for this slave.
-		pthread_cond_signal(&reply_cond);
-		pthread_mutex_unlock(&slave_lock);
+	while (ready) {
+		struct slave_state *sstate = ready;
+		ready = sstate->next_io;
+		start_command(sstate);
+	}
+}
 
-		resend = true;
-		if (DEBUGL(2))
-			logline(&client, "= ", "lost slave\n");
-		fclose(f);
+/* Thread handling all connections with slave machines. */
+static void * __attribute__((noreturn))
+io_thread(void *arg)
+{
+	for (;;) {
+		void *ready[MAX_IO_EVENTS];
+		int n = io_wait(ready);
+		for (int i = 0; i < n; i++) {
+			if (ready[i] == &listen_sock) {
+				accept_slaves();
+				continue;
+			}
+			if (ready[i] == wake_pipe) {
+				process_wakeup();
+				continue;
+			}
+			struct slave_state *sstate = ready[i];
+			switch (sstate->io_state) {
+			case SLAVE_HANDSHAKE: read_handshake(sstate); break;
+			case SLAVE_SENDING:   send_command(sstate); break;
+			case SLAVE_RECEIVING: read_reply(sstate); break;
+			case SLAVE_IDLE:
+			case SLAVE_PREPARING: check_idle_slave(sstate); break;
+			case SLAVE_FREE:      break;
+			}
+		}
 	}
 	pthread_exit(NULL);
 }
 
+
 /* Create a new gtp command for all slaves. The slave lock is held
  * upon entry and upon return, so the command will actually be
  * sent when the lock is released. The last command is overwritten
@@ -583,8 +1029,8 @@ update_cmd(struct board *b, char *cmd, char *args, bool new_id)
 		last->gtp_id = gtp_id;
 		last->next_cmd = NULL;
 	}
-	// Notify the slave threads about the new command.
-	pthread_cond_broadcast(&cmd_cond);
+	// Notify the I/O thread about the new command.
+	wake_io_thread();
 }
 
 /* Update the command history, then create a new gtp command
@@ -613,7 +1059,7 @@ new_cmd(struct board *b, char *cmd, char *args)
 		gtp_cmd += strlen(gtp_cmd);
 	}
 
-	// Let the slave threads send the new gtp command:
+	// Let the I/O thread send the new gtp command:
 	update_cmd(b, cmd, args, true);
 }
 
@@ -654,27 +1100,60 @@ get_replies(double time_limit, int min_replies)
  * 300*200=60000 genmoves per slave. */
 #define MAX_GENMOVES_PER_SLAVE 60000
 
-/* Allocate the receive queue, and create the slave and proxy threads.
- * max_buf_size and the merge-related fields of default_sstate must
- * already be initialized. */
+/* Allocate the receive queue, and create the I/O, prepare and proxy
+ * threads. max_buf_size and the merge-related fields of default_sstate
+ * must already be initialized. If relay is set, we also get stats
+ * from our parent. If shm is set, the binary buffers of the slaves
+ * are in shared memory. */
 void
-protocol_init(char *slave_port, char *proxy_port, int max_slaves)
+protocol_init(char *slave_port, char *proxy_port, int max_slaves_, bool relay, bool shm)
 {
 	start_time = time_now();
+	max_slaves = max_slaves_;
+	if (shm) shm_port = slave_port;
 
-	queue_max_length = max_slaves * MAX_GENMOVES_PER_SLAVE;
+	queue_max_length = (max_slaves + relay) * MAX_GENMOVES_PER_SLAVE;
 	receive_queue = calloc2(queue_max_length, sizeof(*receive_queue));
 
-	default_sstate.slave_sock = port_listen(slave_port, max_slaves);
 	default_sstate.last_processed = -1;
+	default_sstate.fd = -1;
 
 	for (int n = 0; n < BUFFERS_PER_SLAVE; n++) {
 		default_sstate.b[n].queue_index = -1;
 	}
+	slaves = calloc2(max_slaves, sizeof(*slaves));
+	for (int id = 0; id < max_slaves; id++) {
+		slaves[id] = default_sstate;
+		slaves[id].thread_id = id;
+	}
+	if (relay) {
+		parent_sstate = malloc2(sizeof(*parent_sstate));
+		*parent_sstate = default_sstate;
+		parent_sstate->thread_id = max_slaves;
+		slave_state_alloc(parent_sstate);
+	}
+
+	io_init();
+	listen_sock = port_listen(slave_port, max_slaves);
+	set_nonblocking(listen_sock);
+	io_watch(listen_sock, &listen_sock, false, true);
+	if (pipe(wake_pipe)) {
+		perror("pipe");
+		exit(42);
+	}
+	set_nonblocking(wake_pipe[0]);
+	set_nonblocking(wake_pipe[1]);
+	io_watch(wake_pipe[0], wake_pipe, false, true);
 
 	pthread_t thread;
-	for (int id = 0; id < max_slaves; id++) {
-		pthread_create(&thread, NULL, slave_thread, (void *)(intptr_t)id);
+	pthread_create(&thread, NULL, io_thread, NULL);
+
+	/* Merging stats is cpu bound, more threads would not help. */
+	int prepare_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (prepare_threads < 1) prepare_threads = 1;
+	if (prepare_threads > max_slaves) prepare_threads = max_slaves;
+	for (int id = 0; id < prepare_threads; id++) {
+		pthread_create(&thread, NULL, prepare_thread, NULL);
 	}
 
 	if (proxy_port) {
@@ -12,7 +12,7 @@
 #include "board.h"
 
 
-/* Each slave thread maintains a ring of 256 buffers holding
+/* Each slave maintains a ring of 256 buffers holding
  * incremental stats received from the slave. The oldest
  * buffer is recycled to hold stats sent to the slave and
  * received the next reply. */
@@ -20,7 +20,7 @@
 #define BUFFERS_PER_SLAVE (1 << BUFFERS_PER_SLAVE_BITS)
 
 struct slave_state;
-typedef void (*buffer_hook)(void *buf, int size);
+typedef void (*buffer_hook)(void *buf, int size, int format);
 typedef void (*state_alloc_hook)(struct slave_state *sstate);
 typedef int (*getargs_hook)(void *buf, struct slave_state *sstate, int cmd_id);
 
@@ -30,6 +30,7 @@ struct buf_state {
 	 * number of valid bytes. It is set only when the buffer
 	 * is actually in the receive queueue. */
 	int size;
+	int format; // enum stats_format
 	int queue_index;
 	int owner;
 };
@@ -50,7 +51,30 @@ struct slave_state {
 
 	struct buf_state b[BUFFERS_PER_SLAVE];
 	int newest_buf;
-	int slave_sock;
+	/* Binary format negotiated with the slave machine. */
+	int stats_format;
+	bool shm_ring; // buffers in shared memory
+	bool shm;      // slave uses the shared buffers
+
+	/* Connection state, owned by the I/O thread. */
+	int fd;
+	int io_state; // enum slave_io
+	bool io_lost; // connection lost while preparing
+	bool resend;  // send command history
+	int last_cmd_count;
+	int last_reply_id;
+	int last_sent_id; // gtp id of the last command sent
+	int reply_slot;
+	/* Command being sent, then ascii reply being read. */
+	char *io_buf;
+	int io_len, io_pos;
+	/* Binary arg being sent, then binary reply being read. */
+	void *bin_buf;
+	int bin_size, bin_pos, bin_format;
+	char *reply_buf; // last reply, pointed to by gtp_replies
+	char *resend_msg; // for debugging only
+	double io_start;  // for debugging only
+	struct slave_state *next_io; // prepare or send queue
 
 	/* --- PRIVATE DATA for merge.c --- */
 
@@ -62,6 +86,9 @@ struct slave_state {
 	/* Hash indices updated by stats merge. */
 	int *merged;
 	int max_merged_nodes;
+
+	/* Output stats before compact encoding. */
+	struct incr_stats *out_stats;
 };
 extern struct slave_state default_sstate;
 
@@ -74,7 +101,10 @@ void clear_receive_queue(void);
 void update_cmd(struct board *b, char *cmd, char *args, bool new_id);
 void new_cmd(struct board *b, char *cmd, char *args);
 void get_replies(double time_limit, int min_replies);
-void protocol_init(char *slave_port, char *proxy_port, int max_slaves);
+void protocol_init(char *slave_port, char *proxy_port, int max_slaves, bool relay, bool shm);
+
+bool relay_receive_stats(FILE *f, int size, int format);
+void *relay_send_stats(int format, int *size);
 
 extern int reply_count;
 extern char **gtp_replies;
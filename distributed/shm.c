@@ -0,0 +1,190 @@
+/* Shared memory transport for slaves running on the same machine
+ * as their master. With the shm option, the master allocates the
+ * ring of binary buffers of each slave slot (see protocol.c) in a
+ * shared memory segment named after its slave port and the slot.
+ * A slave connected with -g shm:host:port maps the segment of its
+ * slot, reads the genmoves args and writes its stats replies there
+ * directly, so only the short gtp text goes through the socket.
+ * The socket is still used for all gtp commands and replies, which
+ * also orders the accesses to the buffers: the master only touches
+ * a buffer before sending a command or after getting the reply. */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define DEBUG
+
+#include "debug.h"
+#include "util.h"
+#include "distributed/shm.h"
+
+#define SHM_MAGIC 0x50616368 // "Pach"
+
+/* The buffers start after this header. */
+struct shm_header {
+	uint32_t magic;
+	uint32_t buffers;
+	uint32_t buf_size;
+	char pad[64 - 3 * sizeof(uint32_t)];
+};
+
+static void
+shm_name(char *name, int size, char *port, int slot)
+{
+	snprintf(name, size, "/pachi-%s-%d", port, slot);
+}
+
+#ifndef _WIN32
+
+/* Names of the segments created by this master, removed at exit. */
+static char **created;
+static int created_count;
+
+static void
+shm_cleanup(void)
+{
+	for (int i = 0; i < created_count; i++)
+		shm_unlink(created[i]);
+}
+
+/* Create the shared ring of the given slave slot, for a master
+ * listening on port. Return the first buffer, or NULL if shared
+ * memory is not available; the caller should then use private
+ * memory. The space is reserved upfront to avoid a SIGBUS later
+ * if the shared memory filesystem is full. */
+void *
+shm_ring_create(char *port, int slot, int buffers, int buf_size)
+{
+	char name[64];
+	shm_name(name, sizeof(name), port, slot);
+	size_t size = sizeof(struct shm_header) + (size_t)buffers * buf_size;
+
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		if (DEBUGL(1)) perror("shm_open");
+		return NULL;
+	}
+#ifdef __linux__
+	int err = posix_fallocate(fd, 0, size);
+#else
+	int err = ftruncate(fd, size);
+#endif
+	void *p = err ? MAP_FAILED : mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		if (DEBUGL(1))
+			fprintf(stderr, "cannot allocate shared memory %s, %zu bytes\n", name, size);
+		shm_unlink(name);
+		return NULL;
+	}
+
+	if (!created_count) atexit(shm_cleanup);
+	created = realloc(created, (created_count + 1) * sizeof(*created));
+	if (!created) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	created[created_count++] = strdup(name);
+
+	struct shm_header *h = p;
+	h->buffers = buffers;
+	h->buf_size = buf_size;
+	h->magic = SHM_MAGIC;
+	return h + 1;
+}
+
+/* Slave side: port of the master if we use shared memory, and
+ * the mapping of our current slot. */
+static char *slave_port = NULL;
+static struct shm_header *mapped = NULL;
+static size_t mapped_size;
+static int mapped_slot = -1;
+
+static void
+shm_unmap(void)
+{
+	if (mapped) munmap(mapped, mapped_size);
+	mapped = NULL;
+	mapped_slot = -1;
+}
+
+/* Parse the gtp port url given to a slave, at each new connection.
+ * The "shm:" scheme selects the shared memory transport for stats.
+ * Return the url without scheme, to be used for the connection. */
+char *
+shm_slave_init(char *url)
+{
+	shm_unmap();
+	if (strncmp(url, "shm:", 4)) return url;
+	url += 4;
+	char *port = strrchr(url, ':');
+	slave_port = port ? port + 1 : url;
+	return url;
+}
+
+/* Return the buffer with the given index in the master's shared ring
+ * for the given slot, or NULL if we don't use shared memory or the
+ * buffer is smaller than size. */
+void *
+shm_ring_buffer(int slot, int index, int size)
+{
+	if (!slave_port || slot < 0) return NULL;
+	if (slot != mapped_slot) {
+		shm_unmap();
+		char name[64];
+		shm_name(name, sizeof(name), slave_port, slot);
+		int fd = shm_open(name, O_RDWR, 0);
+		if (fd < 0) return NULL;
+
+		struct stat st;
+		void *p = MAP_FAILED;
+		if (!fstat(fd, &st) && st.st_size >= (off_t)sizeof(struct shm_header))
+			p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED) return NULL;
+		mapped = p;
+		mapped_size = st.st_size;
+		mapped_slot = slot;
+		if (DEBUGL(2))
+			fprintf(stderr, "using shared memory %s\n", name);
+	}
+
+	if (mapped->magic != SHM_MAGIC
+	    || index < 0 || (uint32_t)index >= mapped->buffers
+	    || (uint32_t)size > mapped->buf_size
+	    || sizeof(*mapped) + (size_t)mapped->buffers * mapped->buf_size > mapped_size)
+		return NULL;
+	return (char *)(mapped + 1) + (size_t)index * mapped->buf_size;
+}
+
+#else /* _WIN32 */
+
+void *
+shm_ring_create(char *port, int slot, int buffers, int buf_size)
+{
+	return NULL;
+}
+
+char *
+shm_slave_init(char *url)
+{
+	return strncmp(url, "shm:", 4) ? url : url + 4;
+}
+
+void *
+shm_ring_buffer(int slot, int index, int size)
+{
+	return NULL;
+}
+
+#endif /* _WIN32 */
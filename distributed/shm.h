@@ -0,0 +1,8 @@
+#ifndef PACHI_DISTRIBUTED_SHM_H
+#define PACHI_DISTRIBUTED_SHM_H
+
+void *shm_ring_create(char *port, int slot, int buffers, int buf_size);
+char *shm_slave_init(char *url);
+void *shm_ring_buffer(int slot, int index, int size);
+
+#endif
@@ -16,6 +16,7 @@
 #include <ws2tcpip.h>
 #else
 #include <sys/socket.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #endif
@@ -52,8 +53,8 @@ port_listen(char *port, int max_connections)
 	server_addr.sin_port = htons(atoi(port));     
 	server_addr.sin_addr.s_addr = INADDR_ANY; 
 
-	const char val = 1;
-	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)))
+	const int val = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const void *)&val, sizeof(val)))
 		die("setsockopt");
 	if (bind(sock, (struct sockaddr *)&server_addr, sizeof(struct sockaddr)) == -1)
 		die("bind");
@@ -62,11 +63,13 @@ port_listen(char *port, int max_connections)
 	return sock;
 }
 
-/* Returns true if in private address range: 10.0.0.0/8 172.16.0.0/12 192.168.0.0/16 */
+/* Returns true if in private address range: 10.0.0.0/8 172.16.0.0/12 192.168.0.0/16
+ * or loopback 127.0.0.0/8 (slaves running on the same machine). */
 static bool
 is_private(struct in_addr *in)
 {
 	return (ntohl(in->s_addr) & 0xff000000) >> 24 == 10
+	    || (ntohl(in->s_addr) & 0xff000000) >> 24 == 127
 	    || (ntohl(in->s_addr) & 0xfff00000) >> 16 == 172 * 256 + 16
 	    || (ntohl(in->s_addr) & 0xffff0000) >> 16 == 192 * 256 + 168;
 }
@@ -95,6 +98,46 @@ open_server_connection(int socket, struct in_addr *client)
 	}
 }
 
+/* Non-blocking version of open_server_connection(), the socket must
+ * have been set non-blocking. Returns -1 if no connection is pending. */
+int
+accept_server_connection(int socket, struct in_addr *client)
+{
+	assert(socket >= 0);
+	for (;;) {
+		struct sockaddr_in client_addr;
+		int sin_size = sizeof(struct sockaddr_in);
+		int fd = accept(socket, (struct sockaddr *)&client_addr, (socklen_t *)&sin_size);
+		if (fd == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR
+			    || errno == ECONNABORTED)
+				return -1;
+			die("accept");
+		}
+		if (is_private(&client_addr.sin_addr)) {
+			if (client)
+				*client = client_addr.sin_addr;
+			return fd;
+		}
+		close(fd);
+	}
+}
+
+/* Set the file descriptor in non-blocking mode. */
+void
+set_nonblocking(int fd)
+{
+#ifdef _WIN32
+	u_long mode = 1;
+	if (ioctlsocket(fd, FIONBIO, &mode))
+		die("ioctlsocket");
+#else
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		die("fcntl");
+#endif
+}
+
 /* Opens a new connection to the given port name, which must
  * contain a host name. Returns the open file descriptor,
  * or -1 if the open fails. */
@@ -9,6 +9,8 @@
 
 int port_listen(char *port, int max_connections);
 int open_server_connection(int socket, struct in_addr *client);
+int accept_server_connection(int socket, struct in_addr *client);
+void set_nonblocking(int fd);
 void open_log_port(char *port);
 void open_gtp_connection(int *socket, char *port);
 
@@ -39,7 +39,7 @@ board_ownermap_fill(struct board_ownermap *ownermap, struct board *b)
 	foreach_point(b) {
 		enum stone color = board_at(b, c);
 		if (color == S_NONE)
-			color = board_get_one_point_eye(b, c);
+			color = board_fast_eye(b, c);
 		ownermap->map[c][color]++;
 	} foreach_point_end;
 }
@@ -47,10 +47,12 @@ board_ownermap_fill(struct board_ownermap *ownermap, struct board *b)
 void
 board_ownermap_merge(int bsize2, struct board_ownermap *dst, struct board_ownermap *src)
 {
-	dst->playouts += src->playouts;
+	/* dst may be shared with other merging threads. */
+	__sync_fetch_and_add(&dst->playouts, src->playouts);
 	for (int i = 0; i < bsize2; i++)
 		for (int j = 0; j < S_MAX; j++)
-			dst->map[i][j] += src->map[i][j];
+			if (src->map[i][j])
+				__sync_fetch_and_add(&dst->map[i][j], src->map[i][j]);
 }
 
 float
@@ -23,6 +23,7 @@ struct board_ownermap {
 
 void board_print_ownermap(struct board *b, FILE *f, struct board_ownermap *ownermap);
 void board_ownermap_fill(struct board_ownermap *ownermap, struct board *b);
+/* Add src counts to dst; dst may be shared by several merging threads. */
 void board_ownermap_merge(int bsize2, struct board_ownermap *dst, struct board_ownermap *src);
 
 
@@ -12,6 +12,7 @@
 #include "engine.h"
 #include "replay/replay.h"
 #include "montecarlo/montecarlo.h"
+#include "benchmark/benchmark.h"
 #include "random/random.h"
 #include "patternscan/patternscan.h"
 #include "patternplay/patternplay.h"
@@ -19,6 +20,7 @@
 #include "t-unit/test.h"
 #include "uct/uct.h"
 #include "distributed/distributed.h"
+#include "distributed/shm.h"
 #include "gtp.h"
 #include "chat.h"
 #include "timeinfo.h"
@@ -43,6 +45,7 @@ enum engine_id {
 	E_UCT,
 	E_DISTRIBUTED,
 	E_JOSEKI,
+	E_BENCHMARK,
 #ifdef DCNN
 	E_DCNN,
 #endif
@@ -58,6 +61,7 @@ static struct engine *(*engine_init[E_MAX])(char *arg, struct board *b) = {
 	engine_uct_init,
 	engine_distributed_init,
 	engine_joseki_init,
+	engine_benchmark_init,
 #ifdef DCNN
 	engine_dcnn_init,
 #endif
@@ -75,9 +79,9 @@ static struct engine *init_engine(enum engine_id engine, char *e_arg, struct boa
 static void usage(char *name)
 {
 	fprintf(stderr, "Pachi version %s\n", PACHI_VERSION);
-	fprintf(stderr, "Usage: %s [-e random|replay|montecarlo|uct|distributed|dcnn]\n"
+	fprintf(stderr, "Usage: %s [-e random|replay|montecarlo|uct|distributed|benchmark|dcnn]\n"
 		" [-d DEBUG_LEVEL] [-D] [-r RULESET] [-s RANDOM_SEED] [-t TIME_SETTINGS] [-u TEST_FILENAME]\n"
-		" [-g [HOST:]GTP_PORT] [-l [HOST:]LOG_PORT] [-f FBOOKFILE] [ENGINE_ARGS]\n", name);
+		" [-g [shm:][HOST:]GTP_PORT] [-l [HOST:]LOG_PORT] [-f FBOOKFILE] [ENGINE_ARGS]\n", name);
 }
 
 int main(int argc, char *argv[])
@@ -117,6 +121,8 @@ int main(int argc, char *argv[])
 					engine = E_PATTERNPLAY;
 				} else if (!strcasecmp(optarg, "joseki")) {
 					engine = E_JOSEKI;
+				} else if (!strcasecmp(optarg, "benchmark")) {
+					engine = E_BENCHMARK;
 #ifdef DCNN
 				} else if (!strcasecmp(optarg, "dcnn")) {
 					engine = E_DCNN;
@@ -205,7 +211,7 @@ int main(int argc, char *argv[])
 	}
 
 	if (gtp_port) {
-		open_gtp_connection(&gtp_sock, gtp_port);
+		open_gtp_connection(&gtp_sock, shm_slave_init(gtp_port));
 	}
 
 	for (;;) {
@@ -230,7 +236,7 @@ int main(int argc, char *argv[])
 			}
 		}
 		if (!gtp_port) break;
-		open_gtp_connection(&gtp_sock, gtp_port);
+		open_gtp_connection(&gtp_sock, shm_slave_init(gtp_port));
 	}
 	engine_done(e);
 	chat_done();
@@ -407,6 +407,7 @@ pattern_match_atari(struct pattern_config *pc, pattern_spec ps,
 #define BOARD_SPATHASH_MAXD 1
 #endif
 
+#if BOARD_SPATHASH_MAXD < MAX_PATTERN_DIST
 /* Match spatial features that are too distant to be pre-matched
  * incrementally. */
 struct feature *
@@ -440,6 +441,7 @@ pattern_match_spatial_outer(struct pattern_config *pc, pattern_spec ps,
 	}
 	return f;
 }
+#endif
 
 struct feature *
 pattern_match_spatial(struct pattern_config *pc, pattern_spec ps,
@@ -454,8 +456,9 @@ pattern_match_spatial(struct pattern_config *pc, pattern_spec ps,
 
 	hash_t h = pthashes[0][0][S_NONE];
 #ifdef BOARD_SPATHASH
+	board_spathash_sync(b);
 	bool w_to_play = m->color == S_WHITE;
-	for (int d = 2; d <= BOARD_SPATHASH_MAXD; d++) {
+	for (unsigned int d = 2; d <= BOARD_SPATHASH_MAXD && d <= pc->spat_max; d++) {
 		/* Reuse all incrementally matched data. */
 		h ^= b->spathash[m->coord][d - 1][w_to_play];
 		if (d < pc->spat_min)
@@ -472,8 +475,10 @@ pattern_match_spatial(struct pattern_config *pc, pattern_spec ps,
 #else
 	assert(BOARD_SPATHASH_MAXD < 2);
 #endif
+#if BOARD_SPATHASH_MAXD < MAX_PATTERN_DIST
 	if (unlikely(pc->spat_max > BOARD_SPATHASH_MAXD))
 		f = pattern_match_spatial_outer(pc, ps, p, f, b, m, h);
+#endif
 	if (pc->spat_largest && f->id == FEAT_SPATIAL)
 		(f++, p->n++);
 	return f;
@@ -119,6 +119,9 @@ play_random_game(struct playout_setup *setup,
 {
 	assert(setup && policy);
 
+	if (policy->game)
+		return policy->game(policy, setup, b, starting_color, amafmap, ownermap);
+
 	int gamelen = setup->gamelen - b->moves;
 
 	if (policy->setboard)
@@ -14,6 +14,7 @@ struct board_ownermap;
 
 struct playout_policy;
 struct playout_setup;
+struct playout_amafmap;
 
 /* Initialize policy data structures for new playout; subsequent choose calls
  * (but not assess/permit calls!) will all be made on the same board; if
@@ -37,6 +38,14 @@ typedef void (*playoutp_assess)(struct playout_policy *playout_policy, struct pr
  * another move if this one doesn't pass (in which case m will be changed) */
 typedef bool (*playoutp_permit)(struct playout_policy *playout_policy, struct board *b, struct move *m, bool alt);
 
+/* Play the whole random game at once, on a board representation of the
+ * policy's own; arguments and return value like play_random_game(). The
+ * engine hooks of @playout_setup are not called, and on return @b is
+ * good only for board_at() queries. */
+typedef int (*playoutp_game)(struct playout_policy *playout_policy, struct playout_setup *playout_setup,
+			     struct board *b, enum stone starting_color,
+			     struct playout_amafmap *amafmap, struct board_ownermap *ownermap);
+
 /* Tear down the policy state; policy and policy->data will be free()d by caller. */
 typedef void (*playoutp_done)(struct playout_policy *playout_policy);
 
@@ -45,11 +54,14 @@ struct playout_policy {
 	/* We call setboard when we start new playout.
 	 * We call choose when we ask policy about next move.
 	 * We call assess when we ask policy about how good given move is.
-	 * We call permit when we ask policy if we can make a randomly chosen move. */
+	 * We call permit when we ask policy if we can make a randomly chosen move.
+	 * If game is set, we call it instead of all the above to play a whole
+	 * random game. */
 	playoutp_setboard setboard;
 	playoutp_choose choose;
 	playoutp_assess assess;
 	playoutp_permit permit;
+	playoutp_game game;
 	playoutp_done done;
 	/* By default, with setboard set we will refuse to make (random)
 	 * moves outside of the *choose routine in order not to mess up
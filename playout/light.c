@@ -1,9 +1,12 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "bitboard.h"
 #include "board.h"
 #include "debug.h"
+#include "ownermap.h"
 #include "playout.h"
 #include "playout/light.h"
 #include "random.h"
@@ -18,6 +21,58 @@ playout_light_choose(struct playout_policy *p, struct playout_setup *s, struct b
 	return pass;
 }
 
+/* Same uniformly random game as play_random_game() would play with
+ * playout_light_choose(), but on a bitboard. */
+static int
+playout_light_game(struct playout_policy *p, struct playout_setup *setup,
+		   struct board *b, enum stone starting_color,
+		   struct playout_amafmap *amafmap, struct board_ownermap *ownermap)
+{
+	struct bitboard bb;
+	bitboard_init(&bb, b);
+
+	int gamelen = setup->gamelen - b->moves;
+	enum stone color = starting_color;
+	int passes = is_pass(b->last_move.coord) && b->moves > 0;
+
+	while (gamelen-- && passes < 2) {
+		coord_t coord = bitboard_play_random(&bb, color);
+
+		if (PLDEBUGL(7))
+			fprintf(stderr, "%s %s\n", stone2str(color), coord2sstr(coord, b));
+
+		if (unlikely(is_pass(coord))) {
+			passes++;
+		} else {
+			passes = 0;
+		}
+		if (amafmap) {
+			assert(amafmap->gamelen < MAX_GAMELEN);
+			amafmap->is_ko_capture[amafmap->gamelen] = !is_pass(bb.ko.coord);
+			amafmap->game[amafmap->gamelen++] = coord;
+		}
+
+		if (setup->mercymin && abs(bb.captures[S_BLACK] - bb.captures[S_WHITE]) > setup->mercymin)
+			break;
+
+		color = stone_other(color);
+	}
+
+	floating_t score = bitboard_fast_score(&bb);
+	int result = (starting_color == S_WHITE ? score * 2 : - (score * 2));
+
+	if (ownermap)
+		bitboard_ownermap_fill(ownermap, &bb);
+	bitboard_store_stones(&bb, b);
+
+	if (DEBUGL(6)) {
+		fprintf(stderr, "Random playout result: %d (W %f)\n", result, score);
+		if (DEBUGL(7))
+			board_print(b, stderr);
+	}
+	return result;
+}
+
 
 struct playout_policy *
 playout_light_init(char *arg, struct board *b)
@@ -25,8 +80,32 @@ playout_light_init(char *arg, struct board *b)
 	struct playout_policy *p = calloc2(1, sizeof(*p));
 	p->choose = playout_light_choose;
 
-	if (arg)
-		fprintf(stderr, "playout-light: This policy does not accept arguments (%s)\n", arg);
+	if (arg) {
+		char *optspec, *next = arg;
+		while (*next) {
+			optspec = next;
+			next += strcspn(next, ":");
+			if (*next) { *next++ = 0; } else { *next = 0; }
+
+			char *optname = optspec;
+			char *optval = strchr(optspec, '=');
+			if (optval) *optval++ = 0;
+
+			if (!strcasecmp(optname, "debug") && optval) {
+				p->debug_level = atoi(optval);
+			} else if (!strcasecmp(optname, "bitboard")) {
+				/* Play the whole playout on a bitboard
+				 * (see bitboard.h). About 30% faster on 9x9,
+				 * but slower on 19x19 where the flood fills
+				 * get long. Engine playout hooks are not
+				 * called. */
+				p->game = !optval || atoi(optval) ? playout_light_game : NULL;
+			} else {
+				fprintf(stderr, "playout-light: Invalid policy argument %s or missing value\n", optname);
+				exit(1);
+			}
+		}
+	}
 
 	return p;
 }
@@ -22,6 +22,7 @@
 #include "tactics/nakade.h"
 #include "tactics/selfatari.h"
 #include "tactics/seki.h"
+#include "timeinfo.h"
 #include "uct/prior.h"
 
 #define PLDEBUGL(n) DEBUGL_(p->debug_level, n)
@@ -67,8 +68,9 @@ struct moggy_policy {
 	 * group's liberty if that is non-self-atari. */
 	bool selfatari_other;
 	/* Whether to read out ladders elsewhere than near the board
-	 * in the playouts. Note that such ladder testing is currently
-	 * a fairly expensive operation. */
+	 * in the playouts. Repeated readings of the same ladder are
+	 * cached, but the first one is still a fairly expensive
+	 * operation. */
 	bool middle_ladder;
 
 	/* 1lib settings: */
@@ -105,6 +107,48 @@ struct moggy_state {
 	coord_t last_selfatari[S_MAX];
 };
 
+const char *moggy_heuristic_names[MH_MAX] = {
+	[MH_KO] = "ko",
+	[MH_LATARI] = "local_atari_check",
+	[MH_LADDER] = "local_ladder_check",
+	[MH_SELFATARI_CAP] = "local_2lib_capture_check",
+	[MH_L2LIB] = "local_2lib_check",
+	[MH_LNLIB] = "local_nlib_check",
+	[MH_EYEFIX] = "eye_fix_check",
+	[MH_NAKADE] = "nakade_check",
+	[MH_PATTERN] = "apply_pattern",
+	[MH_GATARI] = "global_atari_check",
+	[MH_JOSEKI] = "joseki_check",
+	[MH_FILLBOARD] = "fillboard_check",
+	[MH_PERMIT] = "permit",
+};
+
+/* Profiling statistics of this thread, see playout_moggy_profile(). */
+#ifndef NO_THREAD_LOCAL
+static __thread struct moggy_stats *mstats;
+#else
+static struct moggy_stats *mstats;
+#endif
+
+void
+playout_moggy_profile(struct moggy_stats *stats)
+{
+	mstats = stats;
+}
+
+static void
+mstats_add(enum moggy_heuristic h, double start, bool hit)
+{
+	mstats->calls[h]++;
+	mstats->hits[h] += hit;
+	mstats->time[h] += time_now() - start;
+}
+
+/* Bracket a heuristic run; the cost is a single test unless profiling. */
+#define mstats_start() double mstats_start_ = unlikely(!!mstats) ? time_now() : 0
+#define mstats_end(h, hit) if (unlikely(!!mstats)) mstats_add(h, mstats_start_, hit)
+
+
 static char moggy_patterns_src[PAT3_N][11] = {
 	/* hane pattern - enclosing hane */	/* 0.52 */
 	"XOX"
@@ -335,7 +379,7 @@ local_atari_check(struct playout_policy *p, struct board *b, struct move *m, str
 	if (PLDEBUGL(5))
 		mq_print(q, b, "Local atari");
 
-	return (force || pp->lcapturerate > fast_random(100));
+	return (force || fast_percent(pp->lcapturerate));
 }
 
 
@@ -464,7 +508,7 @@ local_nlib_check(struct playout_policy *p, struct board *b, struct move *m, stru
 		group_t g = group_at(b, c);
 		if (!g || group2 == g || board_at(b, c) != color)
 			continue;
-		if (board_group_info(b, g).libs < 3 || board_group_info(b, g).libs > pp->nlib_count)
+		if (board_group_libs(b, g) < 3 || board_group_libs(b, g) > pp->nlib_count)
 			continue;
 		group_nlib_defense_check(b, g, color, q, 1<<MQ_LNLIB);
 		group2 = g; // prevent trivial repeated checks
@@ -617,9 +661,12 @@ playout_moggy_seqchoose(struct playout_policy *p, struct playout_setup *s, struc
 	/* Ko fight check */
 	if (!is_pass(b->last_ko.coord) && is_pass(b->ko.coord)
 	    && b->moves - b->last_ko_age < pp->koage
-	    && pp->korate > fast_random(100)) {
-		if (board_is_valid_play(b, to_play, b->last_ko.coord)
-		    && !is_bad_selfatari(b, to_play, b->last_ko.coord))
+	    && fast_percent(pp->korate)) {
+		mstats_start();
+		bool ok = board_is_valid_play(b, to_play, b->last_ko.coord)
+		          && !is_bad_selfatari(b, to_play, b->last_ko.coord);
+		mstats_end(MH_KO, ok);
+		if (ok)
 			return b->last_ko.coord;
 	}
 
@@ -628,15 +675,20 @@ playout_moggy_seqchoose(struct playout_policy *p, struct playout_setup *s, struc
 		/* Local group in atari? */
 		if (true) {  // pp->lcapturerate check in local_atari_check()
 			struct move_queue q; q.moves = 0;
-			if (local_atari_check(p, b, &b->last_move, &q) && 
-			    q.moves > 0)
+			/* The rate is checked after the search here. */
+			mstats_start();
+			bool hit = local_atari_check(p, b, &b->last_move, &q) && q.moves > 0;
+			mstats_end(MH_LATARI, hit);
+			if (hit)
 				return mq_pick(&q);
 		}
 
 		/* Local group trying to escape ladder? */
-		if (pp->ladderrate > fast_random(100)) {
+		if (fast_percent(pp->ladderrate)) {
 			struct move_queue q; q.moves = 0;
+			mstats_start();
 			local_ladder_check(p, b, &b->last_move, &q);
+			mstats_end(MH_LADDER, q.moves > 0);
 			if (q.moves > 0)
 				return mq_pick(&q);
 		}
@@ -644,54 +696,66 @@ playout_moggy_seqchoose(struct playout_policy *p, struct playout_setup *s, struc
 		/* Did we just reject selfatari move as opponent ?
 		 * Check if his group can be laddered / put in atari */
 		if (ps->last_selfatari[other_color] &&
-		    pp->atarirate > fast_random(100)) {
+		    fast_percent(pp->atarirate)) {
 			struct move_queue q; q.moves = 0;
 			struct move m = { .coord = ps->last_selfatari[other_color], .color = other_color };			
 			ps->last_selfatari[other_color] = 0;  /* Clear */
+			mstats_start();
 			local_2lib_capture_check(p, b, &m, &q);
+			mstats_end(MH_SELFATARI_CAP, q.moves > 0);
 			if (q.moves > 0)
 				return mq_pick(&q);
 		}
 
 		/* Local group can be PUT in atari? */
-		if (pp->atarirate > fast_random(100)) {
+		if (fast_percent(pp->atarirate)) {
 			struct move_queue q; q.moves = 0;
+			mstats_start();
 			local_2lib_check(p, b, &b->last_move, &q);
+			mstats_end(MH_L2LIB, q.moves > 0);
 			if (q.moves > 0)
 				return mq_pick(&q);
 		}
 
 		/* Local group reduced some of our groups to 3 libs? */
-		if (pp->nlibrate > fast_random(100)) {
+		if (fast_percent(pp->nlibrate)) {
 			struct move_queue q; q.moves = 0;
+			mstats_start();
 			local_nlib_check(p, b, &b->last_move, &q);
+			mstats_end(MH_LNLIB, q.moves > 0);
 			if (q.moves > 0)
 				return mq_pick(&q);
 		}
 
 		/* Some other semeai-ish shape checks */
-		if (pp->eyefixrate > fast_random(100)) {
+		if (fast_percent(pp->eyefixrate)) {
 			struct move_queue q; q.moves = 0;
+			mstats_start();
 			eye_fix_check(p, b, &b->last_move, to_play, &q);
+			mstats_end(MH_EYEFIX, q.moves > 0);
 			if (q.moves > 0)
 				return mq_pick(&q);
 		}
 
 		/* Nakade check */
-		if (pp->nakaderate > fast_random(100)
+		if (fast_percent(pp->nakaderate)
 		    && immediate_liberty_count(b, b->last_move.coord) > 0) {
+			mstats_start();
 			coord_t nakade = nakade_check(p, b, &b->last_move, to_play);
+			mstats_end(MH_NAKADE, !is_pass(nakade));
 			if (!is_pass(nakade))
 				return nakade;
 		}
 
 		/* Check for patterns we know */
-		if (pp->patternrate > fast_random(100)) {
+		if (fast_percent(pp->patternrate)) {
 			struct move_queue q; q.moves = 0;
 			fixp_t gammas[MQL];
+			mstats_start();
 			apply_pattern(p, b, &b->last_move,
 			                  pp->pattern2 && b->last_move2.coord >= 0 ? &b->last_move2 : NULL,
 					  &q, gammas);
+			mstats_end(MH_PATTERN, q.moves > 0);
 			if (q.moves > 0)
 				return mq_gamma_pick(&q, gammas);
 		}
@@ -700,24 +764,30 @@ playout_moggy_seqchoose(struct playout_policy *p, struct playout_setup *s, struc
 	/* Global checks */
 
 	/* Any groups in atari? */
-	if (pp->capturerate > fast_random(100)) {
+	if (fast_percent(pp->capturerate)) {
 		struct move_queue q; q.moves = 0;
+		mstats_start();
 		global_atari_check(p, b, to_play, &q);
+		mstats_end(MH_GATARI, q.moves > 0);
 		if (q.moves > 0)
 			return mq_pick(&q);
 	}
 
 	/* Joseki moves? */
-	if (pp->josekirate > fast_random(100)) {
+	if (fast_percent(pp->josekirate)) {
 		struct move_queue q; q.moves = 0;
+		mstats_start();
 		joseki_check(p, b, to_play, &q);
+		mstats_end(MH_JOSEKI, q.moves > 0);
 		if (q.moves > 0)
 			return mq_pick(&q);
 	}
 
 	/* Fill board */
 	if (pp->fillboardtries > 0) {
+		mstats_start();
 		coord_t c = fillboard_check(p, b);
+		mstats_end(MH_FILLBOARD, !is_pass(c));
 		if (!is_pass(c))
 			return c;
 	}
@@ -878,7 +948,7 @@ playout_moggy_assess_group(struct playout_policy *p, struct prior_map *map, grou
 	struct board *b = map->b;
 	struct move_queue q; q.moves = 0;
 
-	if (board_group_info(b, g).libs > pp->nlib_count)
+	if (board_group_libs(b, g) > pp->nlib_count)
 		return;
 
 	if (PLDEBUGL(5)) {
@@ -1045,7 +1115,7 @@ playout_moggy_assess(struct playout_policy *p, struct prior_map *map, int games)
  * permit() needs to call permit() again on that move. This time alt will be
  * false though (we just want a yes/no answer) so it won't recurse again. */
 static bool
-playout_moggy_permit(struct playout_policy *p, struct board *b, struct move *m, bool alt)
+moggy_permit(struct playout_policy *p, struct board *b, struct move *m, bool alt)
 {
 	struct moggy_policy *pp = p->data;
 	struct moggy_state *ps = b->ps;
@@ -1054,7 +1124,7 @@ playout_moggy_permit(struct playout_policy *p, struct board *b, struct move *m,
 	 * They suck in general, but this also permits us to actually
 	 * handle seki in the playout stage. */
 
-	int bad_selfatari = (pp->selfatarirate > fast_random(100) ? 
+	int bad_selfatari = (fast_percent(pp->selfatarirate) ? 
 			     is_bad_selfatari(b, m->color, m->coord) :
 			     is_really_bad_selfatari(b, m->color, m->coord));
 	if (bad_selfatari) {
@@ -1079,7 +1149,7 @@ playout_moggy_permit(struct playout_policy *p, struct board *b, struct move *m,
 	 * happen only for false eyes, but some of them are in fact
 	 * real eyes with diagonal filled by a dead stone. Prefer
 	 * to counter-capture in that case. */
-	if (!alt || fast_random(100) >= pp->eyefillrate) {
+	if (!alt || !fast_percent(pp->eyefillrate)) {
 		if (PLDEBUGL(5))
 			fprintf(stderr, "skipping eyefill test\n");
 		goto eyefill_skip;
@@ -1120,6 +1190,20 @@ eyefill_skip:
 	return true;
 }
 
+static bool
+playout_moggy_permit(struct playout_policy *p, struct board *b, struct move *m, bool alt)
+{
+	/* Nested permit() checks are accounted within the outer one. */
+	if (likely(!mstats) || !alt)
+		return moggy_permit(p, b, m, alt);
+
+	coord_t coord = m->coord;
+	mstats_start();
+	bool permit = moggy_permit(p, b, m, alt);
+	mstats_end(MH_PERMIT, !permit || m->coord != coord);
+	return permit;
+}
+
 static void
 playout_moggy_setboard(struct playout_policy *playout_policy, struct board *b)
 {
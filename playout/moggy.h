@@ -7,4 +7,40 @@ struct joseki_dict;
 
 struct playout_policy *playout_moggy_init(char *arg, struct board *b, struct joseki_dict *jdict);
 
+
+/* Profiling of the individual moggy heuristics (seqchoose mode only). */
+
+enum moggy_heuristic {
+	MH_KO,
+	MH_LATARI,
+	MH_LADDER,
+	MH_SELFATARI_CAP,
+	MH_L2LIB,
+	MH_LNLIB,
+	MH_EYEFIX,
+	MH_NAKADE,
+	MH_PATTERN,
+	MH_GATARI,
+	MH_JOSEKI,
+	MH_FILLBOARD,
+	/* hits counts moves rejected or redirected by permit(). */
+	MH_PERMIT,
+	MH_MAX
+};
+
+extern const char *moggy_heuristic_names[MH_MAX];
+
+struct moggy_stats {
+	/* Number of times the heuristic ran (after passing its rate
+	 * check), and number of times it came up with a move. */
+	unsigned long calls[MH_MAX];
+	unsigned long hits[MH_MAX];
+	/* Wall time spent inside the heuristic, in seconds. */
+	double time[MH_MAX];
+};
+
+/* Collect statistics of the moggy playouts run by the calling thread
+ * in stats, until called again with NULL. */
+void playout_moggy_profile(struct moggy_stats *stats);
+
 #endif
@@ -10,28 +10,53 @@
 #include "random.h"
 #include "board.h"
 
+static coord_t
+probdist_alias_pick(struct probdist *restrict pd)
+{
+	struct probdist_alias *pa = pd->alias;
+	int k = fast_irandom(pa->n);
+	fixp_t stab = fast_irandom(probdist_total(pd));
+	if (DEBUGL(6))
+		fprintf(stderr, "slot %d [%s] stab %f / %f\n", k, coord2sstr(pa->items[k], pd->b),
+			fixp_to_double(stab), fixp_to_double(pa->prob[k]));
+	return stab < pa->prob[k] ? pa->items[k] : pa->alias[k];
+}
+
 coord_t
 probdist_pick(struct probdist *restrict pd, coord_t *restrict ignore)
 {
+	if (pd->alias)
+		return probdist_alias_pick(pd);
+
 	fixp_t total = probdist_total(pd);
 	fixp_t stab = fast_irandom(total);
 	if (DEBUGL(6))
 		fprintf(stderr, "stab %f / %f\n", fixp_to_double(stab), fixp_to_double(total));
 
+	/* Pick the first item whose prefix sum exceeds stab; items
+	 * with zero value (incl. the muted ones) are thus never hit. */
 	int r = 1;
 	coord_t c = board_size(pd->b) + 1;
-	while (stab > pd->rowtotals[r]) {
+	while (stab >= pd->rowtotals[r]) {
 		if (DEBUGL(6))
 			fprintf(stderr, "[%s] skipping row %f (%f)\n", coord2sstr(c, pd->b), fixp_to_double(pd->rowtotals[r]), fixp_to_double(stab));
 
 		stab -= pd->rowtotals[r];
 		r++; assert(r < board_size(pd->b));
-
 		c += board_size(pd->b);
-		while (!is_pass(*ignore) && *ignore <= c)
-			ignore++;
 	}
 
+	if (is_pass(*ignore)) {
+		/* Fast path, nothing to skip. */
+		for (; c < board_size2(pd->b); c++) {
+			if (stab < pd->items[c])
+				return c;
+			stab -= pd->items[c];
+		}
+	}
+
+	while (!is_pass(*ignore) && *ignore < c)
+		ignore++;
 	for (; c < board_size2(pd->b); c++) {
 		if (DEBUGL(6))
 			fprintf(stderr, "[%s] %f (%f)\n", coord2sstr(c, pd->b), fixp_to_double(pd->items[c]), fixp_to_double(stab));
@@ -44,7 +69,7 @@ probdist_pick(struct probdist *restrict pd, coord_t *restrict ignore)
 			continue;
 		}
 
-		if (stab <= pd->items[c])
+		if (stab < pd->items[c])
 			return c;
 		stab -= pd->items[c];
 	}
@@ -53,3 +78,49 @@ probdist_pick(struct probdist *restrict pd, coord_t *restrict ignore)
 	assert(0);
 	return -1;
 }
+
+void
+probdist_freeze(struct probdist *pd, struct probdist_alias *pa)
+{
+	/* Vose's method, in integers: slot k is accepted with probability
+	 * prob[k] / total, scaled weights are items * n. */
+	int n = 0;
+	for (coord_t c = 0; c < board_size2(pd->b); c++)
+		if (pd->items[c])
+			pa->items[n++] = c;
+	assert(n > 0);
+	pa->n = n;
+
+	uint64_t total = probdist_total(pd);
+	uint64_t scaled[n];
+	int small[n], large[n];
+	int ns = 0, nl = 0;
+	for (int k = 0; k < n; k++) {
+		scaled[k] = (uint64_t) pd->items[pa->items[k]] * n;
+		if (scaled[k] < total)
+			small[ns++] = k;
+		else
+			large[nl++] = k;
+	}
+	while (ns > 0 && nl > 0) {
+		int s = small[--ns], l = large[--nl];
+		pa->prob[s] = scaled[s];
+		pa->alias[s] = pa->items[l];
+		scaled[l] -= total - scaled[s];
+		if (scaled[l] < total)
+			small[ns++] = l;
+		else
+			large[nl++] = l;
+	}
+	/* Whatever remains is exactly full. */
+	while (nl > 0) {
+		int l = large[--nl];
+		pa->prob[l] = total; pa->alias[l] = pa->items[l];
+	}
+	while (ns > 0) {
+		int s = small[--ns];
+		pa->prob[s] = total; pa->alias[s] = pa->items[s];
+	}
+
+	pd->alias = pa;
+}
@@ -16,11 +16,24 @@ struct board;
 /* The interface looks a bit funny-wrapped since we used to switch
  * between different probdist representations. */
 
+struct probdist_alias;
+
 struct probdist {
 	struct board *b;
 	fixp_t *items; // [bsize2], [i] = P(pick==i)
 	fixp_t *rowtotals; // [bsize], [i] = sum of items in row i
 	fixp_t total; // sum of all items
+	struct probdist_alias *alias; // frozen snapshot, NULL if none
+};
+
+/* Alias table (Walker/Vose) of a frozen distribution; picking from it
+ * is O(1), but any change of the distribution invalidates it. Only
+ * the items with non-zero value are stored. */
+struct probdist_alias {
+	int n; // number of slots
+	coord_t *items; // [bsize2], [k] = item of slot k
+	coord_t *alias; // [bsize2], [k] = item picked if slot k is rejected
+	fixp_t *prob; // [bsize2], [k] = P(accept slot k) * total
 };
 
 
@@ -28,7 +41,13 @@ struct probdist {
 #define probdist_alloca(pd_, b_) \
 	fixp_t pd_ ## __pdi[board_size2(b_)] __attribute__((aligned(32))); memset(pd_ ## __pdi, 0, sizeof(pd_ ## __pdi)); \
 	fixp_t pd_ ## __pdr[board_size(b_)] __attribute__((aligned(32))); memset(pd_ ## __pdr, 0, sizeof(pd_ ## __pdr)); \
-	struct probdist pd_ = { .b = b_, .items = pd_ ## __pdi, .rowtotals = pd_ ## __pdr, .total = 0 };
+	struct probdist pd_ = { .b = b_, .items = pd_ ## __pdi, .rowtotals = pd_ ## __pdr, .total = 0, .alias = NULL };
+
+/* Declare alias table pa_ for probdists of board b_ in the local scope. */
+#define probdist_alias_alloca(pa_, b_) \
+	coord_t pa_ ## __pai[board_size2(b_)]; coord_t pa_ ## __paa[board_size2(b_)]; \
+	fixp_t pa_ ## __pap[board_size2(b_)]; \
+	struct probdist_alias pa_ = { .n = 0, .items = pa_ ## __pai, .alias = pa_ ## __paa, .prob = pa_ ## __pap };
 
 /* Get the value of given item. */
 #define probdist_one(pd, c) ((pd)->items[c])
@@ -45,9 +64,16 @@ static void probdist_set(struct probdist *pd, coord_t c, fixp_t val);
 static void probdist_mute(struct probdist *pd, coord_t c);
 
 /* Pick a random item. ignore is a pass-terminated sorted array of items
- * that are not to be considered (and whose values are not in @total). */
+ * that are not to be considered (and whose values are not in @total).
+ * Takes O(bsize), or O(1) if the probdist is frozen. */
 coord_t probdist_pick(struct probdist *pd, coord_t *ignore);
 
+/* Build an alias table of the current distribution in pa and make
+ * probdist_pick() use it until the next probdist_set() or
+ * probdist_mute(). Building is O(bsize2); this pays off for static
+ * distributions that are sampled many times. */
+void probdist_freeze(struct probdist *pd, struct probdist_alias *pa);
+
 
 /* Now, we do something horrible - include board.h for the inline helpers.
  * Yay for us. */
@@ -64,6 +90,7 @@ probdist_set(struct probdist *pd, coord_t c, fixp_t val)
 	assert(c >= 0 && c < board_size2(pd->b));
 	assert(val >= 0);
 #endif
+	pd->alias = NULL;
 	pd->total += val - pd->items[c];
 	pd->rowtotals[coord_y(c, pd->b)] += val - pd->items[c];
 	pd->items[c] = val;
@@ -72,6 +99,7 @@ probdist_set(struct probdist *pd, coord_t c, fixp_t val)
 static inline void
 probdist_mute(struct probdist *pd, coord_t c)
 {
+	pd->alias = NULL;
 	pd->total -= pd->items[c];
 	pd->rowtotals[coord_y(c, pd->b)] -= pd->items[c];
 }
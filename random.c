@@ -1,41 +1,84 @@
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "random.h"
 
 
-/* Simple Park-Miller for floating point; LCG as used in glibc and other places */
+/* xoshiro256** by Blackman and Vigna, http://prng.di.unimi.it/;
+ * seeded by splitmix64. */
 
-#ifndef NO_THREAD_LOCAL
+struct fast_random_state {
+	uint64_t s[4];
+	/* Leftover randomness for fast_percent(): two 32bit fractions
+	 * and the number of draws still in them. */
+	uint64_t pool;
+	int pool_n;
+	unsigned long seed;
+};
 
-static __thread unsigned long pmseed = 29264;
+static inline uint64_t
+rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
 
-void
-fast_srandom(unsigned long seed_)
+static inline uint64_t
+xoshiro_next(struct fast_random_state *r)
 {
-	pmseed = seed_;
+	uint64_t *s = r->s;
+	uint64_t result = rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
 }
 
-unsigned long
-fast_getseed(void)
+static void
+xoshiro_seed(struct fast_random_state *r, unsigned long seed)
 {
-	return pmseed;
+	uint64_t x = seed;
+	for (int i = 0; i < 4; i++) {
+		uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		r->s[i] = z ^ (z >> 31);
+	}
+	r->pool_n = 0;
+	r->seed = seed;
 }
 
-uint16_t
-fast_random(unsigned int max)
+/* Equivalent to 2^128 calls of xoshiro_next(). */
+static void
+xoshiro_jump(struct fast_random_state *r)
 {
-	pmseed = ((pmseed * 1103515245) + 12345) & 0x7fffffff;
-	return ((pmseed & 0xffff) * max) >> 16;
+	static const uint64_t jump[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+					 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+	uint64_t s[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 4; i++)
+		for (int b = 0; b < 64; b++) {
+			if (jump[i] & (1ULL << b))
+				for (int j = 0; j < 4; j++)
+					s[j] ^= r->s[j];
+			xoshiro_next(r);
+		}
+	for (int j = 0; j < 4; j++)
+		r->s[j] = s[j];
 }
 
-float
-fast_frandom(void)
+
+#ifndef NO_THREAD_LOCAL
+
+static __thread struct fast_random_state state = { .s = { 0x9f2dbcd1f4bd1bdbULL, 0xf2b4fa8b4fae3a47ULL,
+							  0x6c2d8d2c0eb1b6ffULL, 0x18ad4e2c6f4e1bb9ULL } };
+
+static inline struct fast_random_state *
+fast_random_state(void)
 {
-	/* Construct (1,2) IEEE floating_t from our random integer */
-	/* http://rgba.org/articles/sfrand/sfrand.htm */
-	union { unsigned long ul; floating_t f; } p;
-	p.ul = (((pmseed *= 16807) & 0x007fffff) - 1) | 0x3f800000;
-	return p.f - 1.0f;
+	return &state;
 }
 
 #else
@@ -45,47 +88,82 @@ fast_frandom(void)
 
 #include <pthread.h>
 
-static pthread_key_t seed_key;
+static pthread_key_t state_key;
 
 static void __attribute__((constructor))
 random_init(void)
 {
-	pthread_key_create(&seed_key, NULL);
-	fast_srandom(29264UL);
+	pthread_key_create(&state_key, free);
+}
+
+static inline struct fast_random_state *
+fast_random_state(void)
+{
+	struct fast_random_state *r = pthread_getspecific(state_key);
+	if (!r) {
+		r = malloc2(sizeof(*r));
+		xoshiro_seed(r, 29264UL);
+		pthread_setspecific(state_key, r);
+	}
+	return r;
+}
+
+#endif
+
+
+void
+fast_srandom(unsigned long seed)
+{
+	xoshiro_seed(fast_random_state(), seed);
 }
 
 void
-fast_srandom(unsigned long seed_)
+fast_srandom_stream(unsigned long seed, int stream)
 {
-	pthread_setspecific(seed_key, (void *)seed_);
+	struct fast_random_state *r = fast_random_state();
+	xoshiro_seed(r, seed);
+	while (stream-- > 0)
+		xoshiro_jump(r);
 }
 
 unsigned long
 fast_getseed(void)
 {
-	return (unsigned long)pthread_getspecific(seed_key);
+	return fast_random_state()->seed;
+}
+
+uint64_t
+fast_random64(void)
+{
+	return xoshiro_next(fast_random_state());
 }
 
 uint16_t
 fast_random(unsigned int max)
 {
-	unsigned long pmseed = (unsigned long)pthread_getspecific(seed_key);
-	pmseed = ((pmseed * 1103515245) + 12345) & 0x7fffffff;
-	pthread_setspecific(seed_key, (void *)pmseed);
-	return ((pmseed & 0xffff) * max) >> 16;
+	return ((xoshiro_next(fast_random_state()) >> 32) * max) >> 32;
+}
+
+bool
+fast_percent(int rate)
+{
+	/* We read each half of the random number as a fraction in [0,1)
+	 * and take out one base-100 digit at a time; three digits per
+	 * half keep the bias below 0.03%. */
+	struct fast_random_state *r = fast_random_state();
+	if (!r->pool_n) {
+		r->pool = xoshiro_next(r);
+		r->pool_n = 6;
+	}
+	int half = r->pool_n > 3 ? 32 : 0;
+	uint64_t m = ((r->pool >> half) & 0xffffffff) * 100;
+	r->pool = (r->pool & ~(0xffffffffULL << half)) | ((m & 0xffffffff) << half);
+	r->pool_n--;
+	return rate > (int) (m >> 32);
 }
 
 float
 fast_frandom(void)
 {
-	/* Construct (1,2) IEEE floating_t from our random integer */
-	/* http://rgba.org/articles/sfrand/sfrand.htm */
-	unsigned long pmseed = (unsigned long)pthread_getspecific(seed_key);
-	pmseed *= 16807;
-	union { unsigned long ul; floating_t f; } p;
-	p.ul = ((pmseed & 0x007fffff) - 1) | 0x3f800000;
-	pthread_setspecific(seed_key, (void *)pmseed);
-	return p.f - 1.0f;
+	return (xoshiro_next(fast_random_state()) >> 40) * (1.0f / 16777216);
 }
-
-#endif
@@ -1,18 +1,33 @@
 #ifndef PACHI_RANDOM_H
 #define PACHI_RANDOM_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "util.h"
 
+/* Each thread has its own generator state (xoshiro256**), so runs
+ * with a fixed seed are reproducible regardless of thread scheduling. */
+
 void fast_srandom(unsigned long seed);
+/* Seed and jump 2^128 steps ahead @stream times; threads seeded with
+ * the same seed and different streams get non-overlapping sequences. */
+void fast_srandom_stream(unsigned long seed, int stream);
+/* The last seed passed to fast_srandom*(). */
 unsigned long fast_getseed(void);
 
-/* Note that only 16bit numbers can be returned. */
+/* Full 64bit random number. */
+uint64_t fast_random64(void);
+
+/* Random number in [0..max) range; max must not exceed 65536. */
 uint16_t fast_random(unsigned int max);
 /* Use this one if you want larger numbers. */
 static uint32_t fast_irandom(unsigned int max);
 
+/* Return true with probability rate/100. Several rate checks are
+ * served from a single 64bit random number. */
+bool fast_percent(int rate);
+
 /* Get random number in [0..1] range. */
 float fast_frandom();
 
@@ -20,11 +35,7 @@ float fast_frandom();
 static inline uint32_t
 fast_irandom(unsigned int max)
 {
-	if (max <= 65536)
-		return fast_random(max);
-	int himax = (max - 1) / 65536;
-	uint16_t hi = fast_random(himax + 1);
-	return ((uint32_t)hi << 16) | fast_random(hi < himax ? 65536 : max % 65536);
+	return ((fast_random64() >> 32) * max) >> 32;
 }
 
 #endif
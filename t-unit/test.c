@@ -30,7 +30,7 @@ board_print_test(int level, struct board *b)
 	board_printed = true;
 }
 
-static void
+void
 board_load(struct board *b, FILE *f, unsigned int size)
 {
 	board_printed = false;
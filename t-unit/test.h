@@ -1,6 +1,13 @@
 #ifndef PACHI_T_UNIT_TEST_H
 #define PACHI_T_UNIT_TEST_H
 
+#include <stdio.h>
+
+struct board;
+
 void unittest(char *filename);
 
+/* Load the board diagram following a "boardsize @size" line in @f. */
+void board_load(struct board *b, FILE *f, unsigned int size);
+
 #endif
@@ -115,6 +115,18 @@ test_undo(struct board *orig, coord_t c, enum stone color)
 		assert(0);
 	}
 
+	// Same with board_play() + board_journal_rollback()
+	board_journal_init(&b2);
+	int mark = board_journal_mark(&b2);
+	r = board_play(&b2, &m);  assert(r >= 0);
+	assert(!board_cmp(&b2, &b));
+	board_journal_rollback(&b2, mark);
+	if (board_cmp(&b2, orig)) {
+		board_dump(orig);
+		board_dump(&b2);
+		assert(0);
+	}
+
 	board_done_noalloc(&b);
 	board_done_noalloc(&b2);
 	
@@ -155,11 +167,15 @@ board_undo_stress_test(struct board *board, char *arg)
 	// Hijack policy permit()
 	policy_permit = policy->permit;  policy->permit = permit_hook;
 
-	/* Play some games */
+	/* Play some games, then roll the whole game back. */
 	for (int i = 0; i < games; i++)  {
 		struct board b;
 		board_copy(&b, board);		
+		board_journal_init(&b);
+		int mark = board_journal_mark(&b);
 		play_random_game(&setup, &b, color, NULL, NULL, policy);
+		board_journal_rollback(&b, mark);
+		assert(!board_cmp(&b, board));
 		board_done_noalloc(&b);
 	}
 	
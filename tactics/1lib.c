@@ -187,7 +187,7 @@ group_atari_check(unsigned int alwaysccaprate, struct board *b, group_t group, e
 	 *     (maybe not so uncommon in moggy ?) / it upsets moggy's balance somehow
 	 *     (there's always a chance opponent doesn't capture after taking snapback) */
 	bool ccap = can_countercapture_any(b, group, q, tag);
-	if (ccap && !ladder && alwaysccaprate > fast_random(100))
+	if (ccap && !ladder && fast_percent(alwaysccaprate))
 		return;
 
 	/* Otherwise, do not save kos. */
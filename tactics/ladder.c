@@ -18,6 +18,27 @@
  * assume ladder doesn't work if countercapturing is possible. */
 #define MIDDLE_LADDER_CHECK_COUNTERCAP 1
 
+/* Middle ladder reading results are cached per thread, see
+ * middle_ladder_read(). */
+#define LADDER_CACHE_SIZE 64
+
+struct ladder_area {
+	int x1, y1, x2, y2;
+};
+
+struct ladder_cache_entry {
+	coord_t coord;
+	group_t laddered;
+	int bsize;
+	struct ladder_area area;
+	hash_t hash;
+	int length;
+};
+
+static __thread struct ladder_cache_entry ladder_cache[LADDER_CACHE_SIZE];
+/* Bounding box of the moves played by the current reading. */
+static __thread struct ladder_area ladder_area;
+
 
 bool
 is_border_ladder(struct board *b, coord_t coord, group_t laddered, enum stone lcolor)
@@ -76,6 +97,16 @@ is_border_ladder(struct board *b, coord_t coord, group_t laddered, enum stone lc
 static int middle_ladder_walk(struct board *b, group_t laddered, enum stone lcolor,
 			      struct move_queue *prev_ccq, coord_t prevmove, int len);
 
+static void
+ladder_area_add(struct board *b, coord_t c)
+{
+	int x = coord_x(c, b), y = coord_y(c, b);
+	if (x < ladder_area.x1) ladder_area.x1 = x;
+	if (x > ladder_area.x2) ladder_area.x2 = x;
+	if (y < ladder_area.y1) ladder_area.y1 = y;
+	if (y > ladder_area.y2) ladder_area.y2 = y;
+}
+
 static int
 middle_ladder_chase(struct board *b, group_t laddered, enum stone lcolor, struct move_queue *ccq,
 		    coord_t prevmove, int len)
@@ -119,6 +150,7 @@ middle_ladder_chase(struct board *b, group_t laddered, enum stone lcolor, struct
 	/* Try out the alternatives. */
 	for (int i = 0; i < libs; i++) {		
 		coord_t ataristone = board_group_info(b, laddered).lib[liblist[i]];
+		ladder_area_add(b, ataristone);
 
 		with_move(b, ataristone, stone_other(lcolor), {
 			/* If we just played self-atari, abandon ship. */
@@ -161,6 +193,7 @@ chaser_capture_escapes(struct board *b, group_t laddered, enum stone lcolor, str
 		coord_t lib = ccq->move[i];
 		if (!board_is_valid_play(b, lcolor, lib))
 			continue;
+		ladder_area_add(b, lib);
 
 #ifndef MIDDLE_LADDER_CHECK_COUNTERCAP
 		return true;
@@ -218,6 +251,7 @@ middle_ladder_walk(struct board *b, group_t laddered, enum stone lcolor,
 
 	/* Escape then */
 	coord_t nextmove = board_group_info(b, laddered).lib[0];
+	ladder_area_add(b, nextmove);
 	if (DEBUGL(6))
 		fprintf(stderr, "  ladder escape %s\n", coord2sstr(nextmove, b));
 	with_move_strict(b, nextmove, lcolor, {
@@ -229,6 +263,65 @@ middle_ladder_walk(struct board *b, group_t laddered, enum stone lcolor,
 
 static __thread int length = 0;
 
+/* Hash of the stones within the area, with the liberty count (capped
+ * at 3) of their groups, plus the ko state. */
+static hash_t
+ladder_area_hash(struct board *b, struct ladder_area *a)
+{
+	hash_t h = b->ko.coord;
+	if (!is_pass(b->ko.coord))
+		h ^= hash_at(b, b->last_move.coord, S_WHITE);
+	for (int y = a->y1; y <= a->y2; y++)
+		for (int x = a->x1; x <= a->x2; x++) {
+			enum stone color = board_atxy(b, x, y);
+			if (color != S_BLACK && color != S_WHITE)
+				continue;
+			int libs = board_group_info(b, group_atxy(b, x, y)).libs;
+			h ^= hash_at(b, coord_xy(b, x, y), color) + (libs > 3 ? 3 : libs);
+		}
+	return h;
+}
+
+/* Read out the ladder of the laddered group escaping at coord. */
+/* The result only depends on the stones around the reading path (and
+ * their liberties), so it is cached together with the bounding box of
+ * the path (plus a two-point margin) and a hash of that area. Playouts
+ * keep asking about the same ladders, and a move elsewhere on the board
+ * does not invalidate the entry. */
+static int
+middle_ladder_read(struct board *b, coord_t coord, group_t laddered, enum stone lcolor)
+{
+	struct ladder_cache_entry *e = &ladder_cache[coord % LADDER_CACHE_SIZE];
+	if (e->coord == coord && e->laddered == laddered && e->bsize == board_size(b)
+	    && e->hash == ladder_area_hash(b, &e->area))
+		return e->length;
+
+	int x = coord_x(coord, b), y = coord_y(coord, b);
+	ladder_area = (struct ladder_area) { x, y, x, y };
+	foreach_in_group(b, laddered) {
+		ladder_area_add(b, c);
+	} foreach_in_group_end;
+
+	/* We could escape by countercapturing a group. */
+	struct move_queue ccq = { .moves = 0 };
+	can_countercapture(b, laddered, &ccq, 0);
+	int len = middle_ladder_walk(b, laddered, lcolor, &ccq, pass, 0);
+
+	int margin = 2, max = board_size(b) - 2;
+	struct ladder_area *a = &ladder_area;
+	a->x1 = a->x1 - margin < 1 ? 1 : a->x1 - margin;
+	a->y1 = a->y1 - margin < 1 ? 1 : a->y1 - margin;
+	a->x2 = a->x2 + margin > max ? max : a->x2 + margin;
+	a->y2 = a->y2 + margin > max ? max : a->y2 + margin;
+	e->coord = coord;
+	e->laddered = laddered;
+	e->bsize = board_size(b);
+	e->area = *a;
+	e->hash = ladder_area_hash(b, a);
+	e->length = len;
+	return len;
+}
+
 bool
 is_middle_ladder(struct board *b, coord_t coord, group_t laddered, enum stone lcolor)
 {
@@ -248,12 +341,7 @@ is_middle_ladder(struct board *b, coord_t coord, group_t laddered, enum stone lc
 	/* A fair chance for a ladder. Group in atari, with some but limited
 	 * space to escape. Time for the expensive stuff - play it out and
 	 * start selective 2-liberty search. */
-
-	/* We could escape by countercapturing a group. */
-	struct move_queue ccq = { .moves = 0 };
-	can_countercapture(b, laddered, &ccq, 0);
-
-	length = middle_ladder_walk(b, laddered, lcolor, &ccq, pass, 0);
+	length = middle_ladder_read(b, coord, laddered, lcolor);
 
 	if (DEBUGL(6) && length) {
 		fprintf(stderr, "is_ladder(): stones: %i  length: %i\n",
@@ -271,11 +359,7 @@ is_middle_ladder_any(struct board *b, coord_t coord, group_t laddered, enum ston
 	assert(board_group_info(b, laddered).lib[0] == coord);
 	assert(board_at(b, laddered) == lcolor);
 
-	/* We could escape by countercapturing a group. */
-	struct move_queue ccq = { .moves = 0 };
-	can_countercapture(b, laddered, &ccq, 0);
-	
-	length = middle_ladder_walk(b, laddered, lcolor, &ccq, pass, 0);
+	length = middle_ladder_read(b, coord, laddered, lcolor);
 	return (length != 0);
 }
 
@@ -23,7 +23,7 @@ breaking_3_stone_seki(struct board *b, coord_t coord, enum stone color)
 		if (board_at(b, c) != other_color)
 			continue;
 		group_t g = group_at(b, c);
-		if (board_group_info(b, g).libs != 2 ||
+		if (board_group_libs(b, g) != 2 ||
 		    group_stone_count(b, g, 4) != 3)
 			return false;
 		if (g3)  /* Multiple groups or bad bent-3 */
@@ -0,0 +1,86 @@
+#!/bin/sh
+#
+# distributed_loopback: Regression run of the distributed engine with
+# a master and several slaves on this machine.
+#
+# Usage: tools/distributed_loopback.sh [RUNS [SLAVES [MASTER_OPTS]]]
+#
+# Each run plays a few moves on 9x9 with all slaves connected through
+# the loopback interface, and fails if the master or a slave dies or
+# the master reports an illegal move (slaves out of sync).
+# MASTER_OPTS are extra options of the distributed engine; with "shm"
+# the slaves connect with -g shm:localhost:PORT.
+# Pass other Pachi parameters of the slaves in PACHIARGS (default -t =3000).
+# With RELAYS=n, the master has n relays on the next ports and the
+# slaves are spread over the relays, e.g. RELAYS=2 with 4 slaves runs
+# 1 master + 2 relays + 4 slaves. MASTER_OPTS also apply to the relays.
+
+runs="${1:-6}"
+nslaves="${2:-3}"
+mopts="$3"
+port="${PORT:-12340}"
+slaveargs="${PACHIARGS--t =3000}"
+nrelays="${RELAYS:-0}"
+[ -z "$mopts" ] || mopts=",$mopts"
+case "$mopts" in *shm*) host="shm:localhost";; *) host="localhost";; esac
+
+log=$(mktemp -d /tmp/pachi-loopback.XXXXXX)
+failed=0
+run=0
+while [ $run -lt $runs ]; do
+	run=$((run+1))
+	# Keep the master listening until all slaves are connected.
+	{ sleep 2
+	  printf 'boardsize 9\nclear_board\nkomi 7.5\n'
+	  for m in 1 2; do
+		printf 'genmove b\ngenmove w\n'
+	  done
+	  printf 'quit\n'
+	} | ./pachi -e distributed -t =3000 -d 2 "slave_port=$port$mopts" \
+		>$log/master.out 2>$log/master.err &
+	master=$!
+	sleep 0.5
+	pids=""
+	r=0
+	while [ $r -lt $nrelays ]; do
+		r=$((r+1))
+		./pachi -e distributed -g "$host:$port" \
+			"slave,slave_port=$((port+r))$mopts" \
+			>/dev/null 2>$log/relay$r.err &
+		pids="$pids $!"
+	done
+	[ $nrelays -eq 0 ] || sleep 0.5
+	s=0
+	while [ $s -lt $nslaves ]; do
+		s=$((s+1))
+		# Slave s connects to the master or to relay (s-1) % RELAYS + 1.
+		sport=$port
+		[ $nrelays -eq 0 ] || sport=$((port + (s-1) % nrelays + 1))
+		./pachi -e uct -g "$host:$sport" $slaveargs slave \
+			>/dev/null 2>$log/slave$s.err &
+		pids="$pids $!"
+	done
+
+	status=ok
+	wait $master || status="master exit $?"
+	kill $pids 2>/dev/null
+	for p in $pids; do wait $p 2>/dev/null; done
+	if grep -q 'illegal move' $log/master.err; then
+		status="illegal move"
+	elif grep -q 'Assertion' $log/slave*.err; then
+		status="slave assertion"
+	elif [ $nrelays -gt 0 ] && grep -q 'Assertion' $log/relay*.err; then
+		status="relay assertion"
+	elif [ $(grep -c '^=' $log/master.out) -ne 8 ]; then
+		status="missing replies"
+	fi
+	echo "run $run: $status"
+	if [ "$status" != ok ]; then
+		failed=$((failed+1))
+		mkdir -p $log/run$run && cp $log/*.out $log/*.err $log/run$run/
+	fi
+	port=$((port+nrelays+1))
+done
+
+echo "$failed of $runs runs failed, logs in $log"
+[ $failed -eq 0 ]
@@ -48,6 +48,7 @@ struct uct {
 	int force_seed;
 	bool no_tbook;
 	bool fast_alloc;
+	bool background_gc;
 	unsigned long max_tree_size;
 	unsigned long max_pruned_size;
 	unsigned long pruning_threshold;
@@ -55,6 +56,8 @@ struct uct {
 	int significant_threshold;
 
 	int threads;
+	bool pin_threads;
+	bool journal_board; /* Roll back one board per thread instead of copying. */
 	enum uct_thread_model {
 		TM_TREE, /* Tree parallelization w/o virtual loss. */
 		TM_TREEVL, /* Tree parallelization with virtual loss. */
@@ -118,6 +121,10 @@ struct uct {
 
 	/* Used within frame of single genmove. */
 	struct board_ownermap ownermap;
+	/* Transposition table size, 2^tt_bits entries; 0 to disable,
+	 * -1 to size it according to max_tree_size. */
+	int tt_bits;
+
 	/* Used for coordination among slaves of the distributed engine. */
 	int stats_hbits;
 	int shared_nodes;
@@ -25,12 +25,14 @@ void uctp_generic_winner(struct uct_policy *p, struct tree *tree, struct uct_des
 #define uctd_try_node_children(tree, descent, allow_pass, parity, tenuki_d, di, urgency) \
 	/* Information abound best children. */ \
 	/* XXX: We assume board <=25x25. */ \
-	struct uct_descent dbest[BOARD_MAX_MOVES + 1] = { { .node = descent->node->children, .lnode = NULL } }; int dbests = 1; \
+	int dchildren; struct tree_node *dfirst = tree_node_children(descent->node, &dchildren); \
+	struct uct_descent dbest[BOARD_MAX_MOVES + 1] = { { .node = dfirst, .lnode = NULL } }; int dbests = 1; \
 	floating_t best_urgency = -9999; \
-	/* Descent children iterator. */ \
-	struct uct_descent dci = { .node = descent->node->children, .lnode = descent->lnode ? descent->lnode->children : NULL }; \
+	/* Descent children iterator; the children are scanned sequentially
+	 * within their block, see tree_node_children(). */ \
+	struct uct_descent dci = { .node = dfirst, .lnode = descent->lnode ? descent->lnode->children : NULL }; \
 	\
-	for (; dci.node; dci.node = dci.node->sibling) { \
+	for (; dci.node < dfirst + dchildren; dci.node++) { \
 		floating_t urgency; \
 		/* Do not consider passing early. */ \
 		if (unlikely((!allow_pass && is_pass(node_coord(dci.node))) || (dci.node->hints & TREE_HINT_INVALID))) \
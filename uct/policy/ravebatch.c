@@ -0,0 +1,265 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DEBUG
+#include "debug.h"
+#include "util.h"
+#include "uct/policy/ravebatch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RAVE_BATCH_X86
+#endif
+
+/* All the kernels below follow exactly ucb1rave_evaluate() and the
+ * urgency adjustments of ucb1rave_descend(); playouts are kept as
+ * floats but hold integer values, conversions to int in the original
+ * code are done by truncation. */
+
+
+/* Plain C kernel. */
+
+static inline void
+merge_c(float *dv, float *dp, float sv, float sp)
+{
+	/* stats_merge() */
+	if (sp != 0) {
+		*dp += sp;
+		*dv += (sv - *dv) * sp / *dp;
+	}
+}
+
+static void
+rave_batch_c(const struct rave_batch_params *p, struct rave_batch *rb, int n)
+{
+	for (int i = 0; i < n; i++) {
+		float nv = rb->uv[i], np = rb->up[i];
+		float rv = rb->av[i], rp = rb->ap[i];
+		if (p->amaf_prior)
+			merge_c(&rv, &rp, rb->pv[i], rb->pp[i]);
+		else
+			merge_c(&nv, &np, rb->pv[i], rb->pp[i]);
+		if (p->virtual_loss)
+			merge_c(&nv, &np, p->vloss_value, truncf(rb->descents[i] * p->vloss_coeff));
+		merge_c(&rv, &rp, rb->lv[i], rb->lp[i]);
+
+		if (p->crit_rave > 0 && rb->up[i] > p->crit_thres) {
+			float crit = rb->wo[i] - (2 * rb->bo[i] * rb->uv[i] - rb->bo[i] - rb->uv[i] + 1);
+			if (p->crit_negative || crit > 0) {
+				float val = 1.0f;
+				if (p->crit_negflip && crit < 0) {
+					val = 0;
+					crit = -crit;
+				}
+				merge_c(&rv, &rp, p->black_parity ? val : 1 - val,
+					truncf(crit * rp * p->crit_rave));
+			}
+		}
+
+		float value = 0;
+		if (np != 0) {
+			if (rp != 0) {
+				float beta = p->sylvain_rave ? rp / ((rp + np) + np * rp / p->equiv_rave) : p->beta;
+				value = beta * rv + (1.f - beta) * nv;
+			} else {
+				value = nv;
+			}
+		} else if (rp != 0) {
+			value = rv;
+		}
+
+		float urgency = p->black_parity ? value : 1 - value;
+		if (rb->up[i] > 0 && p->explore > 0)
+			urgency += p->explore / sqrtf(rb->up[i]);
+		else if (rb->up[i] + rb->ap[i] + rb->pp[i] == 0)
+			urgency = p->fpu;
+		rb->urgency[i] = urgency;
+	}
+}
+
+
+#ifdef RAVE_BATCH_X86
+
+/* SSE2 kernel, 4 children at once. */
+
+#define SSE2 __attribute__((target("sse2")))
+
+static inline SSE2 __m128
+blend_sse2(__m128 mask, __m128 a, __m128 b)
+{
+	/* mask ? a : b */
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline SSE2 __m128
+trunc_sse2(__m128 x)
+{
+	return _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+}
+
+static inline SSE2 void
+merge_sse2(__m128 *dv, __m128 *dp, __m128 sv, __m128 sp)
+{
+	__m128 m = _mm_cmpneq_ps(sp, _mm_setzero_ps());
+	__m128 np = _mm_add_ps(*dp, sp);
+	__m128 nv = _mm_add_ps(*dv, _mm_div_ps(_mm_mul_ps(_mm_sub_ps(sv, *dv), sp), np));
+	*dv = blend_sse2(m, nv, *dv);
+	*dp = blend_sse2(m, np, *dp);
+}
+
+static SSE2 void
+rave_batch_sse2(const struct rave_batch_params *p, struct rave_batch *rb, int n)
+{
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+	for (int i = 0; i < n; i += 4) {
+		__m128 uv = _mm_loadu_ps(&rb->uv[i]), up = _mm_loadu_ps(&rb->up[i]);
+		__m128 ap = _mm_loadu_ps(&rb->ap[i]), pp = _mm_loadu_ps(&rb->pp[i]);
+		__m128 nv = uv, np = up;
+		__m128 rv = _mm_loadu_ps(&rb->av[i]), rp = ap;
+		if (p->amaf_prior)
+			merge_sse2(&rv, &rp, _mm_loadu_ps(&rb->pv[i]), pp);
+		else
+			merge_sse2(&nv, &np, _mm_loadu_ps(&rb->pv[i]), pp);
+		if (p->virtual_loss)
+			merge_sse2(&nv, &np, _mm_set1_ps(p->vloss_value),
+				   trunc_sse2(_mm_mul_ps(_mm_loadu_ps(&rb->descents[i]), _mm_set1_ps(p->vloss_coeff))));
+		merge_sse2(&rv, &rp, _mm_loadu_ps(&rb->lv[i]), _mm_loadu_ps(&rb->lp[i]));
+
+		if (p->crit_rave > 0) {
+			__m128 bo = _mm_loadu_ps(&rb->bo[i]);
+			__m128 crit = _mm_sub_ps(_mm_loadu_ps(&rb->wo[i]),
+						 _mm_add_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(2), bo), uv), bo), uv), one));
+			__m128 m = _mm_cmpgt_ps(up, _mm_set1_ps(p->crit_thres));
+			if (!p->crit_negative)
+				m = _mm_and_ps(m, _mm_cmpgt_ps(crit, zero));
+			__m128 val = one;
+			if (p->crit_negflip) {
+				__m128 neg = _mm_cmplt_ps(crit, zero);
+				val = blend_sse2(neg, zero, one);
+				crit = blend_sse2(neg, _mm_sub_ps(zero, crit), crit);
+			}
+			__m128 cv = p->black_parity ? val : _mm_sub_ps(one, val);
+			__m128 cp = trunc_sse2(_mm_mul_ps(_mm_mul_ps(crit, rp), _mm_set1_ps(p->crit_rave)));
+			merge_sse2(&rv, &rp, cv, _mm_and_ps(m, cp));
+		}
+
+		__m128 hasn = _mm_cmpneq_ps(np, zero), hasr = _mm_cmpneq_ps(rp, zero);
+		__m128 beta = p->sylvain_rave
+			? _mm_div_ps(rp, _mm_add_ps(_mm_add_ps(rp, np), _mm_div_ps(_mm_mul_ps(np, rp), _mm_set1_ps(p->equiv_rave))))
+			: _mm_set1_ps(p->beta);
+		__m128 blended = _mm_add_ps(_mm_mul_ps(beta, rv), _mm_mul_ps(_mm_sub_ps(one, beta), nv));
+		__m128 value = blend_sse2(hasn, blend_sse2(hasr, blended, nv), _mm_and_ps(hasr, rv));
+
+		__m128 urgency = p->black_parity ? value : _mm_sub_ps(one, value);
+		__m128 unvisited = _mm_cmpeq_ps(_mm_add_ps(_mm_add_ps(up, ap), pp), zero);
+		__m128 fpu = blend_sse2(unvisited, _mm_set1_ps(p->fpu), urgency);
+		if (p->explore > 0) {
+			__m128 explored = _mm_add_ps(urgency, _mm_div_ps(_mm_set1_ps(p->explore), _mm_sqrt_ps(up)));
+			urgency = blend_sse2(_mm_cmpgt_ps(up, zero), explored, fpu);
+		} else {
+			urgency = fpu;
+		}
+		_mm_storeu_ps(&rb->urgency[i], urgency);
+	}
+}
+
+
+/* AVX2 kernel, 8 children at once. */
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256
+trunc_avx2(__m256 x)
+{
+	return _mm256_round_ps(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+}
+
+static inline AVX2 void
+merge_avx2(__m256 *dv, __m256 *dp, __m256 sv, __m256 sp)
+{
+	__m256 m = _mm256_cmp_ps(sp, _mm256_setzero_ps(), _CMP_NEQ_UQ);
+	__m256 np = _mm256_add_ps(*dp, sp);
+	__m256 nv = _mm256_add_ps(*dv, _mm256_div_ps(_mm256_mul_ps(_mm256_sub_ps(sv, *dv), sp), np));
+	*dv = _mm256_blendv_ps(*dv, nv, m);
+	*dp = _mm256_blendv_ps(*dp, np, m);
+}
+
+static AVX2 void
+rave_batch_avx2(const struct rave_batch_params *p, struct rave_batch *rb, int n)
+{
+	const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+	for (int i = 0; i < n; i += 8) {
+		__m256 uv = _mm256_loadu_ps(&rb->uv[i]), up = _mm256_loadu_ps(&rb->up[i]);
+		__m256 ap = _mm256_loadu_ps(&rb->ap[i]), pp = _mm256_loadu_ps(&rb->pp[i]);
+		__m256 nv = uv, np = up;
+		__m256 rv = _mm256_loadu_ps(&rb->av[i]), rp = ap;
+		if (p->amaf_prior)
+			merge_avx2(&rv, &rp, _mm256_loadu_ps(&rb->pv[i]), pp);
+		else
+			merge_avx2(&nv, &np, _mm256_loadu_ps(&rb->pv[i]), pp);
+		if (p->virtual_loss)
+			merge_avx2(&nv, &np, _mm256_set1_ps(p->vloss_value),
+				   trunc_avx2(_mm256_mul_ps(_mm256_loadu_ps(&rb->descents[i]), _mm256_set1_ps(p->vloss_coeff))));
+		merge_avx2(&rv, &rp, _mm256_loadu_ps(&rb->lv[i]), _mm256_loadu_ps(&rb->lp[i]));
+
+		if (p->crit_rave > 0) {
+			__m256 bo = _mm256_loadu_ps(&rb->bo[i]);
+			__m256 crit = _mm256_sub_ps(_mm256_loadu_ps(&rb->wo[i]),
+						    _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(2), bo), uv), bo), uv), one));
+			__m256 m = _mm256_cmp_ps(up, _mm256_set1_ps(p->crit_thres), _CMP_GT_OQ);
+			if (!p->crit_negative)
+				m = _mm256_and_ps(m, _mm256_cmp_ps(crit, zero, _CMP_GT_OQ));
+			__m256 val = one;
+			if (p->crit_negflip) {
+				__m256 neg = _mm256_cmp_ps(crit, zero, _CMP_LT_OQ);
+				val = _mm256_blendv_ps(one, zero, neg);
+				crit = _mm256_blendv_ps(crit, _mm256_sub_ps(zero, crit), neg);
+			}
+			__m256 cv = p->black_parity ? val : _mm256_sub_ps(one, val);
+			__m256 cp = trunc_avx2(_mm256_mul_ps(_mm256_mul_ps(crit, rp), _mm256_set1_ps(p->crit_rave)));
+			merge_avx2(&rv, &rp, cv, _mm256_and_ps(m, cp));
+		}
+
+		__m256 hasn = _mm256_cmp_ps(np, zero, _CMP_NEQ_UQ), hasr = _mm256_cmp_ps(rp, zero, _CMP_NEQ_UQ);
+		__m256 beta = p->sylvain_rave
+			? _mm256_div_ps(rp, _mm256_add_ps(_mm256_add_ps(rp, np), _mm256_div_ps(_mm256_mul_ps(np, rp), _mm256_set1_ps(p->equiv_rave))))
+			: _mm256_set1_ps(p->beta);
+		__m256 blended = _mm256_add_ps(_mm256_mul_ps(beta, rv), _mm256_mul_ps(_mm256_sub_ps(one, beta), nv));
+		__m256 value = _mm256_blendv_ps(_mm256_and_ps(hasr, rv), _mm256_blendv_ps(nv, blended, hasr), hasn);
+
+		__m256 urgency = p->black_parity ? value : _mm256_sub_ps(one, value);
+		__m256 unvisited = _mm256_cmp_ps(_mm256_add_ps(_mm256_add_ps(up, ap), pp), zero, _CMP_EQ_OQ);
+		__m256 fpu = _mm256_blendv_ps(urgency, _mm256_set1_ps(p->fpu), unvisited);
+		if (p->explore > 0) {
+			__m256 explored = _mm256_add_ps(urgency, _mm256_div_ps(_mm256_set1_ps(p->explore), _mm256_sqrt_ps(up)));
+			urgency = _mm256_blendv_ps(fpu, explored, _mm256_cmp_ps(up, zero, _CMP_GT_OQ));
+		} else {
+			urgency = fpu;
+		}
+		_mm256_storeu_ps(&rb->urgency[i], urgency);
+	}
+}
+
+#endif /* RAVE_BATCH_X86 */
+
+
+rave_batch_kernel
+rave_batch_kernel_select(void)
+{
+	const char *name = "c";
+	rave_batch_kernel kernel = rave_batch_c;
+#ifdef RAVE_BATCH_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		name = "avx2";
+		kernel = rave_batch_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		name = "sse2";
+		kernel = rave_batch_sse2;
+	}
+#endif
+	if (DEBUGL(3))
+		fprintf(stderr, "ucb1amaf: using %s batch kernel\n", name);
+	return kernel;
+}
@@ -0,0 +1,54 @@
+#ifndef PACHI_UCT_POLICY_RAVEBATCH_H
+#define PACHI_UCT_POLICY_RAVEBATCH_H
+
+/* Batched computation of the RAVE-blended urgency of all children of
+ * a node, for the ucb1amaf policy descent. The caller gathers the
+ * children stats into float arrays, then a kernel computes the urgency
+ * of all of them at once. The kernel is vectorized (AVX2 or SSE2)
+ * and chosen at runtime based on the cpu features; a plain C version
+ * is used on other architectures. */
+
+#include <stdbool.h>
+
+#include "board.h"
+
+/* Arrays are padded to a multiple of the widest vector. */
+#define RAVE_BATCH_MAX ((BOARD_MAX_MOVES + 1 + 7) & ~7)
+
+/* Parameters common to all children of the node. */
+struct rave_batch_params {
+	bool amaf_prior; // merge prior into amaf stats instead of u stats
+	bool virtual_loss;
+	float vloss_coeff, vloss_value;
+	/* Criticality: applied to children with more than crit_thres
+	 * playouts, if crit_rave > 0. */
+	float crit_rave, crit_thres;
+	bool crit_negative, crit_negflip;
+	bool sylvain_rave;
+	float equiv_rave;
+	float beta; // fixed beta if !sylvain_rave
+	bool black_parity; // tree_parity() > 0: value to maximize is black's
+	float explore; // explore_p * nconf, or 0
+	float fpu;
+};
+
+/* Per-child data, in structure-of-arrays layout. */
+struct rave_batch {
+	float uv[RAVE_BATCH_MAX], up[RAVE_BATCH_MAX];          // u stats
+	float av[RAVE_BATCH_MAX], ap[RAVE_BATCH_MAX];          // amaf stats
+	float pv[RAVE_BATCH_MAX], pp[RAVE_BATCH_MAX];          // prior stats
+	float lv[RAVE_BATCH_MAX], lp[RAVE_BATCH_MAX];          // scaled local tree stats
+	float wo[RAVE_BATCH_MAX], bo[RAVE_BATCH_MAX];          // winner_owner, black_owner values
+	float descents[RAVE_BATCH_MAX];
+	/* Output. */
+	float urgency[RAVE_BATCH_MAX];
+} __attribute__((aligned(32)));
+
+/* Compute rb->urgency[] for the first n children. Entries up to
+ * the next multiple of 8 must be initialized. */
+typedef void (*rave_batch_kernel)(const struct rave_batch_params *p, struct rave_batch *rb, int n);
+
+/* Select the best kernel for this cpu. */
+rave_batch_kernel rave_batch_kernel_select(void);
+
+#endif
@@ -15,6 +15,7 @@
 #include "uct/internal.h"
 #include "uct/tree.h"
 #include "uct/policy/generic.h"
+#include "uct/policy/ravebatch.h"
 
 /* This implements the UCB1 policy with an extra AMAF heuristics. */
 
@@ -56,6 +57,10 @@ struct ucb1_policy_amaf {
 	bool crit_negflip;
 	bool crit_amaf;
 	bool crit_lvalue;
+	/* Compute the urgency of all children at once in descend,
+	 * with a vectorized kernel if the cpu supports it. */
+	bool batch;
+	rave_batch_kernel batch_kernel;
 };
 
 
@@ -192,6 +197,99 @@ ucb1rave_evaluate(struct uct_policy *p, struct tree *tree, struct uct_descent *d
 	return tree_node_get_value(tree, parity, value);
 }
 
+/* Batched version of ucb1rave_descend(), without virtual wins: gather
+ * the stats of all children, compute their urgency with the batch
+ * kernel, then pick the best child like uctd_set_best_child(). */
+static void
+ucb1rave_descend_batch(struct uct_policy *p, struct tree *tree, struct uct_descent *descent, int parity, bool allow_pass, floating_t nconf)
+{
+	struct ucb1_policy_amaf *b = p->data;
+	struct uct *u = p->uct;
+	struct tree_node *node = descent->node;
+
+	struct rave_batch_params bp = {
+		.amaf_prior = u->amaf_prior,
+		.virtual_loss = u->virtual_loss,
+		.vloss_coeff = b->vloss_sqrt ? sqrt(u->threads) / u->threads : 1.,
+		.vloss_value = parity > 0 ? 0. : 1.,
+		.crit_rave = b->crit_rave,
+		.crit_thres = b->crit_plthres_coef > 0 ? tree->root->u.playouts * b->crit_plthres_coef : b->crit_min_playouts,
+		.crit_negative = b->crit_negative,
+		.crit_negflip = b->crit_negflip,
+		.sylvain_rave = b->sylvain_rave,
+		.equiv_rave = b->equiv_rave,
+		.black_parity = tree_parity(tree, parity) > 0,
+		.explore = b->explore_p > 0 ? b->explore_p * nconf : 0,
+		.fpu = b->fpu,
+	};
+	if (!b->sylvain_rave)
+		bp.beta = sqrt(b->equiv_rave / (3 * node->u.playouts + b->equiv_rave));
+
+	int nchildren;
+	struct tree_node *children = tree_node_children(node, &nchildren);
+	struct rave_batch rb;
+	struct tree_node *lnodes[RAVE_BATCH_MAX];
+	bool skip[RAVE_BATCH_MAX];
+	bool ltree = u->local_tree && b->ltree_rave > 0;
+	struct tree_node *lni = descent->lnode ? descent->lnode->children : NULL;
+
+	int i;
+	for (i = 0; i < nchildren; i++) {
+		struct tree_node *ni = &children[i];
+		skip[i] = (!allow_pass && is_pass(node_coord(ni))) || (ni->hints & TREE_HINT_INVALID);
+		rb.uv[i] = ni->u.value; rb.up[i] = ni->u.playouts;
+		rb.av[i] = ni->amaf.value; rb.ap[i] = ni->amaf.playouts;
+		rb.pv[i] = ni->prior.value; rb.pp[i] = ni->prior.playouts;
+		rb.wo[i] = ni->winner_owner.value; rb.bo[i] = ni->black_owner.value;
+		rb.descents[i] = ni->descents;
+		rb.lv[i] = rb.lp[i] = 0;
+
+		/* Local tree node corresponding to ni,
+		 * see uctd_try_node_children(). */
+		while (lni && node_coord(lni) < node_coord(ni))
+			lni = lni->sibling;
+		lnodes[i] = lni ? tree_lnode_for_node(tree, ni, lni, u->tenuki_d) : NULL;
+		struct tree_node *lnode = lnodes[i];
+		if (ltree && lnode && (u->local_tree_rootchoose || lnode->parent->parent)) {
+			rb.lv[i] = lnode->u.value;
+			rb.lp[i] = (int) (((floating_t) lnode->u.playouts) * b->ltree_rave / LTREE_PLAYOUTS_MULTIPLIER);
+		}
+	}
+	for (; i < RAVE_BATCH_MAX && (i & 7); i++) {
+		rb.uv[i] = rb.up[i] = rb.av[i] = rb.ap[i] = rb.pv[i] = rb.pp[i] = 0;
+		rb.lv[i] = rb.lp[i] = rb.wo[i] = rb.bo[i] = rb.descents[i] = 0;
+	}
+
+	b->batch_kernel(&bp, &rb, nchildren);
+
+	int dbest[RAVE_BATCH_MAX] = { 0 }; int dbests = 1;
+	floating_t best_urgency = -9999;
+	for (i = 0; i < nchildren; i++) {
+		if (unlikely(skip[i]))
+			continue;
+		floating_t urgency = rb.urgency[i];
+		if (urgency - best_urgency > __FLT_EPSILON__) { /* urgency > best_urgency */
+			best_urgency = urgency; dbests = 0;
+		}
+		if (urgency - best_urgency > -__FLT_EPSILON__) { /* urgency >= best_urgency */
+			/* We want to always choose something else than a pass
+			 * in case of a tie. pass causes degenerative behaviour. */
+			if (dbests == 1 && is_pass(node_coord(&children[dbest[0]])))
+				dbests--;
+			dbest[dbests++] = i;
+		}
+	}
+	int best = dbest[fast_random(dbests)];
+
+	descent->node = &children[best];
+	descent->lnode = lnodes[best];
+	/* Set descent->value. */
+	ucb1rave_evaluate(p, tree, descent, parity);
+	/* Make sure lnode information is meaningful. */
+	if (descent->lnode && is_pass(node_coord(descent->lnode)))
+		descent->lnode = NULL;
+}
+
 void
 ucb1rave_descend(struct uct_policy *p, struct tree *tree, struct uct_descent *descent, int parity, bool allow_pass)
 {
@@ -203,6 +301,10 @@ ucb1rave_descend(struct uct_policy *p, struct tree *tree, struct uct_descent *de
 	int vwin = 0;
 	if (u->max_slaves > 0 && u->slave_index >= 0)
 		vwin = descent->node == tree->root ? b->root_virtual_win : b->virtual_win;
+	if (b->batch && vwin <= 0) {
+		ucb1rave_descend_batch(p, tree, descent, parity, allow_pass, nconf);
+		return;
+	}
 	int child = 0;
 
 	uctd_try_node_children(tree, descent, allow_pass, parity, u->tenuki_d, di, urgency) {
@@ -289,7 +391,9 @@ ucb1amaf_update(struct uct_policy *p, struct tree *tree, struct tree_node *node,
 		/* This loop ignores symmetry considerations, but they should
 		 * matter only at a point when AMAF doesn't help much. */
 		assert(map->game_baselen >= 0);
-		for (struct tree_node *ni = node->children; ni; ni = ni->sibling) {
+		int nchildren;
+		struct tree_node *children = tree_node_children(node, &nchildren);
+		for (struct tree_node *ni = children; ni < children + nchildren; ni++) {
 			if (is_pass(node_coord(ni))) continue;
 
 			/* Use the child move only if it was first played by the same color. */
@@ -377,6 +481,13 @@ policy_ucb1amaf_init(struct uct *u, char *arg, struct board *board)
 	b->root_virtual_win = 30;
 	b->vwin_min_playouts = 1000;
 
+	/* The batch kernels work in single precision. */
+#ifdef DOUBLE_FLOATING
+	b->batch = false;
+#else
+	b->batch = true;
+#endif
+
 	if (arg) {
 		char *optspec, *next = arg;
 		while (*next) {
@@ -424,6 +535,8 @@ policy_ucb1amaf_init(struct uct *u, char *arg, struct board *board)
 				b->vwin_min_playouts = atoi(optval);
 			} else if (!strcasecmp(optname, "vloss_sqrt")) {
 				b->vloss_sqrt = !optval || *optval == '1';
+			} else if (!strcasecmp(optname, "batch")) {
+				b->batch = !optval || *optval == '1';
 			} else {
 				fprintf(stderr, "ucb1amaf: Invalid policy argument %s or missing value\n",
 					optname);
@@ -432,5 +545,8 @@ policy_ucb1amaf_init(struct uct *u, char *arg, struct board *board)
 		}
 	}
 
+	if (b->batch)
+		b->batch_kernel = rave_batch_kernel_select();
+
 	return p;
 }
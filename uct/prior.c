@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,6 +32,10 @@ struct uct_prior {
 	int eqex;
 	int even_eqex, policy_eqex, b19_eqex, eye_eqex, ko_eqex, plugin_eqex, joseki_eqex, pattern_eqex;
 	int dcnn_eqex;
+	/* Use dcnn also for nodes up to dcnn_depth below the root,
+	 * evaluated asynchronously in batches of up to dcnn_batch. */
+	int dcnn_depth, dcnn_batch;
+	struct dcnn_queue *dcnnq;
 	int cfgdn; int *cfgd_eqex;
 	bool prune_ladders;
 };
@@ -96,8 +101,194 @@ uct_prior_dcnn(struct uct *u, struct tree_node *node, struct prior_map *map)
 	} foreach_free_point_end;
 }
 
+
+/* Asynchronous dcnn priors below the root: the thread expanding a node
+ * only queues its position, and an evaluator thread runs the network
+ * on batches of queued positions. The priors are added to the children
+ * of each node when its batch returns; meanwhile, the node carries
+ * virtual loss so that other threads rather explore its siblings. */
+
+#define DCNN_QUEUE_MAX 64
+
+struct dcnn_request {
+	struct tree_node *node;
+	struct board b;
+	enum stone color;
+	int parity;
+	int vloss;
+};
+
+struct dcnn_queue {
+	struct uct_prior *p;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t more; // requests queued, or quit
+	pthread_cond_t done; // batch finished
+	/* Ring buffer; the first inflight requests from head are
+	 * being evaluated. */
+	struct dcnn_request req[DCNN_QUEUE_MAX];
+	int head, count, inflight;
+	bool quit;
+};
+
+static void
+dcnn_request_done(struct dcnn_request *r)
+{
+	if (r->vloss)
+		__sync_fetch_and_sub(&r->node->descents, r->vloss);
+	board_done_noalloc(&r->b);
+}
+
+static void
+dcnn_request_apply(struct uct_prior *p, struct dcnn_request *r, float *res)
+{
+	int nchildren;
+	struct tree_node *ni = tree_node_children(r->node, &nchildren);
+	for (int i = 0; i < nchildren; i++, ni++) {
+		coord_t c = node_coord(ni);
+		if (is_pass(c))
+			continue;
+		float val = res[(coord_x(c, &r->b) - 1) * 19 + coord_y(c, &r->b) - 1];
+		if (isnan(val) || val < 0.001)
+			continue;
+		/* We don't need atomicity, see add_prior_value(). */
+		struct move_stats ps = { .playouts = sqrt(val) * p->dcnn_eqex,
+					 .value = r->parity > 0 ? 1 : 0 };
+		stats_merge(&ni->prior, &ps);
+	}
+}
+
+static void *
+dcnn_queue_worker(void *q_)
+{
+	struct dcnn_queue *q = q_;
+	struct uct_prior *p = q->p;
+	struct board *b[p->dcnn_batch];
+	enum stone color[p->dcnn_batch];
+	float res[p->dcnn_batch][19 * 19];
+	float *resp[p->dcnn_batch];
+	for (int i = 0; i < p->dcnn_batch; i++)
+		resp[i] = res[i];
+
+	pthread_mutex_lock(&q->lock);
+	while (true) {
+		while (!q->count && !q->quit)
+			pthread_cond_wait(&q->more, &q->lock);
+		if (q->quit)
+			break;
+		/* Take whatever accumulated while the previous batch
+		 * was evaluated. */
+		int n = q->count < p->dcnn_batch ? q->count : p->dcnn_batch;
+		q->inflight = n;
+		pthread_mutex_unlock(&q->lock);
+
+		for (int i = 0; i < n; i++) {
+			struct dcnn_request *r = &q->req[(q->head + i) % DCNN_QUEUE_MAX];
+			b[i] = &r->b; color[i] = r->color;
+		}
+		dcnn_get_moves_batch(b, color, resp, n);
+		for (int i = 0; i < n; i++) {
+			struct dcnn_request *r = &q->req[(q->head + i) % DCNN_QUEUE_MAX];
+			dcnn_request_apply(p, r, res[i]);
+			dcnn_request_done(r);
+		}
+
+		pthread_mutex_lock(&q->lock);
+		q->head = (q->head + n) % DCNN_QUEUE_MAX;
+		q->count -= n;
+		q->inflight = 0;
+		pthread_cond_broadcast(&q->done);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
+
+static struct dcnn_queue *
+dcnn_queue_init(struct uct_prior *p)
+{
+	struct dcnn_queue *q = calloc2(1, sizeof(*q));
+	q->p = p;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->more, NULL);
+	pthread_cond_init(&q->done, NULL);
+	pthread_create(&q->thread, NULL, dcnn_queue_worker, q);
+	return q;
+}
+
+static void
+dcnn_queue_flush(struct dcnn_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	/* Drop the requests not taken yet... */
+	for (int i = q->inflight; i < q->count; i++)
+		dcnn_request_done(&q->req[(q->head + i) % DCNN_QUEUE_MAX]);
+	q->count = q->inflight;
+	/* ...and wait for the batch being evaluated, whose nodes
+	 * must not go away before it is applied. */
+	while (q->inflight)
+		pthread_cond_wait(&q->done, &q->lock);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static void
+dcnn_queue_done(struct dcnn_queue *q)
+{
+	dcnn_queue_flush(q);
+	pthread_mutex_lock(&q->lock);
+	q->quit = true;
+	pthread_cond_signal(&q->more);
+	pthread_mutex_unlock(&q->lock);
+	pthread_join(q->thread, NULL);
+	free(q);
+}
+
+void
+uct_prior_queue(struct uct *u, struct tree *t, struct tree_node *node,
+		struct board *b, enum stone color, int parity)
+{
+	struct dcnn_queue *q = u->prior->dcnnq;
+	if (!q || !node->parent || node->depth - t->root->depth > u->prior->dcnn_depth)
+		return;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->count == DCNN_QUEUE_MAX) {
+		/* The evaluator cannot keep up, do without. */
+		pthread_mutex_unlock(&q->lock);
+		return;
+	}
+	struct dcnn_request *r = &q->req[(q->head + q->count) % DCNN_QUEUE_MAX];
+	r->node = node;
+	board_copy(&r->b, b);
+	r->color = color;
+	r->parity = parity;
+	r->vloss = u->virtual_loss;
+	if (r->vloss)
+		__sync_fetch_and_add(&node->descents, r->vloss);
+	q->count++;
+	pthread_cond_signal(&q->more);
+	pthread_mutex_unlock(&q->lock);
+}
+
+void
+uct_prior_flush(struct uct *u)
+{
+	if (u->prior->dcnnq)
+		dcnn_queue_flush(u->prior->dcnnq);
+}
+
 #else
 #define uct_prior_dcnn(u, node, map)  
+
+void
+uct_prior_queue(struct uct *u, struct tree *t, struct tree_node *node,
+		struct board *b, enum stone color, int parity)
+{
+}
+
+void
+uct_prior_flush(struct uct *u)
+{
+}
 #endif /* DCNN */
 
 
@@ -264,6 +455,7 @@ uct_prior_init(char *arg, struct board *b, struct uct *u)
 	 * against regular pachi. Below 1200 is bad (50% winrate and worse), more
 	 * gives diminishing returns (1500 -> 78%, 2000 -> 70% ...) */
 	p->dcnn_eqex    = 1300;
+	p->dcnn_batch   = 8;
 	p->joseki_eqex = -200;
 	p->cfgdn = -1;
 
@@ -334,6 +526,14 @@ uct_prior_init(char *arg, struct board *b, struct uct *u)
 #ifdef DCNN
 			} else if (!strcasecmp(optname, "dcnn") && optval) {
 				p->dcnn_eqex = atoi(optval);
+			} else if (!strcasecmp(optname, "dcnn_depth") && optval) {
+				/* Also use dcnn for nodes up to this depth
+				 * below the root (asynchronously). */
+				p->dcnn_depth = atoi(optval);
+			} else if (!strcasecmp(optname, "dcnn_batch") && optval) {
+				/* Maximum number of positions evaluated
+				 * together by asynchronous dcnn priors. */
+				p->dcnn_batch = atoi(optval);
 #endif
 			} else {
 				fprintf(stderr, "uct: Invalid prior argument %s or missing value\n", optname);
@@ -354,6 +554,10 @@ uct_prior_init(char *arg, struct board *b, struct uct *u)
 
 	if (!using_dcnn(b))
 		p->dcnn_eqex = 0;
+#ifdef DCNN
+	if (p->dcnn_eqex && p->dcnn_depth > 0 && p->dcnn_batch > 0)
+		p->dcnnq = dcnn_queue_init(p);
+#endif
 	
 	if (p->cfgdn < 0) {
 		static int large_bonuses[] = { 0, 55, 50, 15 };
@@ -376,6 +580,10 @@ uct_prior_init(char *arg, struct board *b, struct uct *u)
 void
 uct_prior_done(struct uct_prior *p)
 {
+#ifdef DCNN
+	if (p->dcnnq)
+		dcnn_queue_done(p->dcnnq);
+#endif
 	assert(p->cfgd_eqex);
 	free(p->cfgd_eqex);
 	free(p);
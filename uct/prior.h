@@ -28,6 +28,11 @@ struct prior_map {
 static void add_prior_value(struct prior_map *map, coord_t c, floating_t value, int playouts);
 
 void uct_prior(struct uct *u, struct tree_node *node, struct prior_map *map);
+/* Queue the expanded node for asynchronous priors, if enabled. */
+void uct_prior_queue(struct uct *u, struct tree *t, struct tree_node *node, struct board *b, enum stone color, int parity);
+/* Wait for or drop pending asynchronous priors; must be called before
+ * nodes may be moved or freed. */
+void uct_prior_flush(struct uct *u);
 
 struct uct_prior;
 struct uct_prior *uct_prior_init(char *arg, struct board *b, struct uct *u);
@@ -2,11 +2,14 @@
 #include <limits.h>
 #include <math.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #define DEBUG
 
@@ -17,6 +20,7 @@
 #include "timeinfo.h"
 #include "uct/dynkomi.h"
 #include "uct/internal.h"
+#include "uct/prior.h"
 #include "uct/search.h"
 #include "uct/tree.h"
 #include "uct/uct.h"
@@ -60,13 +64,15 @@ static const struct time_info unlimited_ti = {
  *   |         starts and stops the search managed by thread_manager
  *   |
  * thread_manager
- *   |         spawns and collects worker threads
+ *   |         wakes up and collects worker threads
  *   |
  * worker0
  * worker1
  * ...
  * workerK
- *             uct_playouts() loop, doing descend-playout until uct_halt
+ *             uct_playouts() loop, doing descend-playout until uct_halt;
+ *             workers are spawned on the first search and then parked
+ *             between searches
  *
  * Another way to look at it is by functions (lines denote thread boundaries):
  *
@@ -75,7 +81,7 @@ static const struct time_info unlimited_ti = {
  * | -----------------------
  * | spawn_thread_manager()
  * | -----------------------
- * | spawn_worker()
+ * | spawn_worker()          (run_worker() for each search)
  * V uct_playouts() */
 
 /* Set in thread manager in case the workers should stop. */
@@ -89,21 +95,134 @@ static pthread_cond_t finish_cond = PTHREAD_COND_INITIALIZER;
 static volatile int finish_thread;
 static pthread_mutex_t finish_serializer = PTHREAD_MUTEX_INITIALIZER;
 
-static void *
-spawn_worker(void *ctx_)
+static struct uct_thread_ctx *finish_ctx;
+
+/* Worker threads are created on the first search and then parked
+ * between searches, waiting for a new ctx in their slot. */
+static struct uct_worker {
+	pthread_t thread;
+	struct uct_thread_ctx *ctx; // search to run, NULL if none
+} *workers;
+static int workers_n;
+static pthread_mutex_t workers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workers_cond = PTHREAD_COND_INITIALIZER;
+
+static void
+run_worker(struct uct_thread_ctx *ctx)
 {
-	struct uct_thread_ctx *ctx = ctx_;
 	/* Setup */
-	fast_srandom(ctx->seed);
+	fast_srandom_stream(ctx->seed, ctx->tid);
 	/* Run */
 	ctx->games = uct_playouts(ctx->u, ctx->b, ctx->color, ctx->t, ctx->ti);
 	/* Finish */
 	pthread_mutex_lock(&finish_serializer);
 	pthread_mutex_lock(&finish_mutex);
 	finish_thread = ctx->tid;
+	finish_ctx = ctx;
 	pthread_cond_signal(&finish_cond);
 	pthread_mutex_unlock(&finish_mutex);
-	return ctx;
+}
+
+static void *
+spawn_worker(void *tid_)
+{
+	int tid = (intptr_t) tid_;
+	pthread_mutex_lock(&workers_mutex);
+	while (true) {
+		struct uct_thread_ctx *ctx;
+		while (!(ctx = workers[tid].ctx))
+			pthread_cond_wait(&workers_cond, &workers_mutex);
+		workers[tid].ctx = NULL;
+		pthread_mutex_unlock(&workers_mutex);
+		run_worker(ctx);
+		pthread_mutex_lock(&workers_mutex);
+	}
+	return NULL;
+}
+
+#ifdef __linux__
+/* List the online cpus grouped by NUMA node, so that consecutive
+ * workers share a node (and its memory) as long as possible. */
+static int
+cpus_by_node(int *cpus, int max)
+{
+	int n = 0;
+	for (int node = 0; n < max; node++) {
+		char path[64];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		FILE *f = fopen(path, "r");
+		if (!f)
+			break;
+		/* Format is like 0-7,16-23 */
+		int a, b, c;
+		while (fscanf(f, "%d", &a) == 1) {
+			b = a;
+			c = fgetc(f);
+			if (c == '-' && fscanf(f, "%d", &b) == 1)
+				c = fgetc(f);
+			for (int i = a; i <= b && n < max; i++)
+				cpus[n++] = i;
+			if (c != ',')
+				break;
+		}
+		fclose(f);
+	}
+	if (!n) { // No NUMA information.
+		int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		for (; n < ncpus && n < max; n++)
+			cpus[n] = n;
+	}
+	return n;
+}
+
+static void
+pin_worker(struct uct *u, pthread_t thread, int tid)
+{
+	static int cpus[CPU_SETSIZE];
+	static int ncpus;
+	if (!ncpus)
+		ncpus = cpus_by_node(cpus, CPU_SETSIZE);
+	if (!ncpus)
+		return;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpus[tid % ncpus], &set);
+	if (pthread_setaffinity_np(thread, sizeof(set), &set) && UDEBUGL(2))
+		fprintf(stderr, "Cannot pin worker %d to cpu %d\n", tid, cpus[tid % ncpus]);
+}
+#else
+static void
+pin_worker(struct uct *u, pthread_t thread, int tid)
+{
+}
+#endif
+
+/* Make sure we have at least n parked workers. */
+static void
+spawn_workers(struct uct *u, int n)
+{
+	if (n <= workers_n)
+		return;
+	pthread_mutex_lock(&workers_mutex);
+	workers = realloc(workers, n * sizeof(*workers));
+	if (!workers) {
+		fprintf(stderr, "spawn_workers(): OUT OF MEMORY\n");
+		exit(1);
+	}
+	for (int tid = workers_n; tid < n; tid++) {
+		workers[tid].ctx = NULL;
+		pthread_attr_t a;
+		pthread_attr_init(&a);
+		pthread_attr_setstacksize(&a, 1048576);
+		pthread_create(&workers[tid].thread, &a, spawn_worker, (void *) (intptr_t) tid);
+		pthread_attr_destroy(&a);
+		if (u->pin_threads)
+			pin_worker(u, workers[tid].thread, tid);
+		if (UDEBUGL(4))
+			fprintf(stderr, "Spawned worker %d\n", tid);
+	}
+	workers_n = n;
+	pthread_mutex_unlock(&workers_mutex);
 }
 
 /* Thread manager, controlling worker threads. It must be called with
@@ -124,30 +243,34 @@ spawn_thread_manager(void *ctx_)
 	fast_srandom(mctx->seed);
 
 	int played_games = 0;
-	pthread_t threads[u->threads];
 	int joined = 0;
 
 	uct_halt = 0;
 
 	/* Garbage collect the tree by preference when pondering. */
-	if (u->pondering && t->nodes && t->nodes_size >= t->pruning_threshold) {
-		t->root = tree_garbage_collect(t, t->root);
+	if (u->pondering && t->nodes) {
+		tree_gc_finish(t);
+		if (t->gc_pending || t->nodes_size >= t->pruning_threshold) {
+			t->gc_pending = false;
+			t->root = tree_garbage_collect(t, t->root);
+		}
 	}
 
-	/* Spawn threads... */
+	/* Wake up threads... */
+	spawn_workers(u, u->threads);
+	/* All workers share the seed but get independent streams. */
+	unsigned long seed = fast_random64();
+	pthread_mutex_lock(&workers_mutex);
 	for (int ti = 0; ti < u->threads; ti++) {
 		struct uct_thread_ctx *ctx = malloc2(sizeof(*ctx));
 		ctx->u = u; ctx->b = mctx->b; ctx->color = mctx->color;
 		mctx->t = ctx->t = t;
-		ctx->tid = ti; ctx->seed = fast_random(65536) + ti;
+		ctx->tid = ti; ctx->seed = seed;
 		ctx->ti = mctx->ti;
-		pthread_attr_t a;
-		pthread_attr_init(&a);
-		pthread_attr_setstacksize(&a, 1048576);
-		pthread_create(&threads[ti], &a, spawn_worker, ctx);
-		if (UDEBUGL(4))
-			fprintf(stderr, "Spawned worker %d\n", ti);
+		workers[ti].ctx = ctx;
 	}
+	pthread_cond_broadcast(&workers_cond);
+	pthread_mutex_unlock(&workers_mutex);
 
 	/* ...and collect them back: */
 	while (joined < u->threads) {
@@ -165,18 +288,20 @@ spawn_thread_manager(void *ctx_)
 			continue;
 		}
 		/* ...and gather its remnants. */
-		struct uct_thread_ctx *ctx;
-		pthread_join(threads[finish_thread], (void **) &ctx);
+		struct uct_thread_ctx *ctx = finish_ctx;
 		played_games += ctx->games;
 		joined++;
 		free(ctx);
 		if (UDEBUGL(4))
-			fprintf(stderr, "Joined worker %d\n", finish_thread);
+			fprintf(stderr, "Parked worker %d\n", finish_thread);
 		pthread_mutex_unlock(&finish_serializer);
 	}
 
 	pthread_mutex_unlock(&finish_mutex);
 
+	/* Asynchronous priors must not outlive the search. */
+	uct_prior_flush(u);
+
 	mctx->games = played_games;
 	return mctx;
 }
@@ -198,6 +323,15 @@ uct_search_start(struct uct *u, struct board *b, enum stone color,
 		 struct tree *t, struct time_info *ti,
 		 struct uct_search_state *s)
 {
+	/* Never wait for the background garbage collection: use it if
+	 * it is complete, otherwise abandon it and search the old tree.
+	 * When pondering, leave it to the thread manager which may block. */
+	if (!u->pondering)
+		tree_gc_stop(t);
+
+	/* The search threads all start from copies of b. */
+	board_spathash_sync(b);
+
 	/* Set up search state. */
 	s->base_playouts = s->last_dynkomi = s->last_print = t->root->u.playouts;
 	s->print_interval = u->reportfreq * u->threads;
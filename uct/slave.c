@@ -4,15 +4,17 @@
  * master. When receiving stats the hash table gives a pointer to the
  * tree node to update. When sending stats we remember in the tree
  * what was previously sent so that only the incremental part has to
- * be sent.  The incremental part is smaller and can be compressed.
- * The compression is not yet done in this version. */
+ * be sent.  The incremental part is smaller and is sent in the
+ * compact format if the master supports it. */
 
 /* Similarly the master only sends stats increments.
  * They include only contributions from other slaves. */
 
 /* The keys for the hash table are coordinate paths from
  * a root child to a given node. See distributed/distributed.h
- * for the encoding of a path to a 64 bit integer. */
+ * for the encoding of a path to a 64 bit integer. Deep paths
+ * cannot be decoded, so the nodes we track for sending are
+ * also entered in the hash table. */
 
 /* To allow the master to select the best move, slaves also send
  * absolute playout counts for the best top level nodes (children
@@ -45,6 +47,7 @@
 #include "uct/search.h"
 #include "uct/slave.h"
 #include "uct/tree.h"
+#include "distributed/shm.h"
 
 
 /* UCT infrastructure for a distributed engine slave. */
@@ -59,11 +62,28 @@ static long node_not_found = 0;
 struct tree_hash {
 	path_t coord_path;
 	struct tree_node *node;
+	bool tracked; // node is in the tracked list
 };
 
+/* Nodes considered for sending in the current move, root first.
+ * scanned is the node playouts when we last looked for new
+ * children to track. */
+struct tracked_node {
+	path_t coord_path;
+	struct tree_node *node;
+	int level;
+	int scanned;
+};
+static struct tracked_node *tracked = NULL;
+static int tracked_count = 0;
+static int max_tracked = 0;
+/* Root of the tracked nodes, NULL after a hash table reset. */
+static struct tree_node *tracked_root = NULL;
+
 void *
 uct_htable_alloc(int hbits)
 {
+	tracked_root = NULL;
 	return calloc2(1 << hbits, sizeof(struct tree_hash));
 }
 
@@ -73,6 +93,7 @@ void uct_htable_reset(struct tree *t)
 	if (!t->htable) return;
 	double start = time_now();
 	memset(t->htable, 0, (1 << t->hbits) * sizeof(t->htable[0]));
+	tracked_root = NULL;
 	if (DEBUGL(3))
 		fprintf(stderr, "tree occupied %ld %.1f%% inserts %ld collisions %ld/%ld %.1f%% clear %.3fms\n"
 			"parent_not_found %.1f%% parent_leaf %.1f%% node_not_found %.1f%%\n",
@@ -84,6 +105,8 @@ void uct_htable_reset(struct tree *t)
 			parent_leaf * 100.0 / (h_counts.lookups + 1),
 			node_not_found * 100.0 / (h_counts.lookups + 1));
 	if (DEBUG_MODE) h_counts.occupied = 0;
+	if (DEBUGL(3))
+		fprintf(stderr, "tracked %d/%d nodes\n", tracked_count, max_tracked);
 }
 
 /* Find a node given its coord path from root. Insert it in the
@@ -113,6 +136,12 @@ tree_find_node(struct tree *t, struct incr_stats *is, struct tree_node *prev)
 
 	if (found) return hnode->node;
 
+	/* We know only the deep nodes we have tracked ourselves. */
+	if (is_deep_path(path)) {
+		if (DEBUG_MODE) node_not_found++;
+		return NULL;
+	}
+
 	/* The master sends parents before children so the parent should
 	 * already be in the hash table. */
 	path_t parent_p = parent_path(path, t->board);
@@ -201,52 +230,97 @@ uct_notify(struct engine *e, struct board *b, int id, char *cmd, char *args, cha
 }
 
 
+/* Update the tree with one node of the stats sent by the master. */
+static inline struct tree_node *
+receive_node(struct tree *t, struct incr_stats *is, struct tree_node *prev)
+{
+	struct tree_node *node = tree_find_node(t, is, prev);
+	if (!node) return prev;
+
+	/* node_total += others_incr */
+	stats_add_result(&node->u, is->incr.value, is->incr.playouts);
+
+	/* last_total += others_incr */
+	stats_add_result(&node->pu, is->incr.value, is->incr.playouts);
+
+	return node;
+}
+
 /* Read the move stats sent by the master, as a binary array of
- * incr_stats structs. The stats come sorted by increasing coord path.
+ * incr_stats structs or in the compact format (see distributed.h).
+ * The stats come sorted by increasing coord path. They are read from
+ * shm_buf in the master's shared memory if not NULL, else from stdin.
  * To simplify the code, we assume that master and slave have the same
  * architecture (store values identically).
  * Keep this code in sync with distributed/merge.c:output_stats()
  * Return true if ok, false if error. */
 static bool
-receive_stats(struct uct *u, int size)
+receive_stats(struct uct *u, int size, int format, void *shm_buf)
 {
-	if (size % sizeof(struct incr_stats)) return false;
-	int nodes = size / sizeof(struct incr_stats);
-	if (nodes > (1 << u->stats_hbits)) return false;
-
 	struct tree *t = u->t;
-	assert(nodes && t->htable);
+	assert(t->htable);
 	struct tree_node *prev = NULL;
 	double start_time = time_now();
+	int nodes = 0;
+
+	if (format == STATS_COMPACT) {
+		static unsigned char *buf_ = NULL;
+		static int buf_size = 0;
+		unsigned char *buf = shm_buf;
+		if (!buf) {
+			if (size > buf_size) {
+				free(buf_);
+				buf_ = malloc2(size);
+				buf_size = size;
+			}
+			buf = buf_;
+			if (fread(buf, 1, size, stdin) != (size_t)size)
+				return false;
+		}
 
-	for (int n = 0; n < nodes; n++) {
-		struct incr_stats is;
-		if (fread(&is, sizeof(struct incr_stats), 1, stdin) != 1)
-			return false;
-
-		if (UDEBUGL(7))
-			fprintf(stderr, "read %5d/%d %6d %.3f %"PRIpath" %s\n", n, nodes,
-				is.incr.playouts, is.incr.value, is.coord_path,
-				path2sstr(is.coord_path, t->board));
-
-		struct tree_node *node = tree_find_node(t, &is, prev);
-		if (!node) continue;
-
-		/* node_total += others_incr */
-		stats_add_result(&node->u, is.incr.value, is.incr.playouts);
+		struct stats_reader r;
+		stats_reader_init(&r, buf, size);
+		if (r.nodes > (1 << u->stats_hbits)) return false;
 
-		/* last_total += others_incr */
-		stats_add_result(&node->pu, is.incr.value, is.incr.playouts);
+		struct incr_stats is;
+		while (stats_read(&r, &is)) {
+			if (UDEBUGL(7))
+				fprintf(stderr, "read %5d %6d %.3f %"PRIpath" %s\n", nodes,
+					is.incr.playouts, is.incr.value, is.coord_path,
+					path2sstr(is.coord_path, t->board));
+			prev = receive_node(t, &is, prev);
+			nodes++;
+		}
+		if (r.p != r.end) return false;
 
-		prev = node;
+	} else {
+		if (size % sizeof(struct incr_stats)) return false;
+		nodes = size / sizeof(struct incr_stats);
+		if (nodes > (1 << u->stats_hbits)) return false;
+		assert(nodes);
+
+		for (int n = 0; n < nodes; n++) {
+			struct incr_stats is;
+			if (shm_buf)
+				is = ((struct incr_stats *)shm_buf)[n];
+			else if (fread(&is, sizeof(struct incr_stats), 1, stdin) != 1)
+				return false;
+
+			if (UDEBUGL(7))
+				fprintf(stderr, "read %5d/%d %6d %.3f %"PRIpath" %s\n", n, nodes,
+					is.incr.playouts, is.incr.value, is.coord_path,
+					path2sstr(is.coord_path, t->board));
+
+			prev = receive_node(t, &is, prev);
+		}
 	}
 	if (DEBUGVV(2))
-		fprintf(stderr, "read args for %d nodes in %.4fms\n", nodes,
+		fprintf(stderr, "read args for %d nodes %d bytes in %.4fms\n", nodes, size,
 			(time_now() - start_time)*1000);
 	return true;
 }
 
-/* A tree traversal fills this array, then the nodes with most increments are sent. */
+/* The tracked nodes fill this array, then the nodes with most increments are sent. */
 struct stats_candidate {
 	path_t coord_path;
 	int playout_incr;
@@ -261,14 +335,13 @@ struct stats_candidate {
 #define MAX_BUCKETS 1024
 static int bucket_count[MAX_BUCKETS];
 
-/* Traverse the tree rooted at node, and append incremental stats
- * for children to stats_queue. start_path is the coordinate path
- * for the top node. Stats for a node are only appended if enough playouts
- * have been made since the last send, and the level is not too deep.
- * Return the updated stats count. */
-static int
-append_stats(struct stats_candidate *stats_queue, struct tree_node *node, int stats_count,
-	     int max_count, path_t start_path, path_t max_path, int min_increment, struct board *b)
+/* Add to the tracked list the children of node with at least
+ * min_increment playouts since the last send. The path of node
+ * is given, its children are at the given level. They are also
+ * entered in the hash table since deep paths cannot be decoded. */
+static void
+track_children(struct tree *t, struct tree_node *node, path_t path,
+	       int level, int min_increment)
 {
 	/* The children field is set only after all children are created
 	 * so we can traverse the the tree while it is updated. */
@@ -276,29 +349,105 @@ append_stats(struct stats_candidate *stats_queue, struct tree_node *node, int st
 
 		if (is_pass(node_coord(ni))) continue;
 		if (ni->hints & TREE_HINT_INVALID) continue;
+		if (ni->u.playouts - ni->pu.playouts < min_increment) continue;
 
-		int incr = ni->u.playouts - ni->pu.playouts;
-		if (incr < min_increment) continue;
+		path_t child_path = append_child(path, node_coord(ni), t->board);
+		int hash;
+		bool found;
+		find_hash(hash, t->htable, t->hbits, child_path, found, h_counts);
+		struct tree_hash *hnode = &t->htable[hash];
+		if (found && hnode->tracked) continue;
 
 		/* min_increment should be tuned to avoid overflow. */
+		if (tracked_count >= max_tracked) {
+			if (DEBUGL(0))
+				fprintf(stderr, "*** tracked overflow %d nodes\n", tracked_count);
+			return;
+		}
+		if (!found && DEBUG_MODE) h_counts.inserts++, h_counts.occupied++;
+		hnode->coord_path = child_path;
+		hnode->node = ni;
+		hnode->tracked = true;
+
+		struct tracked_node *tn = &tracked[tracked_count++];
+		tn->coord_path = child_path;
+		tn->node = ni;
+		tn->level = level;
+		tn->scanned = 0;
+	}
+}
+
+/* Drop the tracked nodes with less than min_increment playouts
+ * since the last send to make room for new ones. They can be
+ * tracked again from their parent. */
+static void
+compact_tracked(struct tree *t, int min_increment)
+{
+	int count = 1; // keep the root
+	for (int i = 1; i < tracked_count; i++) {
+		struct tree_node *node = tracked[i].node;
+		if (node->u.playouts - node->pu.playouts >= min_increment) {
+			tracked[count++] = tracked[i];
+			continue;
+		}
+		int hash;
+		bool found;
+		find_hash(hash, t->htable, t->hbits, tracked[i].coord_path, found, h_counts);
+		if (found) t->htable[hash].tracked = false;
+	}
+	tracked_count = count;
+}
+
+/* Append to stats_queue the tracked nodes with at least min_increment
+ * playouts since the last send. The tree is not traversed from the
+ * root: children of a tracked node are only looked at again once it
+ * has min_increment more playouts, and only if its level is less than
+ * shared_levels. So the cost depends on the active part of the tree,
+ * not on its size or on shared_levels.
+ * Return the stats count. */
+static int
+append_stats(struct uct *u, struct stats_candidate *stats_queue, int max_count,
+	     int min_increment)
+{
+	struct tree *t = u->t;
+
+	/* Paths are relative to the root. */
+	if (t->root != tracked_root) {
+		if (tracked_root) uct_htable_reset(t);
+		tracked_root = t->root;
+		tracked[0] = (struct tracked_node){ .node = t->root };
+		tracked_count = 1;
+	}
+	if (tracked_count > max_tracked / 2)
+		compact_tracked(t, min_increment);
+
+	int stats_count = 0;
+	/* New children are appended to the list and checked in the same pass. */
+	for (int i = 0; i < tracked_count; i++) {
+		struct tracked_node *tn = &tracked[i];
+		struct tree_node *node = tn->node;
+		if (node->hints & TREE_HINT_INVALID) continue;
+
+		if (tn->level < u->shared_levels
+		    && node->u.playouts - tn->scanned >= min_increment) {
+			tn->scanned = node->u.playouts;
+			track_children(t, node, tn->coord_path, tn->level + 1, min_increment);
+		}
+
+		int incr = node->u.playouts - node->pu.playouts;
+		if (!tn->level || incr < min_increment) continue;
+
 		if (stats_count >= max_count) {
 			if (DEBUGL(0))
 				fprintf(stderr, "*** stats overflow %d nodes\n", stats_count);
-			return stats_count;
+			break;
 		}
-		path_t child_path = append_child(start_path, node_coord(ni), b);
 		stats_queue[stats_count].playout_incr = incr;
-		stats_queue[stats_count].coord_path = child_path;
-		stats_queue[stats_count++].node = ni;
+		stats_queue[stats_count].coord_path = tn->coord_path;
+		stats_queue[stats_count++].node = node;
 
 		if (incr >= MAX_BUCKETS) incr = MAX_BUCKETS - 1;
 		bucket_count[incr]++;
-
-		/* Do not recurse if level deep enough. */
-		if (child_path >= max_path) continue;
-
-		stats_count = append_stats(stats_queue, ni, stats_count, max_count,
-					   child_path, max_path, min_increment, b);
 	}
 	return stats_count;
 }
@@ -366,17 +515,17 @@ select_best_stats(struct stats_candidate *stats_queue, int stats_count,
 
 /* Get incremental stats updates for the distributed engine.
  * Return a binary array of incr_stats structs in coordinate order
- * (increasing levels and increasing coordinates within a level).
+ * (increasing levels and increasing coordinates within a level),
+ * encoded in the given format, in shm_buf if not NULL.
  * This function is called only by the main thread, but may be
  * called while the tree is updated by the worker threads. Keep this
  * code in sync with distributed/merge.c:merge_new_stats(). */
 static void *
-report_incr_stats(struct uct *u, int *stats_size)
+report_incr_stats(struct uct *u, int *stats_size, int format, void *shm_buf)
 {
 	double start_time = time_now();
 
 	struct tree_node *root = u->t->root;
-	struct board *b = u->t->board;
 
 	/* The factor 3 below has experimentally been found to be
 	 * sufficient. At worst if we fill stats_queue we will
@@ -385,11 +534,19 @@ report_incr_stats(struct uct *u, int *stats_size)
 	static struct stats_candidate *stats_queue = NULL;
 	if (!stats_queue) stats_queue = malloc2(max_nodes * sizeof(*stats_queue));
 
+	/* Leave the hash table at most 1/4 full for the received nodes. */
+	if (!tracked) {
+		max_tracked = 4 * u->shared_nodes;
+		if (max_tracked > 1 << (u->t->hbits - 2))
+			max_tracked = 1 << (u->t->hbits - 2);
+		tracked = malloc2(max_tracked * sizeof(*tracked));
+	}
+
 	memset(bucket_count, 0, sizeof(bucket_count));
 
 	/* Try to fill the output buffer with the most important
-         * nodes (highest increments), while still traversing
-	 * as little of the tree as possible. If we set min_increment
+	 * nodes (highest increments), while still looking at
+	 * as few nodes as possible. If we set min_increment
 	 * too low we waste time. If we set it too high we can't
 	 * fill the output buffer with the desired number of nodes.
 	 * The best min_increment results in stats_count just above 
@@ -404,23 +561,36 @@ report_incr_stats(struct uct *u, int *stats_size)
 		min_increment--;
 	}
 
-	stats_count = append_stats(stats_queue, root, 0, max_nodes, 0,
-				   max_parent_path(u, b), min_increment, b);
+	stats_count = append_stats(u, stats_queue, max_nodes, min_increment);
 
 	void *buf = select_best_stats(stats_queue, stats_count, u->shared_nodes, stats_size);
+	int nodes = *stats_size / sizeof(struct incr_stats);
+
+	if (format == STATS_COMPACT) {
+		/* The compact encoding is never larger, see distributed.h */
+		static void *compact_buf = NULL;
+		if (!compact_buf)
+			compact_buf = malloc2((u->shared_nodes + 1) * sizeof(struct incr_stats));
+		void *out = shm_buf ? shm_buf : compact_buf;
+		*stats_size = stats_encode(buf, nodes, out);
+		buf = out;
+	} else if (shm_buf) {
+		memcpy(shm_buf, buf, *stats_size);
+		buf = shm_buf;
+	}
 
 	if (DEBUGVV(2))
 		fprintf(stderr,
-			"min_incr %d games %d stats_queue %d/%d sending %d/%d in %.3fms\n",
-			min_increment, root->u.playouts - root->pu.playouts, stats_count,
-			max_nodes, *stats_size / (int)sizeof(struct incr_stats), u->shared_nodes,
+			"min_incr %d games %d tracked %d stats_queue %d/%d sending %d/%d (%d bytes) in %.3fms\n",
+			min_increment, root->u.playouts - root->pu.playouts, tracked_count,
+			stats_count, max_nodes, nodes, u->shared_nodes, *stats_size,
 			(time_now() - start_time)*1000);
 	root->pu = root->u;
 	return buf;
 }
 
 /* Get stats for the distributed engine. Return a buffer with one
- * line "played_own root_playouts threads keep_looking @size", then
+ * line "played_own root_playouts threads keep_looking @size[:format]", then
  * a list of lines "coord playouts value" with absolute counts for
  * children of the root node (including contributions from other
  * slaves). The last line must not end with \n.
@@ -430,7 +600,7 @@ report_incr_stats(struct uct *u, int *stats_size)
  * code in sync with distributed/distributed.c:select_best_move(). */
 static char *
 report_stats(struct uct *u, struct board *b, coord_t c,
-	     bool keep_looking, int bin_size)
+	     bool keep_looking, int bin_size, int bin_format)
 {
 	static char reply[10240];
 	char *r = reply;
@@ -438,6 +608,9 @@ report_stats(struct uct *u, struct board *b, coord_t c,
 	struct tree_node *root = u->t->root;
 	r += snprintf(r, end - r, "%d %d %d %d @%d", u->played_own, root->u.playouts,
 		      u->threads, keep_looking, bin_size);
+	/* Old masters do not know about formats. */
+	if (bin_format != STATS_RAW)
+		r += snprintf(r, end - r, ":%d", bin_format);
 	int min_playouts = root->u.playouts / 100;
 	if (min_playouts < GJ_MINGAMES)
 		min_playouts = GJ_MINGAMES;
@@ -480,9 +653,13 @@ report_stats(struct uct *u, struct board *b, coord_t c,
  * returns. It is stopped by receiving a play GTP command, triggering
  * uct_pondering_stop(). */
 /* genmoves gets in the args parameter
- * "played_games nodes main_time byoyomi_time byoyomi_periods byoyomi_stones @size"
+ * "played_games nodes main_time byoyomi_time byoyomi_periods byoyomi_stones @size[:format:max]"
  * and reads a binary array of coord, playouts, value to get stats of other slaves,
- * except possibly for the first call at a given move number.
+ * except possibly for the first call at a given move number. The array is
+ * in the given format; we reply in the best format <= max that we know.
+ * If we use shared memory and the master gives "@size:format:max:slot:index"
+ * we read and write the stats in its shared ring instead of the socket,
+ * and tell it with STATS_SHM in the reply format (see distributed/shm.c).
  * See report_stats() for the description of the return value. */
 char *
 uct_genmoves(struct engine *e, struct board *b, struct time_info *ti, enum stone color,
@@ -519,14 +696,19 @@ uct_genmoves(struct engine *e, struct board *b, struct time_info *ti, enum stone
 
 	/* Read binary incremental stats if present, otherwise
 	 * wait a bit to populate the statistics. */
-	int size = 0;
+	int size = 0, format = STATS_RAW, master_format = STATS_RAW, slot = -1, index = -1;
 	char *sizep = strchr(args, '@');
-	if (sizep) size = atoi(sizep+1);
+	if (sizep) sscanf(sizep, "@%d:%d:%d:%d:%d", &size, &format, &master_format, &slot, &index);
+	void *shm_buf = shm_ring_buffer(slot, index, u->shared_nodes * sizeof(struct incr_stats));
+	if ((format & STATS_SHM) && (!shm_buf || size > u->shared_nodes * (int)sizeof(struct incr_stats)))
+		return NULL;
 	if (!size) {
 		time_sleep(u->stats_delay);
-	} else if (!receive_stats(u, size)) {
+	} else if (!receive_stats(u, size, format & ~STATS_SHM,
+				  format & STATS_SHM ? shm_buf : NULL)) {
 		return NULL;
 	}
+	int reply_format = master_format < STATS_FORMAT_MAX ? master_format : STATS_FORMAT_MAX;
 
 	/* Check the state of the Monte Carlo Tree Search. */
 
@@ -546,9 +728,12 @@ uct_genmoves(struct engine *e, struct board *b, struct time_info *ti, enum stone
 		if (best_coord > 0) best_coord = 0; 
 
 		if (u->shared_levels) {
-			*stats_buf = report_incr_stats(u, stats_size);
+			*stats_buf = report_incr_stats(u, stats_size, reply_format, shm_buf);
 		}
 	}
-	char *reply = report_stats(u, b, best_coord, keep_looking, *stats_size);
+	char *reply = report_stats(u, b, best_coord, keep_looking, *stats_size,
+				   reply_format | (shm_buf ? STATS_SHM : 0));
+	/* Nothing more to send on the socket. */
+	if (shm_buf) *stats_size = 0;
 	return reply;
 }
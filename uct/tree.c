@@ -28,20 +28,95 @@ tree_alloc_node(struct tree *t, int count, bool fast_alloc)
 {
 	struct tree_node *n = NULL;
 	size_t nsize = count * sizeof(*n);
-	unsigned long old_size = __sync_fetch_and_add(&t->nodes_size, nsize);
 
 	if (fast_alloc) {
+		unsigned long old_size = __sync_fetch_and_add(&t->nodes_size, nsize);
 		if (old_size + nsize > t->max_tree_size)
 			return NULL;
 		assert(t->nodes != NULL);
 		n = (struct tree_node *)(t->nodes + old_size);
 		memset(n, 0, nsize);
 	} else {
+		/* With a nodes buffer, nodes_size is the offset of its free
+		 * space; the local trees are allocated outside of it. */
+		if (!t->nodes)
+			__sync_fetch_and_add(&t->nodes_size, nsize);
 		n = calloc2(count, sizeof(*n));
 	}
 	return n;
 }
 
+/* Account for freeing count nodes allocated by tree_alloc_node()
+ * without fast_alloc, see there. Returns the remaining size. */
+static unsigned long
+tree_free_size(struct tree *t, int count)
+{
+	size_t nsize = count * sizeof(struct tree_node);
+	if (t->nodes)
+		return t->nodes_size;
+	return __sync_sub_and_fetch(&t->nodes_size, nsize);
+}
+
+/* In fast_alloc mode, each thread carves its own chunk out of the nodes
+ * buffer and allocates expanded children from it, so that the shared
+ * nodes_size counter is bumped only once per chunk instead of once per
+ * expansion. nodes_size then counts whole chunks handed out and
+ * overestimates the tree size by at most one chunk per thread. */
+#define TREE_ARENA_CHUNK (256 * 1024)
+/* But never hand out more than this fraction of the buffer at once. */
+#define TREE_ARENA_SHARE 64
+
+#ifndef NO_THREAD_LOCAL
+static __thread struct tree_arena {
+	unsigned long gen; // t->arena_gen when the chunk was carved
+	char *next, *end;
+} arena;
+#endif
+
+static volatile unsigned long arena_gen;
+
+/* Allocate count nodes from the thread's arena, fast_alloc only.
+ * Returns NULL if not enough memory.
+ * This function may be called by multiple threads in parallel. */
+static struct tree_node *
+tree_arena_alloc(struct tree *t, int count)
+{
+#ifndef NO_THREAD_LOCAL
+	size_t nsize = count * sizeof(struct tree_node);
+	if (arena.gen != t->arena_gen || arena.next + nsize > arena.end) {
+		size_t chunk = t->max_tree_size / TREE_ARENA_SHARE;
+		if (chunk > TREE_ARENA_CHUNK)
+			chunk = TREE_ARENA_CHUNK;
+		if (nsize >= chunk)
+			return tree_alloc_node(t, count, true);
+		/* The rest of the previous chunk is lost until the next
+		 * garbage collection. */
+		unsigned long old_size = __sync_fetch_and_add(&t->nodes_size, chunk);
+		if (old_size + chunk > t->max_tree_size)
+			return NULL;
+		arena.gen = t->arena_gen;
+		arena.next = (char *)t->nodes + old_size;
+		arena.end = arena.next + chunk;
+	}
+	struct tree_node *n = (struct tree_node *)arena.next;
+	arena.next += nsize;
+	memset(n, 0, nsize);
+	return n;
+#else
+	return tree_alloc_node(t, count, true);
+#endif
+}
+
+/* Give back the unused tail of the last tree_arena_alloc() block. */
+static void
+tree_arena_trim(struct tree_node *end, struct tree_node *used_end)
+{
+#ifndef NO_THREAD_LOCAL
+	if (arena.next == (char *)end)
+		arena.next = (char *)used_end;
+#endif
+}
+
 /* Initialize a node at a given place in memory.
  * This function may be called by multiple threads in parallel. */
 static void
@@ -74,13 +149,14 @@ tree_init_node(struct tree *t, coord_t coord, int depth, bool fast_alloc)
 /* Create a tree structure. Pre-allocate all nodes if max_tree_size is > 0. */
 struct tree *
 tree_init(struct board *board, enum stone color, unsigned long max_tree_size,
-	  unsigned long max_pruned_size, unsigned long pruning_threshold, floating_t ltree_aging, int hbits)
+	  unsigned long max_pruned_size, unsigned long pruning_threshold, floating_t ltree_aging, int hbits, int tt_bits)
 {
 	struct tree *t = calloc2(1, sizeof(*t));
 	t->board = board;
 	t->max_tree_size = max_tree_size;
 	t->max_pruned_size = max_pruned_size;
 	t->pruning_threshold = pruning_threshold;
+	t->arena_gen = __sync_add_and_fetch(&arena_gen, 1);
 	if (max_tree_size != 0) {
 		t->nodes = malloc2(max_tree_size);
 		/* The nodes buffer doesn't need initialization. This is currently
@@ -98,26 +174,49 @@ tree_init(struct board *board, enum stone color, unsigned long max_tree_size,
 
 	t->hbits = hbits;
 	if (hbits) t->htable = uct_htable_alloc(hbits);
+	t->tt_bits = tt_bits;
+	if (tt_bits) t->tt = calloc2(1UL << tt_bits, sizeof(*t->tt));
 	return t;
 }
 
 
-/* This function may be called by multiple threads in parallel on the
- * same tree, but not on node n. n may be detached from the tree but
- * must have been created in this tree originally.
- * It returns the remaining size of the tree after n has been freed. */
-static unsigned long
-tree_done_node(struct tree *t, struct tree_node *n)
+/* Free the subtree of nodes below n, but not n itself.
+ * This function may be called by multiple threads in parallel on the
+ * same tree, but not on node n. */
+static void
+tree_done_children(struct tree *t, struct tree_node *n)
 {
+	if (n->nchildren) {
+		/* Search tree node, children in a single block. */
+		struct tree_node *children = n->children;
+		for (int i = 0; i < n->nchildren; i++)
+			tree_done_children(t, &children[i]);
+		free(children);
+		tree_free_size(t, n->nchildren);
+		return;
+	}
+	/* Local tree node, children allocated one by one. */
 	struct tree_node *ni = n->children;
 	while (ni) {
 		struct tree_node *nj = ni->sibling;
-		tree_done_node(t, ni);
+		tree_done_children(t, ni);
+		free(ni);
+		tree_free_size(t, 1);
 		ni = nj;
 	}
+}
+
+/* This function may be called by multiple threads in parallel on the
+ * same tree, but not on node n. n may be detached from the tree but
+ * must have been created in this tree originally, and it must not be
+ * part of a children block.
+ * It returns the remaining size of the tree after n has been freed. */
+static unsigned long
+tree_done_node(struct tree *t, struct tree_node *n)
+{
+	tree_done_children(t, n);
 	free(n);
-	unsigned long old_size = __sync_fetch_and_sub(&t->nodes_size, sizeof(*n));
-	return old_size - sizeof(*n);
+	return tree_free_size(t, 1);
 }
 
 struct subtree_ctx {
@@ -167,10 +266,12 @@ tree_done_node_detached(struct tree *t, struct tree_node *n)
 void
 tree_done(struct tree *t)
 {
+	tree_gc_stop(t);
 	tree_done_node(t, t->ltree_black);
 	tree_done_node(t, t->ltree_white);
 
 	if (t->htable) free(t->htable);
+	if (t->tt) free(t->tt);
 	if (t->nodes) {
 		free(t->nodes);
 		free(t);
@@ -288,8 +389,8 @@ tree_save(struct tree *tree, struct board *b, int thres)
 }
 
 
-void
-tree_node_load(FILE *f, struct tree_node *node, int *num)
+static void
+tree_node_load(FILE *f, struct tree *tree, struct tree_node *node, int *num)
 {
 	(*num)++;
 
@@ -307,16 +408,36 @@ tree_node_load(FILE *f, struct tree_node *node, int *num)
 	}
 	memcpy(&node->pu, &node->u, sizeof(node->u));
 
-	struct tree_node *ni = NULL, *ni_prev = NULL;
+	/* We do not know the number of children in advance, load them
+	 * first and move them into a single block afterwards. */
+	struct tree_node *children = calloc2(BOARD_MAX_MOVES + 1, sizeof(*children));
+	int nchildren = 0;
 	while (fgetc(f)) {
-		ni_prev = ni; ni = calloc2(1, sizeof(*ni));
-		if (!node->children)
-			node->children = ni;
-		else
-			ni_prev->sibling = ni;
+		assert(nchildren < BOARD_MAX_MOVES + 1);
+		tree_node_load(f, tree, &children[nchildren++], num);
+	}
+	if (!nchildren) {
+		free(children);
+		return;
+	}
+
+	struct tree_node *block = tree_alloc_node(tree, nchildren, tree->nodes);
+	if (!block) { // out of memory in fast_alloc mode, keep a leaf
+		free(children);
+		node->is_expanded = false;
+		return;
+	}
+	memcpy(block, children, nchildren * sizeof(*block));
+	for (int i = 0; i < nchildren; i++) {
+		struct tree_node *ni = &block[i];
 		ni->parent = node;
-		tree_node_load(f, ni, num);
+		ni->sibling = i + 1 < nchildren ? ni + 1 : NULL;
+		for (int j = 0; j < ni->nchildren; j++)
+			ni->children[j].parent = ni;
 	}
+	free(children);
+	node->nchildren = nchildren;
+	node->children = block;
 }
 
 void
@@ -331,58 +452,74 @@ tree_load(struct tree *tree, struct board *b)
 
 	int num = 0;
 	if (fgetc(f))
-		tree_node_load(f, tree->root, &num);
+		tree_node_load(f, tree, tree->root, &num);
 	fprintf(stderr, "Loaded %d nodes.\n", num);
 
 	fclose(f);
 }
 
 
-/* Copy the subtree rooted at node: all nodes at or below depth
- * or with at least threshold playouts. Only for fast_alloc.
- * The code is destructive on src. The relative order of children of
- * a given node is preserved (assumed by tree_get_node in particular).
- * Returns the copy of node in the destination tree, or NULL
- * if we could not copy it. */
-static struct tree_node *
-tree_prune(struct tree *dest, struct tree *src, struct tree_node *node,
-	   int threshold, int depth)
+/* Copy the children of node into dest below n2, which must be
+ * a copy of node in dest: all nodes at or below depth or with at least
+ * threshold playouts. Only for fast_alloc.
+ * The children of a given node are copied in a single block, in the
+ * same relative order (assumed by the distributed engine in particular). */
+static void
+tree_prune_children(struct tree *dest, struct tree_node *n2, struct tree_node *node,
+		    int threshold, int depth)
 {
-	assert(dest->nodes && node);
-	struct tree_node *n2 = tree_alloc_node(dest, 1, true);
-	if (!n2)
-		return NULL;
-	*n2 = *node;
-	if (n2->depth > dest->max_depth)
-		dest->max_depth = n2->depth;
+	n2->nchildren = 0;
 	n2->children = NULL;
 	n2->is_expanded = false;
 
 	if (node->depth >= depth && node->u.playouts < threshold)
-		return n2;
+		return;
+	if (dest->gc_cancel)
+		return; // background collection abandoned, see tree_gc_stop()
 	/* For deep nodes with many playouts, we must copy all children,
 	 * even those with zero playouts, because partially expanded
 	 * nodes are not supported. Considering them as fully expanded
 	 * would degrade the playing strength. The only exception is
 	 * when dest becomes full, but this should never happen in practice
 	 * if threshold is chosen to limit the number of nodes traversed. */
-	struct tree_node *ni = node->children;
-	if (!ni)
-		return n2;
-	struct tree_node **prev2 = &(n2->children);
-	while (ni) {
-		struct tree_node *ni2 = tree_prune(dest, src, ni, threshold, depth);
-		if (!ni2) break;
-		*prev2 = ni2;
-		prev2 = &(ni2->sibling);
+	int nchildren = node->nchildren;
+	if (!nchildren)
+		return;
+	struct tree_node *children2 = tree_alloc_node(dest, nchildren, true);
+	if (!children2)
+		return; // avoid partially expanded nodes
+	memcpy(children2, node->children, nchildren * sizeof(*children2));
+	for (int i = 0; i < nchildren; i++) {
+		struct tree_node *ni2 = &children2[i];
 		ni2->parent = n2;
-		ni = ni->sibling;
-	}
-	if (!ni) {
-		n2->is_expanded = true;
-	} else {
-		n2->children = NULL; // avoid partially expanded nodes
+		ni2->sibling = i + 1 < nchildren ? ni2 + 1 : NULL;
+		if (ni2->depth > dest->max_depth)
+			dest->max_depth = ni2->depth;
 	}
+	n2->nchildren = nchildren;
+	n2->children = children2;
+	n2->is_expanded = true;
+
+	for (int i = 0; i < nchildren; i++)
+		tree_prune_children(dest, &children2[i], &node->children[i], threshold, depth);
+}
+
+/* Copy the subtree rooted at node, see tree_prune_children().
+ * The code is destructive on src.
+ * Returns the copy of node in the destination tree, or NULL
+ * if we could not copy it. */
+static struct tree_node *
+tree_prune(struct tree *dest, struct tree *src, struct tree_node *node,
+	   int threshold, int depth)
+{
+	assert(dest->nodes && node);
+	struct tree_node *n2 = tree_alloc_node(dest, 1, true);
+	if (!n2)
+		return NULL;
+	*n2 = *node;
+	if (n2->depth > dest->max_depth)
+		dest->max_depth = n2->depth;
+	tree_prune_children(dest, n2, node, threshold, depth);
 	return n2;
 }
 
@@ -407,21 +544,14 @@ tree_prune(struct tree *dest, struct tree *src, struct tree_node *node,
  * This guarantees garbage collection in < 1s. */
 #define SMALL_TREE_PLAYOUTS 5000
 
-/* Free all the tree, keeping only the subtree rooted at node.
- * Prune the subtree if necessary to fit in memory or
- * to save time scanning the tree.
- * Returns the moved node. Only for fast_alloc. */
-struct tree_node *
-tree_garbage_collect(struct tree *tree, struct tree_node *node)
+/* Copy the subtree rooted at node to dest, which must be empty apart
+ * from its dummy root. Prune the subtree if necessary to fit in
+ * dest->max_tree_size or to save time scanning the tree.
+ * Returns the copy of node. Only for fast_alloc. */
+static struct tree_node *
+tree_gc_copy(struct tree *dest, struct tree *tree, struct tree_node *node, int *max_depth_)
 {
-	assert(tree->nodes && !node->parent && !node->sibling);
-	double start_time = time_now();
-	unsigned long orig_size = tree->nodes_size;
-
-	struct tree *temp_tree = tree_init(tree->board,  tree->root_color,
-					   tree->max_pruned_size, 0, 0, tree->ltree_aging, 0);
-	temp_tree->nodes_size = 0; // We do not want the dummy pass node
-        struct tree_node *temp_node;
+	dest->nodes_size = 0; // We do not want the dummy pass node
 
 	/* Find the maximum depth at which we can copy all nodes. */
 	int max_nodes = 1;
@@ -429,11 +559,12 @@ tree_garbage_collect(struct tree *tree, struct tree_node *node)
 		max_nodes++;
 	unsigned long nodes_size = max_nodes * sizeof(*node);
 	int max_depth = node->depth;
-	while (nodes_size < tree->max_pruned_size && max_nodes > 1) {
+	while (nodes_size < dest->max_tree_size && max_nodes > 1) {
 		max_nodes--;
 		nodes_size += max_nodes * nodes_size;
 		max_depth++;
 	}
+	*max_depth_ = max_depth;
 
 	/* Copy all nodes for small trees. For large trees, copy all nodes
 	 * with depth <= max_depth, and all nodes with enough playouts.
@@ -444,14 +575,15 @@ tree_garbage_collect(struct tree *tree, struct tree_node *node)
 	int threshold = (node->u.playouts - LARGE_TREE_PLAYOUTS) * DEEP_PLAYOUTS_THRESHOLD / LARGE_TREE_PLAYOUTS;
 	if (threshold < 0) threshold = 0;
 	if (threshold > DEEP_PLAYOUTS_THRESHOLD) threshold = DEEP_PLAYOUTS_THRESHOLD; 
-	temp_node = tree_prune(temp_tree, tree, node, threshold, max_depth);
-	assert(temp_node);
-
-	/* Now copy back to original tree. */
-	tree->nodes_size = 0;
-	tree->max_depth = 0;
-	struct tree_node *new_node = tree_prune(tree, temp_tree, temp_node, 0, temp_tree->max_depth);
+	struct tree_node *n2 = tree_prune(dest, tree, node, threshold, max_depth);
+	assert(n2);
+	return n2;
+}
 
+static void
+tree_gc_report(struct tree *tree, struct tree *dest, double start_time,
+	       int max_depth, unsigned long orig_size, struct tree_node *new_node)
+{
 	if (DEBUGL(1)) {
 		double now = time_now();
 		static double prev_time;
@@ -459,16 +591,45 @@ tree_garbage_collect(struct tree *tree, struct tree_node *node)
 		fprintf(stderr,
 			"tree pruned in %0.6g s, prev %0.3g s ago, dest depth %d wanted %d,"
 			" size %lu->%lu/%lu, playouts %d\n",
-			now - start_time, start_time - prev_time, temp_tree->max_depth, max_depth,
-			orig_size, temp_tree->nodes_size, tree->max_pruned_size, new_node->u.playouts);
+			now - start_time, start_time - prev_time, dest->max_depth, max_depth,
+			orig_size, dest->nodes_size, tree->max_pruned_size, new_node->u.playouts);
 		prev_time = start_time;
 	}
-	if (temp_tree->nodes_size >= temp_tree->max_tree_size) {
+	if (dest->nodes_size >= tree->max_pruned_size) {
 		fprintf(stderr, "temp tree overflow, max_tree_size %lu, pruning_threshold %lu\n",
 			tree->max_tree_size, tree->pruning_threshold);
 		/* This is not a serious problem, we will simply recompute the discarded nodes
 		 * at the next move if necessary. This is better than frequently wasting memory. */
-	} else {
+	}
+}
+
+/* Free all the tree, keeping only the subtree rooted at node.
+ * Prune the subtree if necessary to fit in memory or
+ * to save time scanning the tree.
+ * Returns the moved node. Only for fast_alloc. */
+struct tree_node *
+tree_garbage_collect(struct tree *tree, struct tree_node *node)
+{
+	assert(tree->nodes && !tree->gc && !node->parent && !node->sibling);
+	double start_time = time_now();
+	if (tree->tt)
+		tree_tt_clear(tree);
+	unsigned long orig_size = tree->nodes_size;
+
+	struct tree *temp_tree = tree_init(tree->board,  tree->root_color,
+					   tree->max_pruned_size, 0, 0, tree->ltree_aging, 0, 0);
+	int max_depth;
+	struct tree_node *temp_node = tree_gc_copy(temp_tree, tree, node, &max_depth);
+
+	/* Now copy back to original tree. The thread arenas point
+	 * to the old contents of the buffer, invalidate them. */
+	tree->nodes_size = 0;
+	tree->arena_gen = __sync_add_and_fetch(&arena_gen, 1);
+	tree->max_depth = 0;
+	struct tree_node *new_node = tree_prune(tree, temp_tree, temp_node, 0, temp_tree->max_depth);
+
+	tree_gc_report(tree, temp_tree, start_time, max_depth, orig_size, new_node);
+	if (temp_tree->nodes_size < temp_tree->max_tree_size) {
 		assert(tree->nodes_size == temp_tree->nodes_size);
 		assert(tree->max_depth == temp_tree->max_depth);
 	}
@@ -476,6 +637,110 @@ tree_garbage_collect(struct tree *tree, struct tree_node *node)
 	return new_node;
 }
 
+/* Background garbage collection: a separate thread copies the subtree
+ * of the root to a fresh nodes buffer (the free half of a semi-space),
+ * and tree_gc_finish() then simply swaps the buffers. This saves the
+ * copy back of tree_garbage_collect(), and the copy itself is done
+ * while we wait for the opponent to play. The tree must not be
+ * modified while the collection is running. */
+struct tree_gc {
+	pthread_t thread;
+	struct tree *tree;
+	struct tree *dest;
+	struct tree_node *node; // copy of the root in dest
+	int max_depth;
+	unsigned long orig_size;
+	double start_time;
+	volatile bool done; // copy complete, joining does not block
+};
+
+static void *
+tree_gc_worker(void *ctx_)
+{
+	struct tree_gc *gc = ctx_;
+	gc->node = tree_gc_copy(gc->dest, gc->tree, gc->tree->root, &gc->max_depth);
+	__sync_synchronize();
+	gc->done = true;
+	return NULL;
+}
+
+void
+tree_gc_start(struct tree *tree)
+{
+	assert(tree->nodes && !tree->gc && !tree->root->parent);
+	tree->gc_pending = false;
+	if (tree->tt)
+		tree_tt_clear(tree);
+
+	struct tree_gc *gc = malloc2(sizeof(*gc));
+	gc->tree = tree;
+	gc->orig_size = tree->nodes_size;
+	gc->start_time = time_now();
+	gc->done = false;
+	/* The buffer is as large as the tree one, but only up to
+	 * max_pruned_size of it is written (and backed by memory)
+	 * until it replaces the tree buffer. */
+	gc->dest = tree_init(tree->board, tree->root_color,
+			     tree->max_tree_size, 0, 0, tree->ltree_aging, 0, 0);
+	gc->dest->max_tree_size = tree->max_pruned_size;
+	tree->gc = gc;
+	pthread_create(&gc->thread, NULL, tree_gc_worker, gc);
+}
+
+void
+tree_gc_finish(struct tree *tree)
+{
+	struct tree_gc *gc = tree->gc;
+	if (!gc)
+		return;
+	pthread_join(gc->thread, NULL);
+	tree->gc = NULL;
+
+	struct tree *dest = gc->dest;
+	tree_gc_report(tree, dest, gc->start_time, gc->max_depth, gc->orig_size, gc->node);
+
+	/* Swap the buffers; the old one is freed with dest. */
+	void *nodes = tree->nodes;
+	tree->nodes = dest->nodes;
+	dest->nodes = nodes;
+	tree->nodes_size = dest->nodes_size;
+	tree->arena_gen = __sync_add_and_fetch(&arena_gen, 1);
+	tree->max_depth = dest->max_depth;
+	tree->root = gc->node;
+	tree_done(dest);
+	free(gc);
+}
+
+/* Abandon the background collection: the copy stops at the next node
+ * and the tree is left as it was, with the collection pending again. */
+static void
+tree_gc_cancel(struct tree *tree)
+{
+	struct tree_gc *gc = tree->gc;
+	double start_time = time_now();
+	gc->dest->gc_cancel = true;
+	pthread_join(gc->thread, NULL);
+	tree->gc = NULL;
+	tree->gc_pending = true;
+	if (DEBUGL(2))
+		fprintf(stderr, "tree pruning cancelled after %0.3g s, stopped in %0.3g s\n",
+			start_time - gc->start_time, time_now() - start_time);
+	tree_done(gc->dest);
+	free(gc);
+}
+
+void
+tree_gc_stop(struct tree *tree)
+{
+	struct tree_gc *gc = tree->gc;
+	if (!gc)
+		return;
+	if (gc->done)
+		tree_gc_finish(tree);
+	else
+		tree_gc_cancel(tree);
+}
+
 
 /* Get a node of given coordinate from within parent, possibly creating it
  * if necessary - in a very raw form (no .d, priors, ...). */
@@ -556,6 +821,179 @@ tree_lnode_for_node(struct tree *tree, struct tree_node *ni, struct tree_node *l
 }
 
 
+static coord_t
+flip_coord(struct board *b, coord_t c,
+           bool flip_horiz, bool flip_vert, int flip_diag)
+{
+	int x = coord_x(c, b), y = coord_y(c, b);
+	if (flip_diag) {
+		int z = x; x = y; y = z;
+	}
+	if (flip_horiz) {
+		x = board_size(b) - 1 - x;
+	}
+	if (flip_vert) {
+		y = board_size(b) - 1 - y;
+	}
+	return coord_xy(b, x, y);
+}
+
+
+/* Transposition table. Each position maps to a bucket of
+ * TREE_TT_BUCKET entries; on insertion, we take a free entry or
+ * replace the node with the fewest playouts. The table is not
+ * locked: entries are claimed with compare-and-swap, and readers
+ * check the entry consistency (see struct tree_tt_entry).
+ *
+ * Positions are keyed in canonical form: the smallest hash over the
+ * 8 board symmetries. The symmetry which maps the position of the
+ * entry node to the canonical form is kept in the top bits of the
+ * key, so that we can map its children to our orientation. */
+
+#define TREE_TT_BUCKET 2
+
+/* Results of transposed children are merged into the priors up to this
+ * many playouts in all, a few times the weight of the regular priors;
+ * the node would otherwise start with tens of thousands of playouts
+ * and never explore by itself. */
+#define TREE_TT_PRIOR_MAX 500
+
+/* Symmetry s is flip_coord() with flip_horiz = s & 1, flip_vert = s & 2,
+ * flip_diag = s & 4. */
+#define TREE_TT_SYM_SHIFT 61
+#define TREE_TT_SYM_MASK ((hash_t) 7 << TREE_TT_SYM_SHIFT)
+
+static coord_t
+tree_tt_flip(struct board *b, coord_t c, int sym)
+{
+	return flip_coord(b, c, sym & 1, sym & 2, sym & 4);
+}
+
+/* Inverse of tree_tt_flip(): with the diagonal flip, horizontal and
+ * vertical flips swap meaning. */
+static coord_t
+tree_tt_unflip(struct board *b, coord_t c, int sym)
+{
+	if (sym & 4)
+		sym = 4 | (sym & 1) << 1 | (sym & 2) >> 1;
+	return tree_tt_flip(b, c, sym);
+}
+
+/* Returns the canonical position key, its symmetry in the top bits. */
+static hash_t
+tree_tt_key(struct board *b, enum stone color)
+{
+	hash_t keys[8] = { b->hash };
+	foreach_point(b) {
+		enum stone s = board_at(b, c);
+		if (s != S_BLACK && s != S_WHITE)
+			continue;
+		for (int sym = 1; sym < 8; sym++)
+			keys[sym] ^= hash_at(b, tree_tt_flip(b, c, sym), s);
+	} foreach_point_end;
+
+	hash_t key = 0; int ksym = 0;
+	for (int sym = 0; sym < 8; sym++) {
+		if (!is_pass(b->ko.coord)) {
+			hash_t k = hash_at(b, tree_tt_flip(b, b->ko.coord, sym), S_BLACK);
+			keys[sym] ^= (k << 17) | (k >> 47);
+		}
+		if (color == S_WHITE)
+			keys[sym] = ~keys[sym];
+		keys[sym] &= ~TREE_TT_SYM_MASK;
+		if (!sym || keys[sym] < key) {
+			key = keys[sym]; ksym = sym;
+		}
+	}
+	return key | (hash_t) ksym << TREE_TT_SYM_SHIFT;
+}
+
+static struct tree_tt_entry *
+tree_tt_bucket(struct tree *t, hash_t key)
+{
+	return &t->tt[key & ((1UL << t->tt_bits) - 1) & ~(TREE_TT_BUCKET - 1)];
+}
+
+/* Returns the node stored for the position of @key (symmetry bits
+ * ignored) and its symmetry in @sym. */
+static struct tree_node *
+tree_tt_lookup(struct tree *t, hash_t key, int *sym)
+{
+	struct tree_tt_entry *e = tree_tt_bucket(t, key);
+	for (int i = 0; i < TREE_TT_BUCKET; i++) {
+		struct tree_node *n = e[i].node;
+		hash_t k = e[i].check ^ (hash_t) (uintptr_t) n;
+		if (n && ((k ^ key) & ~TREE_TT_SYM_MASK) == 0) {
+			*sym = k >> TREE_TT_SYM_SHIFT;
+			return n;
+		}
+	}
+	return NULL;
+}
+
+static void
+tree_tt_insert(struct tree *t, hash_t key, struct tree_node *node)
+{
+	struct tree_tt_entry *e = tree_tt_bucket(t, key);
+	int victim = 0;
+	struct tree_node *old = e[0].node;
+	for (int i = 0; i < TREE_TT_BUCKET && old; i++) {
+		struct tree_node *n = e[i].node;
+		if (!n || n->u.playouts < old->u.playouts) {
+			victim = i;
+			old = n;
+		}
+	}
+	/* If another thread got there first, simply give up. */
+	if (!__sync_bool_compare_and_swap(&e[victim].node, old, node))
+		return;
+	e[victim].check = key ^ (hash_t) (uintptr_t) node;
+}
+
+void
+tree_tt_clear(struct tree *t)
+{
+	if (DEBUGL(2))
+		fprintf(stderr, "transpositions: %lu hits / %lu lookups\n", t->tt_hits, t->tt_lookups);
+	memset(t->tt, 0, (1UL << t->tt_bits) * sizeof(*t->tt));
+	t->tt_hits = t->tt_lookups = 0;
+}
+
+/* Set up the prior map from the children of @tn, an expanded node for
+ * the same position up to symmetry: their priors refined by their
+ * playout results, capped at TREE_TT_PRIOR_MAX. @tn_sym and @sym map
+ * the position of @tn and ours to the canonical form. Returns false
+ * if @tn is not fully expanded yet. */
+static bool
+tree_tt_prior(struct tree *t, struct tree_node *tn, int tn_sym, int sym, struct prior_map *map)
+{
+	int nchildren;
+	struct tree_node *children = tree_node_children(tn, &nchildren);
+	if (!children)
+		return false;
+
+	/* Moves missing from tn children were pruned by uct_prior(). */
+	int size2 = board_size2(map->b);
+	bool legal[size2];
+	memcpy(legal, map->consider, sizeof(legal));
+	memset(map->consider, 0, sizeof(legal));
+	for (struct tree_node *ni = children; ni < children + nchildren; ni++) {
+		coord_t c = node_coord(ni);
+		if (!is_pass(c) && tn_sym != sym)
+			c = tree_tt_unflip(map->b, tree_tt_flip(map->b, c, tn_sym), sym);
+		if (!is_pass(c) && !legal[c])
+			continue;
+		map->consider[c] = true;
+		map->prior[c] = ni->prior;
+		struct move_stats u = ni->u;
+		stats_merge(&map->prior[c], &u);
+		if (map->prior[c].playouts > TREE_TT_PRIOR_MAX)
+			map->prior[c].playouts = TREE_TT_PRIOR_MAX;
+	}
+	return true;
+}
+
+
 /* Tree symmetry: When possible, we will localize the tree to a single part
  * of the board in tree_expand_node() and possibly flip along symmetry axes
  * to another part of the board in tree_promote_at(). We follow b->symmetry
@@ -596,10 +1034,26 @@ tree_expand_node(struct tree *t, struct tree_node *node, struct board *b, enum s
 		map.consider[c] = true;
 		child_count++;
 	} foreach_free_point_end;
-	uct_prior(u, node, &map);
 
-	/* Now, create the nodes (all at once if fast_alloc) */
-	struct tree_node *ni = t->nodes ? tree_alloc_node(t, child_count, true) : tree_alloc_node(t, 1, false);
+	/* Reuse the children of a transposition if we have one. The table
+	 * holds only nodes expanded on the whole board, but while the board
+	 * is symmetric we can still take priors from one; the loop below
+	 * keeps the symmetry playground. The root always gets fresh priors
+	 * (dcnn). */
+	bool tt = t->tt && node->parent;
+	hash_t tt_key = tt ? tree_tt_key(b, color) : 0;
+	int tn_sym = 0, tt_sym = tt_key >> TREE_TT_SYM_SHIFT;
+	struct tree_node *tn = tt ? tree_tt_lookup(t, tt_key, &tn_sym) : NULL;
+	if (tt) t->tt_lookups++;
+	bool tt_hit = tn && tree_tt_prior(t, tn, tn_sym, tt_sym, &map);
+	if (tt_hit)
+		t->tt_hits++;
+	else
+		uct_prior(u, node, &map);
+
+	/* Now, create the nodes, all at once in a single block. */
+	struct tree_node *ni = t->nodes ? tree_arena_alloc(t, child_count)
+				        : tree_alloc_node(t, child_count, false);
 	/* In fast_alloc mode we might temporarily run out of nodes but this should be rare. */
 	if (!ni) {
 		node->is_expanded = false;
@@ -636,7 +1090,7 @@ tree_expand_node(struct tree *t, struct tree_node *node, struct board *b, enum s
 				continue;
 			assert(c != node_coord(node)); // I have spotted "C3 C3" in some sequence...
 
-			struct tree_node *nj = t->nodes ? first_child + child++ : tree_alloc_node(t, 1, false);
+			struct tree_node *nj = first_child + child++;
 			tree_setup_node(t, nj, c, node->depth + 1);
 			nj->parent = node; ni->sibling = nj; ni = nj;
 
@@ -644,27 +1098,26 @@ tree_expand_node(struct tree *t, struct tree_node *node, struct board *b, enum s
 			ni->d = distances[c];
 		}
 	}
-	node->children = first_child; // must be done at the end to avoid race
+	/* Symmetric moves may have been dropped; with calloc the tail of
+	 * the block is freed together with it, do not account for it.
+	 * In fast_alloc mode, return it to the arena. */
+	if (!t->nodes && child < child_count)
+		__sync_fetch_and_sub(&t->nodes_size, (child_count - child) * sizeof(*ni));
+	else if (t->nodes && child < child_count)
+		tree_arena_trim(first_child + child_count, first_child + child);
+	node->nchildren = child;
+	/* Must be done at the end to avoid race, pairs with the acquire
+	 * load in tree_node_children(). */
+	__atomic_store_n(&node->children, first_child, __ATOMIC_RELEASE);
+
+	if (tt && b->symmetry.type == SYM_NONE)
+		tree_tt_insert(t, tt_key, node);
+	/* Priors copied from a transposition are complete already. */
+	if (!tt_hit)
+		uct_prior_queue(u, t, node, b, color, map.parity);
 }
 
 
-static coord_t
-flip_coord(struct board *b, coord_t c,
-           bool flip_horiz, bool flip_vert, int flip_diag)
-{
-	int x = coord_x(c, b), y = coord_y(c, b);
-	if (flip_diag) {
-		int z = x; x = y; y = z;
-	}
-	if (flip_horiz) {
-		x = board_size(b) - 1 - x;
-	}
-	if (flip_vert) {
-		y = board_size(b) - 1 - y;
-	}
-	return coord_xy(b, x, y);
-}
-
 static void
 tree_fix_node_symmetry(struct board *b, struct tree_node *node,
                        bool flip_horiz, bool flip_vert, int flip_diag)
@@ -732,6 +1185,22 @@ tree_unlink_node(struct tree_node *node)
 	node->parent = NULL;
 }
 
+/* Move a child of the root out of its children block, so that the rest
+ * of the tree can be freed. Returns the new copy. Only for fast_alloc=false. */
+static struct tree_node *
+tree_detach_node(struct tree *tree, struct tree_node *node)
+{
+	struct tree_node *n2 = tree_alloc_node(tree, 1, false);
+	*n2 = *node;
+	n2->parent = n2->sibling = NULL;
+	for (int i = 0; i < n2->nchildren; i++)
+		n2->children[i].parent = n2;
+	/* The old copy is freed together with its block. */
+	node->children = NULL;
+	node->nchildren = 0;
+	return n2;
+}
+
 /* Reduce weight of statistics on promotion. Remove nodes that
  * get reduced to zero playouts; returns next node to consider
  * in the children list (@node may get deleted). */
@@ -757,17 +1226,25 @@ tree_age_node(struct tree *tree, struct tree_node *node)
 void
 tree_promote_node(struct tree *tree, struct tree_node **node)
 {
-	assert((*node)->parent == tree->root);
-	tree_unlink_node(*node);
+	assert((*node)->parent == tree->root && !tree->gc);
+	/* Nodes may be freed or moved below. */
+	if (tree->tt)
+		tree_tt_clear(tree);
 	if (!tree->nodes) {
+		*node = tree_detach_node(tree, *node);
 		/* Freeing the rest of the tree can take several seconds on large
 		 * trees, so we must do it asynchronously: */
 		tree_done_node_detached(tree, tree->root);
 	} else {
+		tree_unlink_node(*node);
 		/* Garbage collect if we run out of memory, or it is cheap to do so now: */
 		if (tree->nodes_size >= tree->pruning_threshold
-		    || (tree->nodes_size >= tree->max_tree_size / 10 && (*node)->u.playouts < SMALL_TREE_PLAYOUTS))
-			*node = tree_garbage_collect(tree, *node);
+		    || (tree->nodes_size >= tree->max_tree_size / 10 && (*node)->u.playouts < SMALL_TREE_PLAYOUTS)) {
+			if (tree->gc_background)
+				tree->gc_pending = true; // left to the caller, see tree_gc_start()
+			else
+				*node = tree_garbage_collect(tree, *node);
+		}
 	}
 	tree->root = *node;
 	tree->root_color = stone_other(tree->root_color);
@@ -789,6 +1266,7 @@ tree_promote_node(struct tree *tree, struct tree_node **node)
 bool
 tree_promote_at(struct tree *tree, struct board *b, coord_t c)
 {
+	tree_gc_stop(tree);
 	tree_fix_symmetry(tree, b, c);
 
 	for (struct tree_node *ni = tree->root->children; ni; ni = ni->sibling) {
@@ -39,24 +39,31 @@ struct uct;
  *            | node |
  *            +------+
  *          / <- parent
- * +------+   v- sibling +------+
- * | node | ------------ | node |
- * +------+              +------+
- *    | <- children          |
- * +------+   +------+   +------+   +------+
- * | node | - | node |   | node | - | node |
- * +------+   +------+   +------+   +------+
- */
-
-/* TODO: Performance would benefit from a reorganization:
- * (i) Allocate all children of a node within a single block.
- * (ii) Keep all u stats together, and all amaf stats together.
- * Currently, rave_update is top source of cache misses, and
- * there is large memory overhead for having all nodes separate. */
+ * +------+------+------+
+ * | node | node | node |   <- children, allocated in a single block
+ * +------+------+------+
+ *    | <- children
+ * +------+------+
+ * | node | node |
+ * +------+------+
+ *
+ * All children of a search tree node are allocated contiguously by
+ * tree_expand_node(), so that the node policies can scan them
+ * sequentially (see tree_node_children()). The sibling pointers are
+ * still maintained and link the block members in order.
+ *
+ * The local trees (ltree_black, ltree_white) are the exception: their
+ * nodes are created one by one by tree_get_node() and are linked only
+ * through sibling pointers; nchildren is always 0 there. */
+
+/* TODO: Keep all u stats together, and all amaf stats together
+ * within the children block. */
 
 struct tree_node {
 	hash_t hash;
 	struct tree_node *parent, *sibling, *children;
+	/* Size of the children block; 0 for leaves and local tree nodes. */
+	unsigned short nchildren;
 
 	/*** From here on, struct is saved/loaded from opening tbook */
 
@@ -98,6 +105,17 @@ struct tree_node {
 };
 
 struct tree_hash;
+struct tree_gc;
+
+/* Transposition table entry. The node is valid only if check ^ node
+ * is the position key; this detects torn updates by concurrent threads. */
+struct tree_tt_entry {
+	hash_t check;
+	struct tree_node *node;
+};
+
+/* Largest transposition table, 2^TREE_TT_MAX_BITS entries. */
+#define TREE_TT_MAX_BITS 30
 
 struct tree {
 	struct board *board;
@@ -140,9 +158,27 @@ struct tree {
 	struct tree_hash *htable;
 	int hbits;
 
+	/* Optional transposition table, shared by all threads. Maps
+	 * a position (board hash, color to play and ko) to an expanded
+	 * node for this position; when expanding a node for the same
+	 * position, we reuse its children priors and results instead
+	 * of computing the priors again. Entries are dropped whenever
+	 * nodes may be moved or freed. */
+	struct tree_tt_entry *tt;
+	int tt_bits;
+	unsigned long tt_lookups, tt_hits; // statistics only, not atomic
+
 	// Statistics
 	int max_depth;
-	volatile unsigned long nodes_size; // byte size of all allocated nodes
+	volatile unsigned long nodes_size; // byte size of all allocated nodes (fast_alloc: incl. thread arenas)
+	unsigned long arena_gen; // changes whenever thread arenas must be dropped
+
+	/* Garbage collection in the background, only for fast_alloc.
+	 * If gc_background is set, tree_promote_node() only sets
+	 * gc_pending and the caller is expected to tree_gc_start(). */
+	bool gc_background, gc_pending;
+	struct tree_gc *gc; // running background collection
+	volatile bool gc_cancel; // set on the destination tree of an abandoned collection
 	unsigned long max_tree_size; // maximum byte size for entire tree, > 0 only for fast_alloc
 	unsigned long max_pruned_size;
 	unsigned long pruning_threshold;
@@ -151,7 +187,7 @@ struct tree {
 
 /* Warning: all functions below except tree_expand_node & tree_leaf_node are THREAD-UNSAFE! */
 struct tree *tree_init(struct board *board, enum stone color, unsigned long max_tree_size,
-		       unsigned long max_pruned_size, unsigned long pruning_threshold, floating_t ltree_aging, int hbits);
+		       unsigned long max_pruned_size, unsigned long pruning_threshold, floating_t ltree_aging, int hbits, int tt_bits);
 void tree_done(struct tree *tree);
 void tree_dump(struct tree *tree, double thres);
 void tree_save(struct tree *tree, struct board *b, int thres);
@@ -159,9 +195,16 @@ void tree_load(struct tree *tree, struct board *b);
 
 struct tree_node *tree_get_node(struct tree *tree, struct tree_node *node, coord_t c, bool create);
 struct tree_node *tree_garbage_collect(struct tree *tree, struct tree_node *node);
+void tree_gc_start(struct tree *tree);
+void tree_gc_finish(struct tree *tree);
+/* Like tree_gc_finish() if the copy is complete, otherwise cancel the
+ * collection without waiting for it; gc_pending is then set again. */
+void tree_gc_stop(struct tree *tree);
 void tree_promote_node(struct tree *tree, struct tree_node **node);
 bool tree_promote_at(struct tree *tree, struct board *b, coord_t c);
 
+void tree_tt_clear(struct tree *tree);
+
 void tree_expand_node(struct tree *tree, struct tree_node *node, struct board *b, enum stone color, struct uct *u, int parity);
 struct tree_node *tree_lnode_for_node(struct tree *tree, struct tree_node *ni, struct tree_node *lni, int tenuki_d);
 
@@ -184,6 +227,19 @@ tree_leaf_node(struct tree_node *node)
 	return !(node->children);
 }
 
+/* Get the children block of a search tree node and store its length
+ * in @nchildren. This may be called while another thread is expanding
+ * the node: nchildren is set before children is published with
+ * release ordering, so a non-NULL result always comes with the right
+ * length. */
+static inline struct tree_node *
+tree_node_children(struct tree_node *node, int *nchildren)
+{
+	struct tree_node *children = __atomic_load_n(&node->children, __ATOMIC_ACQUIRE);
+	*nchildren = children ? node->nchildren : 0;
+	return children;
+}
+
 static inline floating_t
 tree_node_criticality(const struct tree *t, const struct tree_node *node)
 {
@@ -42,7 +42,8 @@ static void
 setup_state(struct uct *u, struct board *b, enum stone color)
 {
 	u->t = tree_init(b, color, u->fast_alloc ? u->max_tree_size : 0,
-			 u->max_pruned_size, u->pruning_threshold, u->local_tree_aging, u->stats_hbits);
+			 u->max_pruned_size, u->pruning_threshold, u->local_tree_aging, u->stats_hbits, u->tt_bits);
+	u->t->gc_background = u->background_gc;
 	if (u->initial_extra_komi)
 		u->t->extra_komi = u->initial_extra_komi;
 	if (u->force_seed)
@@ -191,6 +192,13 @@ uct_notify_play(struct engine *e, struct board *b, struct move *m, char *enginea
 		return NULL;
 	}
 
+	/* Collect the garbage only while the opponent is thinking: after
+	 * our own move here (slave), otherwise after uct_genmove() chose
+	 * it. The search on the opponent's move runs on the unpruned tree,
+	 * up to max_tree_size. */
+	if (u->t->gc_pending && m->color == u->my_color)
+		tree_gc_start(u->t);
+
 	/* If we are a slave in a distributed engine, start pondering once
 	 * we know which move we actually played. See uct_genmove() about
 	 * the check for pass. */
@@ -597,6 +605,9 @@ uct_genmove(struct engine *e, struct board *b, struct time_info *ti, enum stone
 
 	if (!u->t->untrustworthy_tree) {
 		tree_promote_node(u->t, &best);
+		/* Collect the garbage while the opponent is thinking. */
+		if (u->t->gc_pending)
+			tree_gc_start(u->t);
 	} else {
 		/* Throw away an untrustworthy tree. */
 		/* Preserve dynamic komi information, though, that is important. */
@@ -640,7 +651,7 @@ uct_dumptbook(struct engine *e, struct board *b, enum stone color)
 {
 	struct uct *u = e->data;
 	struct tree *t = tree_init(b, color, u->fast_alloc ? u->max_tree_size : 0,
-			 u->max_pruned_size, u->pruning_threshold, u->local_tree_aging, 0);
+			 u->max_pruned_size, u->pruning_threshold, u->local_tree_aging, 0, 0);
 	tree_load(t, b);
 	tree_dump(t, 0);
 	tree_done(t);
@@ -969,6 +980,18 @@ uct_state_init(char *arg, struct board *b)
 				/* By default, Pachi will run with only single
 				 * tree search thread! */
 				u->threads = atoi(optval);
+			} else if (!strcasecmp(optname, "pin_threads")) {
+				/* Pin each search thread to its own cpu, filling
+				 * one NUMA node before moving to the next one. */
+				u->pin_threads = !optval || atoi(optval);
+			} else if (!strcasecmp(optname, "journal_board")) {
+				/* Each search thread keeps its own board and
+				 * rolls it back through the undo journal after
+				 * each simulation instead of copying the root
+				 * board. Playouts touch most of the board, so
+				 * this does not pay off with the current board
+				 * layout; off by default. */
+				u->journal_board = !optval || atoi(optval);
 			} else if (!strcasecmp(optname, "thread_model") && optval) {
 				if (!strcasecmp(optval, "tree")) {
 					/* Tree parallelization - all threads
@@ -1004,6 +1027,23 @@ uct_state_init(char *arg, struct board *b)
 				 * Increase to reduce pruning time overhead if memory is plentiful.
 				 * This option is meaningful only for fast_alloc. */
 				u->pruning_threshold = atol(optval) * 1048576;
+			} else if (!strcasecmp(optname, "background_gc")) {
+				/* Prune the tree in a separate thread after our move
+				 * is played instead of right before returning it, so
+				 * that genmove does not wait for the pruning.
+				 * This option is meaningful only for fast_alloc. */
+				u->background_gc = !optval || atoi(optval);
+			} else if (!strcasecmp(optname, "transpositions")) {
+				/* Share priors and results between nodes of the same
+				 * position reached through different move orders, using
+				 * a transposition table of 2^transpositions entries.
+				 * Without a value, the table is sized according to
+				 * max_tree_size. */
+				u->tt_bits = optval ? atoi(optval) : -1;
+				if (optval && (u->tt_bits < 0 || u->tt_bits > TREE_TT_MAX_BITS)) {
+					fprintf(stderr, "UCT: Invalid transpositions size %s (0 to %d)\n", optval, TREE_TT_MAX_BITS);
+					exit(1);
+				}
 
 			/** Time control */
 
@@ -1222,7 +1262,8 @@ uct_state_init(char *arg, struct board *b)
 				 * Must use the same value in master and slaves. */
 				u->shared_nodes = atoi(optval);
 			} else if (!strcasecmp(optname, "shared_levels") && optval) {
-				/* Share only nodes of level <= shared_levels. */
+				/* Share only nodes of level <= shared_levels.
+				 * Deep levels may need a larger stats_hbits. */
 				u->shared_levels = atoi(optval);
 			} else if (!strcasecmp(optname, "stats_hbits") && optval) {
 				/* Set hash table size to 2^stats_hbits for the shared stats. */
@@ -1302,6 +1343,13 @@ uct_state_init(char *arg, struct board *b)
 		u->max_tree_size -= u->max_tree_size / 20;
 	}
 
+	if (u->tt_bits < 0) {
+		/* One entry for every TREE_TT_NODES tree nodes. */
+#define TREE_TT_NODES 16
+		unsigned long entries = u->max_tree_size / sizeof(struct tree_node) / TREE_TT_NODES;
+		for (u->tt_bits = 1; (2UL << u->tt_bits) <= entries && u->tt_bits < TREE_TT_MAX_BITS; u->tt_bits++);
+	}
+
 	if (!u->prior)
 		u->prior = uct_prior_init(NULL, b, u);
 
@@ -1319,7 +1367,6 @@ uct_state_init(char *arg, struct board *b)
 	if (u->slave) {
 		if (!u->stats_hbits) u->stats_hbits = DEFAULT_STATS_HBITS;
 		if (!u->shared_nodes) u->shared_nodes = DEFAULT_SHARED_NODES;
-		assert(u->shared_levels * board_bits2(b) <= 8 * (int)sizeof(path_t));
 	}
 
 	if (!u->dynkomi)
@@ -25,6 +25,28 @@
 
 #define DESCENT_DLEN 512
 
+#ifndef NO_THREAD_LOCAL
+/* Search workers collect playout ownership in a private ownermap,
+ * merged into u->ownermap every OWNERMAP_MERGE_INTERVAL playouts;
+ * the shared counters would otherwise bounce between all the cpus
+ * at the end of each playout. NULL outside of uct_playouts(). */
+static __thread struct board_ownermap *thread_ownermap;
+#define OWNERMAP_MERGE_INTERVAL 64
+
+static void
+uct_ownermap_flush(struct uct *u, struct board *b, struct board_ownermap *ownermap)
+{
+	board_ownermap_merge(board_size2(b), &u->ownermap, ownermap);
+	ownermap->playouts = 0;
+	memset(ownermap->map, 0, board_size2(b) * sizeof(ownermap->map[0]));
+}
+
+/* Search workers also keep their own copy of the root board, journaled
+ * so that each simulation is rolled back at its end instead of starting
+ * from a fresh copy. NULL outside of uct_playouts(). */
+static __thread struct board *thread_board;
+#endif
+
 
 void
 uct_progress_text(struct uct *u, struct tree *t, enum stone color, int playouts)
@@ -374,9 +396,18 @@ uct_leaf_node(struct uct *u, struct board *b, enum stone player_color,
 		.postpolicy_hook = uct_playout_postpolicy,
 		.hook_data = &upc,
 	};
+	struct board_ownermap *ownermap = &u->ownermap;
+#ifndef NO_THREAD_LOCAL
+	if (thread_ownermap)
+		ownermap = thread_ownermap;
+#endif
 	int result = play_random_game(&ps, b, next_color,
 	                              u->playout_amaf ? amaf : NULL,
-				      &u->ownermap, u->playout);
+				      ownermap, u->playout);
+#ifndef NO_THREAD_LOCAL
+	if (ownermap == thread_ownermap && ownermap->playouts >= OWNERMAP_MERGE_INTERVAL)
+		uct_ownermap_flush(u, b, ownermap);
+#endif
 	if (next_color == S_WHITE) {
 		/* We need the result from black's perspective. */
 		result = - result;
@@ -521,8 +552,22 @@ record_local_sequence(struct uct *u, struct tree *t, struct board *endb,
 int
 uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree *t)
 {
-	struct board b2;
-	board_copy(&b2, b);
+	struct board b2_copy, *b2 = &b2_copy;
+	int b2_mark = -1;
+#ifndef NO_THREAD_LOCAL
+	if (thread_board) {
+		b2 = thread_board;
+		b2_mark = board_journal_mark(b2);
+	} else {
+		/* Keep the playout board arrays around, there is no point
+		 * in allocating them again for each playout. */
+		static __thread void *b2_buf;
+		static __thread size_t b2_bufsize;
+		board_copy_buf(b2, b, &b2_buf, &b2_bufsize);
+	}
+#else
+	board_copy(b2, b);
+#endif
 
 	struct playout_amafmap amaf;
 	amaf.gamelen = amaf.game_baselen = 0;
@@ -535,7 +580,7 @@ uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree
 
 	/* Make sure the root node is expanded. */
 	if (tree_leaf_node(n) && !__sync_lock_test_and_set(&n->is_expanded, 1))
-		tree_expand_node(t, n, &b2, player_color, u, 1);
+		tree_expand_node(t, n, b2, player_color, u, 1);
 
 	/* Tree descent history. */
 	/* XXX: This is somewhat messy since @n and descent[dlen-1].node are
@@ -553,7 +598,7 @@ uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree
 		significant[node_color - 1] = n;
 
 	int result;
-	int pass_limit = (board_size(&b2) - 2) * (board_size(&b2) - 2) / 2;
+	int pass_limit = (board_size(b2) - 2) * (board_size(b2) - 2) / 2;
 	int passes = is_pass(b->last_move.coord) && b->moves > 0;
 
 	/* debug */
@@ -583,9 +628,9 @@ uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree
 		}
 
 		if (!u->random_policy_chance || fast_random(u->random_policy_chance))
-			u->policy->descend(u->policy, t, &descent[dlen], parity, b2.moves > pass_limit);
+			u->policy->descend(u->policy, t, &descent[dlen], parity, b2->moves > pass_limit);
 		else
-			u->random_policy->descend(u->random_policy, t, &descent[dlen], parity, b2.moves > pass_limit);
+			u->random_policy->descend(u->random_policy, t, &descent[dlen], parity, b2->moves > pass_limit);
 
 
 		/*** Perform the descent: */
@@ -608,16 +653,16 @@ uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree
 			__sync_fetch_and_add(&n->descents, u->virtual_loss);
 
 		struct move m = { node_coord(n), node_color };
-		int res = board_play(&b2, &m);
+		int res = board_play(b2, &m);
 
-		if (res < 0 || (!is_pass(m.coord) && !group_at(&b2, m.coord)) /* suicide */
-		    || b2.superko_violation) {
+		if (res < 0 || (!is_pass(m.coord) && !group_at(b2, m.coord)) /* suicide */
+		    || b2->superko_violation) {
 			if (UDEBUGL(4)) {
 				for (struct tree_node *ni = n; ni; ni = ni->parent)
 					fprintf(stderr, "%s<%"PRIhash"> ", coord2sstr(node_coord(ni), t->board), ni->hash);
 				fprintf(stderr, "marking invalid %s node %d,%d res %d group %d spk %d\n",
 				        stone2str(node_color), coord_x(node_coord(n),b), coord_y(node_coord(n),b),
-					res, group_at(&b2, m.coord), b2.superko_violation);
+					res, group_at(b2, m.coord), b2->superko_violation);
 			}
 			n->hints |= TREE_HINT_INVALID;
 			result = 0;
@@ -625,7 +670,7 @@ uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree
 		}
 
 		assert(node_coord(n) >= -1);
-		record_amaf_move(&amaf, node_coord(n), board_playing_ko_threat(&b2));
+		record_amaf_move(&amaf, node_coord(n), board_playing_ko_threat(b2));
 
 		if (is_pass(node_coord(n)))
 			passes++;
@@ -638,18 +683,20 @@ uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree
 		 * node, the latter one will simply do another simulation from
 		 * the node itself, no big deal. t->nodes_size may exceed
 		 * the maximum in multi-threaded case but not by much so it's ok.
+		 * (With fast_alloc it also includes the unused parts of the
+		 * thread arenas, so it errs on the safe side.)
 		 * The size test must be before the test&set not after, to allow
 		 * expansion of the node later if enough nodes have been freed. */
 		if (tree_leaf_node(n)
 		    && n->u.playouts - u->virtual_loss >= u->expand_p && t->nodes_size < u->max_tree_size
 		    && !__sync_lock_test_and_set(&n->is_expanded, 1))
-			tree_expand_node(t, n, &b2, next_color, u, -parity);
+			tree_expand_node(t, n, b2, next_color, u, -parity);
 	}
 
 	amaf.game_baselen = amaf.gamelen;
 
 	if (t->use_extra_komi && u->dynkomi->persim) {
-		b2.komi += round(u->dynkomi->persim(u->dynkomi, &b2, t, n));
+		b2->komi += round(u->dynkomi->persim(u->dynkomi, b2, t, n));
 	}
 
 	/* !!! !!! !!!
@@ -661,7 +708,7 @@ uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree
 	// assert(tree_leaf_node(n));
 	/* In case of parallel tree search, the assertion might
 	 * not hold if two threads chew on the same node. */
-	result = uct_leaf_node(u, &b2, player_color, &amaf, descent, &dlen, significant, t, n, node_color, spaces);
+	result = uct_leaf_node(u, b2, player_color, &amaf, descent, &dlen, significant, t, n, node_color, spaces);
 
 	if (u->policy->wants_amaf && u->playout_amaf_cutoff) {
 		unsigned int cutoff = amaf.game_baselen;
@@ -673,7 +720,7 @@ uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree
 
 	assert(n == t->root || n->parent);
 	floating_t rval = scale_value(u, b, node_color, significant, result);
-	u->policy->update(u->policy, t, n, node_color, player_color, &amaf, &b2, rval);
+	u->policy->update(u->policy, t, n, node_color, player_color, &amaf, b2, rval);
 
 	stats_add_result(&t->avg_score, result / 2, 1);
 	if (t->use_extra_komi) {
@@ -690,22 +737,22 @@ uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree
 		 * which is expected as it will create new lnodes. */
 		enum stone seq_color = player_color;
 		/* First move always starts a sequence. */
-		record_local_sequence(u, t, &b2, descent, dlen, 1, seq_color);
+		record_local_sequence(u, t, b2, descent, dlen, 1, seq_color);
 		seq_color = stone_other(seq_color);
 		for (int dseqi = 2; dseqi < dlen; dseqi++, seq_color = stone_other(seq_color)) {
 			if (u->local_tree_allseq) {
 				/* We are configured to record all subsequences. */
-				record_local_sequence(u, t, &b2, descent, dlen, dseqi, seq_color);
+				record_local_sequence(u, t, b2, descent, dlen, dseqi, seq_color);
 				continue;
 			}
 			if (descent[dseqi].node->d >= u->tenuki_d) {
 				/* Tenuki! Record the fresh sequence. */
-				record_local_sequence(u, t, &b2, descent, dlen, dseqi, seq_color);
+				record_local_sequence(u, t, b2, descent, dlen, dseqi, seq_color);
 				continue;
 			}
 			if (descent[dseqi].lnode && !descent[dseqi].lnode) {
 				/* Record result for in-descent picked sequence. */
-				record_local_sequence(u, t, &b2, descent, dlen, dseqi, seq_color);
+				record_local_sequence(u, t, b2, descent, dlen, dseqi, seq_color);
 				continue;
 			}
 		}
@@ -719,13 +766,34 @@ end:
 		}
 	}
 
-	board_done_noalloc(&b2);
+#ifndef NO_THREAD_LOCAL
+	if (b2_mark >= 0)
+		board_journal_rollback(b2, b2_mark);
+	else
+		board_done_buf(b2);
+#else
+	board_done_noalloc(b2);
+#endif
 	return result;
 }
 
 int
 uct_playouts(struct uct *u, struct board *b, enum stone color, struct tree *t, struct time_info *ti)
 {
+#ifndef NO_THREAD_LOCAL
+	struct board_ownermap ownermap;
+	ownermap.playouts = 0;
+	ownermap.map = calloc2(board_size2(b), sizeof(ownermap.map[0]));
+	thread_ownermap = &ownermap;
+
+	struct board board;
+	if (u->journal_board) {
+		board_copy(&board, b);
+		board_journal_init(&board);
+		thread_board = &board;
+	}
+#endif
+
 	int i;
 	if (ti && ti->dim == TD_GAMES) {
 		for (i = 0; t->root->u.playouts <= ti->len.games && !uct_halt; i++)
@@ -734,5 +802,16 @@ uct_playouts(struct uct *u, struct board *b, enum stone color, struct tree *t, s
 		for (i = 0; !uct_halt; i++)
 			uct_playout(u, b, color, t);
 	}
+
+#ifndef NO_THREAD_LOCAL
+	uct_ownermap_flush(u, b, &ownermap);
+	thread_ownermap = NULL;
+	free(ownermap.map);
+
+	if (thread_board) {
+		thread_board = NULL;
+		board_done_noalloc(&board);
+	}
+#endif
 	return i;
 }